@@ -0,0 +1,157 @@
+#!/bin/sh
+#########################################################################################################################################################
+## Program Filename: bench/bench.sh
+## Description:
+##              Benchmark suite for smallsh's hot paths, run by "make bench". Each measurement becomes a line of a TSV results file
+##              (metric, value, unit, which direction is better) that is compared against a stored baseline: a metric that got worse
+##              by more than the tolerance is a regression and makes the run fail. "make bench-baseline" stores a new baseline.
+##
+##              prompt_p50, prompt_p99       round trip from sending a line to the next prompt ("smallsh -i" driven by bench/drive)
+##              builtin_per_sec              "true" lines per second, run in the shell
+##              external_per_sec             "command true" lines per second, one spawn each
+##              spawn_{posix,fork}_p50/p99   time the shell is blocked starting a child, from the "stats" built in
+##              reap_jobs_per_sec            "sleep 0 &" jobs started and reaped per second with BENCH_JOBS in the stream
+##              serve_requests_per_sec       "true" requests per second to "smallsh --serve" from BENCH_CLIENTS clients (bench/serve)
+##              serve_p50, serve_p99         request latency through the server, connect to close
+##              parse_*_tokens_per_sec       parse_line() on a BENCH_LINE_ARGS argument line with each tokenizer (bench/tokenize)
+##              fanout_mb_per_sec            BENCH_FANOUT_MB of output copied to two files and a "wc -c" with ">& ... |>"
+##              fanout_tee_mb_per_sec        the same copies made by chained "tee" processes, for comparison
+##              glob_entries_per_sec         directory entries matched per second by "*7" patterns over BENCH_GLOB_FILES files
+##
+## Usage: sh bench/bench.sh [--baseline]
+##        Environment: BENCH_COMMANDS (2000), BENCH_JOBS (10000), BENCH_LINE_ARGS (100000), BENCH_CLIENTS (100),
+##                     BENCH_FANOUT_MB (512), BENCH_GLOB_FILES (200000), BENCH_TOLERANCE (percent, 20), BENCH_RESULTS (bench/results.tsv), BENCH_BASELINE (bench/baseline.tsv)
+##
+#########################################################################################################################################################
+
+SMALLSH=./smallsh
+COMMANDS=${BENCH_COMMANDS:-2000}
+JOBS=${BENCH_JOBS:-10000}
+LINE_ARGS=${BENCH_LINE_ARGS:-100000}
+CLIENTS=${BENCH_CLIENTS:-100}
+FANOUT_MB=${BENCH_FANOUT_MB:-512}
+GLOB_FILES=${BENCH_GLOB_FILES:-200000}
+TOLERANCE=${BENCH_TOLERANCE:-20}
+RESULTS=${BENCH_RESULTS:-bench/results.tsv}
+BASELINE=${BENCH_BASELINE:-bench/baseline.tsv}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+#record metric value unit better
+record()
+{
+     printf '%s\t%s\t%s\t%s\n' "$1" "$2" "$3" "$4" >> "$RESULTS.new"
+     printf '  %-28s %14s %s\n' "$1" "$2" "$3"
+}
+
+#converts a "stats" duration (us, ms or s) to microseconds
+to_usec()
+{
+     echo "$1" | awk '/us$/ { print $0 + 0; next } /ms$/ { print $0 * 1000; next } { print $0 * 1000000 }'
+}
+
+#rate script lines: runs a script of lines copies of a command and prints lines per second
+rate()
+{
+     awk -v n="$1" -v line="$2" 'BEGIN { for (i = 0; i < n; i++) print line }' > "$work/rate.sh"
+     start=$(date +%s%N)
+     $SMALLSH "$work/rate.sh" > /dev/null
+     end=$(date +%s%N)
+     awk -v n="$1" -v ns="$((end - start))" 'BEGIN { printf "%.0f\n", n / (ns / 1e9) }'
+}
+
+#throughput line: runs a one line script that moves FANOUT_MB and prints MB per second
+throughput()
+{
+     echo "$1" > "$work/throughput.sh"
+     start=$(date +%s%N)
+     $SMALLSH "$work/throughput.sh" > /dev/null
+     end=$(date +%s%N)
+     rm -f "$work/a.log" "$work/b.log"
+     awk -v mb="$FANOUT_MB" -v ns="$((end - start))" 'BEGIN { printf "%.0f\n", mb / (ns / 1e9) }'
+}
+
+#spawn engine: spawn latency percentiles from "stats" after COMMANDS external commands
+spawn()
+{
+     awk -v n="$COMMANDS" 'BEGIN { for (i = 0; i < n; i++) print "command true"; print "stats" }' > "$work/spawn.sh"
+     line=$(SMALLSH_SPAWN=$1 $SMALLSH "$work/spawn.sh" | grep "^spawn $1 ")
+     record "spawn_$1_p50" "$(to_usec "$(echo "$line" | awk '{ print $4 }')")" us lower
+     record "spawn_$1_p99" "$(to_usec "$(echo "$line" | awk '{ print $5 }')")" us lower
+}
+
+rm -f "$RESULTS.new"
+echo "smallsh benchmarks ($COMMANDS commands, $JOBS jobs, $LINE_ARGS argument line)"
+
+bench/drive prompt $SMALLSH "$COMMANDS" > "$work/prompt" || exit 1
+record prompt_p50 "$(awk '$1 == "prompt_p50" { print $2 }' "$work/prompt")" us lower
+record prompt_p99 "$(awk '$1 == "prompt_p99" { print $2 }' "$work/prompt")" us lower
+
+record builtin_per_sec "$(rate "$((COMMANDS * 50))" true)" lines/s higher
+record external_per_sec "$(rate "$COMMANDS" "command true")" lines/s higher
+
+spawn posix
+spawn fork
+
+bench/drive reap $SMALLSH "$JOBS" > "$work/reap" || exit 1
+record reap_jobs_per_sec "$(awk '{ print $2 }' "$work/reap")" jobs/s higher
+
+$SMALLSH --serve "$work/sock" > /dev/null &
+server=$!
+while [ ! -S "$work/sock" ] && kill -0 "$server" 2> /dev/null
+do
+     sleep 0.01
+done
+bench/serve "$work/sock" "$CLIENTS" "$((COMMANDS * 10))" > "$work/serve"
+kill "$server"
+wait "$server"
+record serve_requests_per_sec "$(awk '$1 == "serve_requests_per_sec" { print $2 }' "$work/serve")" requests/s higher
+record serve_p50 "$(awk '$1 == "serve_p50" { print $2 }' "$work/serve")" us lower
+record serve_p99 "$(awk '$1 == "serve_p99" { print $2 }' "$work/serve")" us lower
+
+bench/tokenize "$LINE_ARGS" 10 | awk 'NR > 1 { print $1, $2 }' | while read -r isa tokens
+do
+     record "parse_${isa}_tokens_per_sec" "$tokens" tokens/s higher
+done
+
+fanout_source="head -c $((FANOUT_MB * 1048576)) /dev/zero"
+record fanout_mb_per_sec "$(throughput "$fanout_source >& $work/a.log $work/b.log |> wc -c")" MB/s higher
+record fanout_tee_mb_per_sec "$(throughput "$fanout_source | tee $work/a.log | tee $work/b.log | wc -c")" MB/s higher
+
+#the first line reads the directory, the rest match against the cached listing (an mtime from just now isn't trusted)
+mkdir "$work/glob"
+(cd "$work/glob" && seq "$GLOB_FILES" | xargs touch)
+touch -d "1 minute ago" "$work/glob"
+record glob_entries_per_sec "$(rate 20 "echo $work/glob/*7 > /dev/null" | awk -v n="$GLOB_FILES" '{ print $1 * n }')" entries/s higher
+rm -rf "$work/glob"
+
+mv "$RESULTS.new" "$RESULTS"
+
+if [ "$1" = "--baseline" ]
+then
+     cp "$RESULTS" "$BASELINE"
+     echo "baseline saved to $BASELINE"
+     exit 0
+fi
+
+if [ ! -f "$BASELINE" ]
+then
+     echo "no baseline at $BASELINE, run \"make bench-baseline\" to store one"
+     exit 0
+fi
+
+#compare every metric found in both files, worse by more than TOLERANCE percent is a regression
+awk -F '\t' -v tolerance="$TOLERANCE" '
+     NR == FNR { baseline[$1] = $2; next }
+     ($1 in baseline) && (baseline[$1] > 0) {
+          change = (($2 - baseline[$1]) * 100) / baseline[$1]
+          worse = ($4 == "higher") ? -change : change
+          verdict = (worse > tolerance) ? "REGRESSION" : "ok"
+          if (verdict != "ok") failed++
+          printf "  %-28s %14s -> %-14s %+7.1f%%  %s\n", $1, baseline[$1], $2, change, verdict
+     }
+     END {
+          if (failed > 0) { printf "%d regression(s) beyond %s%%\n", failed, tolerance; exit 1 }
+          printf "no regressions beyond %s%%\n", tolerance
+     }' "$BASELINE" "$RESULTS"
@@ -0,0 +1,292 @@
+/********************************************************************************************************************************************************
+*** Program Filename: bench/drive.c
+*** Description:
+***              Drives a running smallsh through pipes for the measurements bench/bench.sh can't take from a script:
+***
+***              prompt: starts "smallsh -i", sends empty lines one at a time and times each one until the next ": " prompt comes
+***                      back. Prints the p50 and p99 round trip in microseconds.
+***              reap:   sends "sleep 0 &" lines as fast as the shell takes them and counts the "Background pid ... is done"
+***                      reports. Prints how many jobs per second were started and reaped.
+***
+***              Output is "name<TAB>value" lines for bench/bench.sh.
+***
+*** Usage: bench/drive prompt|reap smallsh_path count
+***
+* ********************************************************************************************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define DRIVE_BUFSIZE 65536
+
+/*************************************
+FUNCTION PROTOTYPES
+*************************************/
+pid_t drive_start(const char *shell, const char *option, int *to_shell, int *from_shell); //starts smallsh with its stdin and stdout on pipes
+long long drive_nsec(); //CLOCK_MONOTONIC in nanoseconds
+int drive_compare(const void *a, const void *b); //qsort() order for round trip times
+int drive_prompt(const char *shell, int count); //prompt round trip measurement
+int drive_reap(const char *shell, int count); //background reap throughput measurement
+
+
+int main(int argc, char *argv[])
+{
+     int count;
+
+     if (argc != 4)
+     {
+          printf("usage: bench/drive prompt|reap smallsh_path count\n");
+          return 2;
+     }
+
+     signal(SIGPIPE, SIG_IGN);
+     count = atoi(argv[3]);
+
+     if (strcmp(argv[1], "prompt") == 0)
+     {
+          return drive_prompt(argv[2], count);
+     }
+     if (strcmp(argv[1], "reap") == 0)
+     {
+          return drive_reap(argv[2], count);
+     }
+
+     printf("bench/drive: unknown measurement %s\n", argv[1]);
+     return 2;
+}
+
+/**********************************************************************
+** Function: drive_start(const char *shell, const char *option,
+**                       int *to_shell, int *from_shell)
+** Description: starts the shell (with option, if not NULL) with its
+**              stdin and stdout connected to pipes. Returns its pid.
+** Parameters: the shell, an option for it and where to store the
+**             pipe ends the driver keeps
+**********************************************************************/
+pid_t drive_start(const char *shell, const char *option, int *to_shell, int *from_shell)
+{
+     int input[2];
+     int output[2];
+     pid_t pid;
+
+     pipe2(input, O_CLOEXEC);
+     pipe2(output, O_CLOEXEC);
+
+     pid = fork();
+     if (pid == 0)
+     {
+          dup2(input[0], 0);
+          dup2(output[1], 1);
+          execl(shell, shell, option, (char *)NULL);
+          _exit(127);
+     }
+
+     close(input[0]);
+     close(output[1]);
+     *to_shell = input[1];
+     *from_shell = output[0];
+
+     return pid;
+}
+
+/**********************************************************************
+** Function: drive_nsec()
+** Description: returns the CLOCK_MONOTONIC time in nanoseconds
+** Parameters: none
+**********************************************************************/
+long long drive_nsec()
+{
+     struct timespec now;
+
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+/**********************************************************************
+** Function: drive_compare(const void *a, const void *b)
+** Description: orders round trip times for qsort()
+** Parameters: the two times
+**********************************************************************/
+int drive_compare(const void *a, const void *b)
+{
+     long long left = *(const long long *)a;
+     long long right = *(const long long *)b;
+
+     return (left > right) - (left < right);
+}
+
+/**********************************************************************
+** Function: drive_prompt(const char *shell, int count)
+** Description: times count empty lines from being sent to the shell
+**              until its next prompt arrives. Returns the exit status.
+** Parameters: the shell and the number of round trips
+**********************************************************************/
+int drive_prompt(const char *shell, int count)
+{
+     long long *times = malloc(count * sizeof(long long));
+     char buffer[DRIVE_BUFSIZE];
+     int to_shell, from_shell;
+     int status;
+     int i;
+
+     drive_start(shell, "-i", &to_shell, &from_shell);
+
+     //the first prompt, then one round trip per line
+     for (i = -1; i < count; i++)
+     {
+          long long start = drive_nsec();
+          size_t seen = 0;
+
+          if ((i >= 0) && (write(to_shell, "\n", 1) != 1))
+          {
+               printf("bench/drive: the shell went away\n");
+               return 1;
+          }
+
+          while (1)
+          {
+               ssize_t bytes = read(from_shell, buffer + seen, sizeof(buffer) - seen - 1);
+
+               if (bytes <= 0)
+               {
+                    printf("bench/drive: the shell went away\n");
+                    return 1;
+               }
+               seen += bytes;
+               buffer[seen] = '\0';
+
+               if ((seen >= 2) && (strcmp(buffer + seen - 2, ": ") == 0))
+               {
+                    break;
+               }
+               if (seen == sizeof(buffer) - 1)
+               {
+                    seen = 0;
+               }
+          }
+
+          if (i >= 0)
+          {
+               times[i] = drive_nsec() - start;
+          }
+     }
+
+     close(to_shell);
+     wait(&status);
+
+     qsort(times, count, sizeof(long long), drive_compare);
+     printf("prompt_p50\t%.1f\n", times[count / 2] / 1000.0);
+     printf("prompt_p99\t%.1f\n", times[(count * 99) / 100] / 1000.0);
+
+     free(times);
+     return 0;
+}
+
+/**********************************************************************
+** Function: drive_reap(const char *shell, int count)
+** Description: feeds count "sleep 0 &" lines to the shell while
+**              counting its "is done" reports, so starting and
+**              reaping overlap like they do for a real job fan out.
+**              Returns the exit status.
+** Parameters: the shell and the number of jobs
+**********************************************************************/
+int drive_reap(const char *shell, int count)
+{
+     const char *line = "sleep 0 &\n";
+     size_t line_length = strlen(line);
+     char buffer[DRIVE_BUFSIZE];
+     char *pending = malloc(line_length * count);
+     size_t pending_length = line_length * count;
+     size_t sent = 0;
+     size_t kept = 0;   //partial output line carried over to the next read
+     int reaped = 0;
+     int to_shell, from_shell;
+     long long start;
+     int status;
+     int i;
+
+     for (i = 0; i < count; i++)
+     {
+          memcpy(pending + (i * line_length), line, line_length);
+     }
+
+     drive_start(shell, NULL, &to_shell, &from_shell);
+     fcntl(to_shell, F_SETFL, O_NONBLOCK);
+
+     start = drive_nsec();
+
+     while (reaped < count)
+     {
+          struct pollfd waits[2];
+          int num_waits = 0;
+
+          waits[num_waits].fd = from_shell;
+          waits[num_waits].events = POLLIN;
+          num_waits++;
+          if (sent < pending_length)
+          {
+               waits[num_waits].fd = to_shell;
+               waits[num_waits].events = POLLOUT;
+               num_waits++;
+          }
+
+          poll(waits, num_waits, -1);
+
+          if ((num_waits == 2) && (waits[1].revents != 0))
+          {
+               ssize_t bytes = write(to_shell, pending + sent, pending_length - sent);
+
+               if (bytes > 0)
+               {
+                    sent += bytes;
+               }
+          }
+
+          if (waits[0].revents != 0)
+          {
+               ssize_t bytes = read(from_shell, buffer + kept, sizeof(buffer) - kept - 1);
+               char *scan = buffer;
+               char *newline;
+
+               if (bytes <= 0)
+               {
+                    printf("bench/drive: the shell went away after %d jobs\n", reaped);
+                    return 1;
+               }
+               buffer[kept + bytes] = '\0';
+
+               while ((newline = strchr(scan, '\n')) != NULL)
+               {
+                    *newline = '\0';
+                    if (strstr(scan, "is done") != NULL)
+                    {
+                         reaped++;
+                    }
+                    scan = newline + 1;
+               }
+
+               kept = strlen(scan);
+               memmove(buffer, scan, kept);
+               if (kept == sizeof(buffer) - 1)
+               {
+                    kept = 0;
+               }
+          }
+     }
+
+     printf("reap_jobs_per_sec\t%.0f\n", count / ((drive_nsec() - start) / 1e9));
+
+     close(to_shell);
+     wait(&status);
+     free(pending);
+     return 0;
+}
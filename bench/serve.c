@@ -0,0 +1,247 @@
+/********************************************************************************************************************************************************
+*** Program Filename: bench/serve.c
+*** Description:
+***              Load generator for "smallsh --serve". Keeps "clients" connections open at once, each sending the command line and reading
+***              the output until the server closes the connection, and opens a new one until requests have been answered. The trailer
+***              after the last '\0' of each response is checked for "status=0".
+***
+***              Prints the requests per second and the p50 and p99 request latency in microseconds as "name<TAB>value" lines for
+***              bench/bench.sh, plus a "failed" line if any request didn't come back with status 0.
+***
+*** Usage: bench/serve socket_path clients requests [command]
+***
+* ********************************************************************************************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVE_BUFSIZE 4096
+#define SERVE_TRAILER 256  //the end of a response that is kept to find the trailer
+
+typedef struct client
+{
+     int fd;
+     long long start;              //when the request was sent
+     char tail[SERVE_TRAILER + 1]; //last bytes of the response
+     size_t tail_length;
+}client;
+
+/*************************************
+FUNCTION PROTOTYPES
+*************************************/
+long long serve_nsec(); //CLOCK_MONOTONIC in nanoseconds
+int serve_compare(const void *a, const void *b); //qsort() order for latencies
+int serve_connect(const char *path, client *current, const char *request, size_t request_length); //opens a connection and sends the request
+int serve_trailer_ok(client *current); //checks the trailer of a finished response
+
+
+int main(int argc, char *argv[])
+{
+     struct epoll_event event;
+     struct epoll_event events[64];
+     char buffer[SERVE_BUFSIZE];
+     char request[1024];
+     size_t request_length;
+     client *clients;
+     long long *latencies;
+     long long start;
+     int num_clients, num_requests;
+     int sent = 0, answered = 0, failed = 0;
+     int epoll_fd;
+     int i;
+
+     if ((argc != 4) && (argc != 5))
+     {
+          printf("usage: bench/serve socket_path clients requests [command]\n");
+          return 2;
+     }
+
+     signal(SIGPIPE, SIG_IGN);
+     num_clients = atoi(argv[2]);
+     num_requests = atoi(argv[3]);
+     snprintf(request, sizeof(request), "%s\n", (argc == 5) ? argv[4] : "true");
+     request_length = strlen(request);
+
+     if (num_clients > num_requests)
+     {
+          num_clients = num_requests;
+     }
+
+     clients = calloc(num_clients, sizeof(client));
+     latencies = malloc(num_requests * sizeof(long long));
+     epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+     start = serve_nsec();
+
+     for (i = 0; i < num_clients; i++)
+     {
+          if (serve_connect(argv[1], &clients[i], request, request_length) == -1)
+          {
+               printf("bench/serve: can't connect to %s: %s\n", argv[1], strerror(errno));
+               return 1;
+          }
+          event.events = EPOLLIN;
+          event.data.u32 = i;
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &event);
+          sent++;
+     }
+
+     while (answered < num_requests)
+     {
+          int num_events = epoll_wait(epoll_fd, events, 64, -1);
+
+          for (i = 0; i < num_events; i++)
+          {
+               client *current = &clients[events[i].data.u32];
+               ssize_t bytes = read(current->fd, buffer, sizeof(buffer));
+
+               if (bytes > 0)
+               {
+                    //only the end of the response matters, keep the last SERVE_TRAILER bytes
+                    if ((size_t)bytes >= SERVE_TRAILER)
+                    {
+                         memcpy(current->tail, buffer + bytes - SERVE_TRAILER, SERVE_TRAILER);
+                         current->tail_length = SERVE_TRAILER;
+                    }
+                    else
+                    {
+                         size_t keep = SERVE_TRAILER - bytes;
+
+                         if (current->tail_length > keep)
+                         {
+                              memmove(current->tail, current->tail + current->tail_length - keep, keep);
+                              current->tail_length = keep;
+                         }
+                         memcpy(current->tail + current->tail_length, buffer, bytes);
+                         current->tail_length += bytes;
+                    }
+                    continue;
+               }
+               if ((bytes == -1) && (errno == EINTR))
+               {
+                    continue;
+               }
+
+               //the server closed the connection, the response is complete
+               latencies[answered++] = serve_nsec() - current->start;
+               if (!serve_trailer_ok(current))
+               {
+                    failed++;
+               }
+               close(current->fd);
+
+               if (sent < num_requests)
+               {
+                    if (serve_connect(argv[1], current, request, request_length) == -1)
+                    {
+                         printf("bench/serve: can't connect to %s: %s\n", argv[1], strerror(errno));
+                         return 1;
+                    }
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, current->fd, &events[i]);
+                    sent++;
+               }
+          }
+     }
+
+     printf("serve_requests_per_sec\t%.0f\n", num_requests / ((serve_nsec() - start) / 1e9));
+
+     qsort(latencies, num_requests, sizeof(long long), serve_compare);
+     printf("serve_p50\t%.1f\n", latencies[num_requests / 2] / 1000.0);
+     printf("serve_p99\t%.1f\n", latencies[(num_requests * 99) / 100] / 1000.0);
+     if (failed > 0)
+     {
+          printf("failed\t%d\n", failed);
+     }
+
+     free(clients);
+     free(latencies);
+     return (failed > 0);
+}
+
+/**********************************************************************
+** Function: serve_nsec()
+** Description: returns the CLOCK_MONOTONIC time in nanoseconds
+** Parameters: none
+**********************************************************************/
+long long serve_nsec()
+{
+     struct timespec now;
+
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+/**********************************************************************
+** Function: serve_compare(const void *a, const void *b)
+** Description: orders latencies for qsort()
+** Parameters: the two latencies
+**********************************************************************/
+int serve_compare(const void *a, const void *b)
+{
+     long long left = *(const long long *)a;
+     long long right = *(const long long *)b;
+
+     return (left > right) - (left < right);
+}
+
+/**********************************************************************
+** Function: serve_connect(const char *path, client *current,
+**                         const char *request, size_t request_length)
+** Description: connects to the server, sends the request and resets
+**              the client. Returns -1 if the connection failed.
+** Parameters: the socket path, the client and the request line
+**********************************************************************/
+int serve_connect(const char *path, client *current, const char *request, size_t request_length)
+{
+     struct sockaddr_un address;
+
+     memset(&address, 0, sizeof(address));
+     address.sun_family = AF_UNIX;
+     strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+     current->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+     current->start = serve_nsec();
+     current->tail_length = 0;
+
+     if (connect(current->fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+     {
+          return -1;
+     }
+
+     //a request is far smaller than the socket buffer, it goes out in one write
+     if (write(current->fd, request, request_length) != (ssize_t)request_length)
+     {
+          return -1;
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: serve_trailer_ok(client *current)
+** Description: returns 1 if the response ended with a trailer that
+**              reports status 0
+** Parameters: the finished client
+**********************************************************************/
+int serve_trailer_ok(client *current)
+{
+     char *trailer = memrchr(current->tail, '\0', current->tail_length);
+
+     if (trailer == NULL)
+     {
+          return 0;
+     }
+
+     current->tail[current->tail_length] = '\0'; //the trailer ends with a newline, not a '\0'
+     return strncmp(trailer + 1, "status=0 ", 9) == 0;
+}
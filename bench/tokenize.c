@@ -0,0 +1,75 @@
+/********************************************************************************************************************************************************
+*** Program Filename: bench/tokenize.c
+*** Description:
+***              Micro-benchmark for smallsh's tokenizer. Builds one very long command line (100000 arguments by default, every tenth one
+***              quoted) and times parse_line() on it with each smallsh_find_special() version the CPU supports, reporting tokens/sec.
+***
+*** Usage: bench/tokenize [num_args] [iterations]
+***
+* ********************************************************************************************************************************************************/
+
+#define SMALLSH_NO_MAIN
+#include "../smallsh.c"
+
+int main(int argc, char *argv[])
+{
+     const char *versions[] = { "scalar", "sse2", "avx2" };
+     int num_args = (argc > 1) ? atoi(argv[1]) : 100000;
+     int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+     size_t line_size = (size_t)num_args * 32 + 16;
+     char *line = malloc(line_size);
+     char *work = malloc(line_size);
+     size_t length = 0;
+     int v;
+     int i;
+
+     //every tenth argument is quoted so the unquoting path is part of the measurement
+     length += sprintf(line, "command");
+     for (i = 1; i < num_args; i++)
+     {
+          if ((i % 10) == 0)
+          {
+               length += sprintf(line + length, " 'quoted argument %d'", i);
+          }
+          else
+          {
+               length += sprintf(line + length, " argument%d", i);
+          }
+     }
+
+     printf("%d arguments, %zu byte line, %d iterations\n", num_args, length, iterations);
+
+     for (v = 0; v < 3; v++)
+     {
+          struct timespec start, end;
+          double seconds;
+          int tokens = 0;
+
+          if (strcmp(smallsh_tokenizer_init(versions[v]), versions[v]) != 0)
+          {
+               continue; //not supported on this CPU
+          }
+
+          clock_gettime(CLOCK_MONOTONIC, &start);
+
+          for (i = 0; i < iterations; i++)
+          {
+               memcpy(work, line, length + 1); //parse_line() splits the line in place
+               smallsh_arena_reset(&command_arena);
+               parse_line(work, &tokens);
+          }
+
+          clock_gettime(CLOCK_MONOTONIC, &end);
+          seconds = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9);
+
+          if (tokens != num_args)
+          {
+               printf("%s: expected %d tokens, got %d\n", versions[v], num_args, tokens);
+               return 1;
+          }
+
+          printf("%-6s %12.0f tokens/sec %8.1f MB/s\n", versions[v], ((double)tokens * iterations) / seconds, ((double)length * iterations) / seconds / 1e6);
+     }
+
+     return 0;
+}
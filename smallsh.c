@@ -18,8 +18,11 @@
 ***
 * ********************************************************************************************************************************************************/
 
+#define _GNU_SOURCE   // POSIX_SPAWN_USEVFORK and other glibc extensions
+
 #include <stdio.h>
 #include <stdlib.h>    // getenv 
+#include <ctype.h>     // isalnum()
 #include <string.h>    // strcmp(), strtok()
 #include <sys/stat.h>  
 #include <sys/types.h> // getpid()
@@ -27,6 +30,30 @@
 #include <unistd.h>    // chdir(), fork(), exec()
 #include <fcntl.h>     // file control
 #include <signal.h>    
+#include <spawn.h>     // posix_spawn()
+#include <errno.h>
+#include <time.h>      // clock_gettime()
+#include <limits.h>    // PATH_MAX
+#include <dirent.h>    // DT_DIR
+#include <stdint.h>
+#include <sys/epoll.h>     // epoll_wait()
+#include <sys/signalfd.h>  // signalfd()
+#include <sys/timerfd.h>   // timerfd_create()
+#include <sys/syscall.h>   // pidfd_open()
+#include <sys/mman.h>      // memfd_create()
+#include <poll.h>
+#include <sys/sendfile.h>  // sendfile()
+#include <sys/resource.h>  // wait4(), getrusage()
+#include <sched.h>         // sched_setaffinity()
+#include <sys/socket.h>    // --serve
+#include <sys/un.h>
+#include <sys/prctl.h>     // PR_SET_PDEATHSIG
+#include <getopt.h>        // getopt_long()
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h> // SSE2/AVX2 tokenizer, chosen at runtime
+#define TOKENIZER_X86
+#endif
 
 /*************************************
 GLOBALS AND CONSTANTS VARIABLES
@@ -36,43 +63,840 @@ GLOBALS AND CONSTANTS VARIABLES
 #define TOKEN_BUFSIZE 64
 #define TOKEN_DELIM " \t\r\n\a"
 
-//Singly linked list implementation for keeping a list of background processes to kill once shell is exiting (To prevent orphans)
-typedef struct bg_child
+//Character classes used by the tokenizer
+#define TOKEN_CLASS_DELIM 1     //one of TOKEN_DELIM
+#define TOKEN_CLASS_QUOTE 2     //' " or \, the word needs unquoting
+#define TOKEN_CLASS_OPERATOR 4  //first character of a shell operator
+#define TOKEN_CLASS_BREAK 8     //first character of ";", "&&" or "||", which end a word even without a delimiter
+
+const unsigned char token_class[256] = {
+     [' '] = TOKEN_CLASS_DELIM, ['\t'] = TOKEN_CLASS_DELIM, ['\r'] = TOKEN_CLASS_DELIM, ['\n'] = TOKEN_CLASS_DELIM, ['\a'] = TOKEN_CLASS_DELIM,
+     ['\''] = TOKEN_CLASS_QUOTE, ['"'] = TOKEN_CLASS_QUOTE, ['\\'] = TOKEN_CLASS_QUOTE,
+     ['|'] = TOKEN_CLASS_OPERATOR | TOKEN_CLASS_BREAK, ['<'] = TOKEN_CLASS_OPERATOR, ['>'] = TOKEN_CLASS_OPERATOR,
+     ['&'] = TOKEN_CLASS_OPERATOR | TOKEN_CLASS_BREAK, [';'] = TOKEN_CLASS_OPERATOR | TOKEN_CLASS_BREAK
+};
+
+//Unquoted operator tokens are replaced by these pointers, see smallsh_is_operator()
+const char *shell_operators[] = { "|", "<", ">", ">>", "&", ";", "&&", "||", ">&", "|>", NULL };
+#define SHELL_OPERATOR_SEMICOLON 5 //index of ";"
+
+//A "$" that was quoted or escaped is kept as this byte by parse_line() so smallsh_expand() leaves it alone
+#define EXPAND_LITERAL_DOLLAR '\001'
+#define EXPAND_SPECIAL "$\001"
+
+//Quoted or escaped glob characters are kept as these bytes the same way, smallsh_glob() takes them literally
+#define GLOB_LITERAL_STAR '\002'
+#define GLOB_LITERAL_QUESTION '\003'
+#define GLOB_LITERAL_BRACKET '\004'
+#define GLOB_SPECIAL "*?[\002\003\004"
+#define GLOB_LITERALS "\002\003\004"
+
+//Redirections that name a descriptor ("2>", "2>>", "0<") or duplicate one ("2>&1", ">&2", "3<&0", "2>&-") are interned
+//here the first time an unquoted one is seen, so they are recognized by address like shell_operators. Descriptors are
+//0-9 and a slot is addressed by [descriptor or 10 for none][operator][target descriptor, 10 for "-" or 11 for none].
+#define REDIRECT_MAX_FD 9
+#define REDIRECT_FD_BASE 10     //files opened for redirections are moved to here or above, out of the way of the dup2()s
+#define REDIRECT_OPERATORS 5    //"<", ">", ">>", "<&", ">&"
+char redirect_words[REDIRECT_MAX_FD + 2][REDIRECT_OPERATORS][REDIRECT_MAX_FD + 3][6];
+
+//One redirection, applied in order after the stage's pipes
+typedef struct redirect
+{
+     int fd;          //descriptor set up in the command
+     int source_fd;   //file opened by the shell (opened is 1) or the command's descriptor it duplicates, -1 closes fd
+     int opened;
+}redirect;
+
+//Version of smallsh_find_special() picked for this CPU by smallsh_tokenizer_init()
+const char *(*smallsh_find_special)(const char *text, const char *end);
+
+//Per-command arena: the token array, pipeline stages and other per-line data are carved from here and
+//released all at once before the next line. Blocks are kept, so once the arena has grown to fit the
+//longest line the command loop does not allocate. A single allocation over ARENA_LARGE_SIZE (a glob that
+//matched a huge directory) gets a block of its own that the next reset frees, so the arena doesn't keep it.
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_LARGE_SIZE (1 << 20)
+
+typedef struct arena_block
+{
+     struct arena_block *next;
+     size_t size;
+     size_t used;
+     char data[];
+}arena_block;
+
+typedef struct arena
+{
+     arena_block *first;
+     arena_block *current;  //block allocations are taken from
+     arena_block *last;
+     arena_block *large;    //allocations over ARENA_LARGE_SIZE, freed by the next reset
+}arena;
+
+arena command_arena;
+
+//Command tree for lists ("a ; b", "a && b", "a || b") and blocks (if, while, until, for). A block is read to its end,
+//with "> " prompts for the rest of it, parsed once into nodes in block_arena and then run as often as it loops. Each
+//command copies its words into the command arena, which is reset before the next one, so a long loop runs in flat memory.
+#define NODE_COMMAND 0  //words for smallsh_execute()
+#define NODE_LIST 1     //left, then right
+#define NODE_AND 2      //right if left succeeded
+#define NODE_OR 3       //right if left failed
+#define NODE_IF 4       //left is the condition, right the "then" part and other the "else" part (an "elif" is a NODE_IF)
+#define NODE_WHILE 5    //left is the condition, right the body
+#define NODE_UNTIL 6
+#define NODE_FOR 7      //name is bound to each of words in turn for the body in right
+
+#define PARSE_OK 0
+#define PARSE_INCOMPLETE 1  //the block goes on past the last token, another line is needed
+#define PARSE_ERROR 2
+
+#define BLOCK_EXIT 0    //smallsh_run_node() results: "exit" ran
+#define BLOCK_NEXT 1    //carry on
+#define BLOCK_STOP 2    //-e saw a failure or SIGINT came in, the rest of the block is skipped
+
+typedef struct command_node
+{
+     int type;
+     char **words;     //NODE_COMMAND words or the NODE_FOR list, part of the block's tokens
+     int num_words;
+     char *name;       //NODE_FOR variable
+     struct command_node *left;
+     struct command_node *right;
+     struct command_node *other;
+}command_node;
+
+typedef struct token_cursor
+{
+     char **tokens;
+     int position;
+     int count;
+}token_cursor;
+
+arena block_arena;   //the tokens and tree of the block being run
+
+//A "for" variable is a shell variable: "$name" sees it before the environment, but it is never exported to the
+//commands in the body. Bindings are a stack that lives in the frames of the loops, the innermost one wins.
+typedef struct shell_variable
+{
+     const char *name;
+     const char *value;
+     struct shell_variable *next;   //outer binding
+}shell_variable;
+
+shell_variable *shell_variables = NULL;
+
+//Reserved words are only special where a command starts
+const char *reserved_words[] = { "if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done", NULL };
+
+int condition_depth = 0;                      //>0 while a condition runs, -e doesn't stop for failures there
+volatile sig_atomic_t block_interrupted = 0;  //set by SIGINT while a block or "wait" runs
+const char *prompt = ": ";                    //"> " while the rest of a block is read
+pid_t last_background_pid = 0;               //"$!"
+pid_t wait_pid = 0;                           //the job "wait pid..." waits for last and how it ended
+int wait_status = 0;
+
+//Server mode ("smallsh --serve socket"): the parent binds the socket and keeps a pool of forked workers alive. Each
+//worker accepts on the shared socket (EPOLLEXCLUSIVE wakes one worker per connection) and holds up to
+//SERVE_CONNECTIONS clients with a fixed line buffer each, so memory stays bounded however many connect; the rest wait
+//in the listen backlog. A client sends one command line and gets the command's output, then a trailer that starts
+//with a '\0': "status=N signal=N timed_out=0|1 real_us=N user_us=N sys_us=N maxrss_kb=N\n". Then the connection is closed.
+#define SERVE_CONNECTIONS 1024       //clients per worker
+#define SERVE_BACKLOG 4096
+#define SERVE_LISTEN ((uint64_t)-1)  //epoll data for the socket and the job event loop, clients use their slot
+#define SERVE_JOBS ((uint64_t)-2)
+
+typedef struct serve_client
+{
+     int fd;                //-1 when the slot is free
+     int used;              //bytes of the line read so far
+     char line[MAX_LENGTH];
+}serve_client;
+
+int serve_stdout = -1;      //the worker's own stdout and stderr while a request has them
+int serve_stderr = -1;
+int serve_home = -1;        //directory every request starts in
+
+//Engines smallsh_launch() can use to start external commands (switch with the "spawn" built in or SMALLSH_SPAWN=fork)
+#define SPAWN_FORK 0  //classic fork() then redirect and exec() in the child
+#define SPAWN_POSIX 1 //posix_spawn(), which glibc runs as clone(CLONE_VM|CLONE_VFORK) so no page tables are copied
+
+int spawn_mode = SPAWN_POSIX;
+long spawn_count[2] = { 0, 0 };        //number of launches done by each engine
+long long spawn_nsec[2] = { 0, 0 };    //total time the shell spent blocked starting children with each engine
+
+//CPU and scheduling placement set with the "on" prefix or the "placement" session default for background jobs.
+//It is applied by the child before exec(), which posix_spawn() can't do, so placed children use the fork engine.
+#ifndef MPOL_BIND
+#define MPOL_BIND 2          //set_mempolicy() mode from <linux/mempolicy.h>
+#endif
+#define NUMA_MAX_NODES 1024  //nodes a set_mempolicy() mask can name
+
+typedef struct placement
+{
+     int active;          //0 if nothing is set
+     int has_cpus;
+     cpu_set_t cpus;      //allowed CPUs, already narrowed to the NUMA node's
+     int has_nice;
+     int nice;            //added to the shell's nice value, like nice(1)
+     int policy;          //SCHED_BATCH, SCHED_IDLE, SCHED_OTHER or -1 to keep the shell's
+     int numa_node;       //memory is bound to this node, -1 for none
+     int round_robin;     //each background job is pinned to the next CPU of the allowed set
+}placement;
+
+placement default_placement;          //"placement": used for background jobs started without "on"
+placement *command_placement = NULL;  //"on": used for the command it prefixes
+int placement_next_cpu = 0;           //where the round robin search for a CPU starts
+
+//cgroup v2 resource limits set with the "limit" prefix, or for a named "group" of jobs. A limited command gets its own
+//leaf under smallsh-<pid> in the shell's cgroup (or uses its group's) and the child moves itself into it before exec().
+//A limit whose controller isn't enabled, or every limit when cgroupfs isn't writable, becomes a setrlimit() in the child.
+#define CGROUP_NAME_LENGTH 64
+#define CGROUP_CONTROLLERS "+memory +cpu +pids"
+#define CPU_PERIOD_USEC 100000   //cpu.max period used for "cpu=N%"
+
+typedef struct resource_limits
+{
+     long long memory_max;   //memory.max in bytes (RLIMIT_AS in the fallback), -1 for none
+     long long cpu_quota;    //cpu.max microseconds per period (no fallback), -1 for none
+     long long cpu_period;
+     long long pids_max;     //pids.max (RLIMIT_NPROC in the fallback), -1 for none
+}resource_limits;
+
+typedef struct resource_group
+{
+     char name[CGROUP_NAME_LENGTH];  //"group" name, empty for the leaf of a "limit" command
+     char leaf[CGROUP_NAME_LENGTH + 8]; //the cgroup directory: group-<name> or job-<n>
+     resource_limits limits;
+     resource_limits fallback;       //the limits the cgroup couldn't take, set with setrlimit() instead
+     int dir_fd;                     //the cgroup directory, -1 if it couldn't be created
+     int procs_fd;                   //its cgroup.procs, the child writes "0" to move itself in
+     int refs;                       //jobs in it, plus the "limit" running and the "group" that names it
+     double memory_pressure;         //"some avg10" of memory.pressure and cpu.pressure, as of the last "jobs -l"
+     double cpu_pressure;
+     struct resource_group *next;    //next named group
+}resource_group;
+
+int cgroup_base_fd = -2;                 //smallsh-<pid> directory, -1 if cgroupfs isn't writable, -2 before the first use
+char cgroup_base_path[PATH_MAX];         //its path, for removing it when the shell exits
+char cgroup_origin_path[PATH_MAX] = "";  //the cgroup the shell was started in, if it moved to smallsh-<pid>/shell
+int cgroup_next_leaf = 1;                //numbers the leaves of "limit" commands
+resource_group *named_groups = NULL;     //"group" list
+resource_group *command_group = NULL;    //"limit": used for the command it prefixes
+
+//What an engine needs to start one child
+typedef struct spawn_request
+{
+     const char *path;   //resolved command
+     char **args;
+     int stdin_fd;       //dup2()'d onto stdin in the child, -1 keeps the shell's
+     int stdout_fd;      //dup2()'d onto stdout in the child, -1 keeps the shell's
+     int stdin_null;     //1 to read stdin from "/dev/null" (background command, a "<" redirection still wins)
+     const redirect *redirects; //applied in order after stdin/stdout
+     int num_redirects;
+     pid_t pgid;         //process group to join, 0 starts a new one, -1 stays in the shell's
+     const placement *place; //CPU and scheduling placement, NULL for none
+     int cpu;            //round robin CPU to pin to, -1 for none
+     const resource_group *group; //cgroup to join and limits to set, NULL for none
+     struct job_table *builtin_jobs; //set to run args as a built in in the forked shell instead of exec(), NULL for a program
+}spawn_request;
+
+//Resource accounting: children are reaped with wait4() and every command name gets a log-linear latency histogram
+//(HDR style: 2^(HISTOGRAM_SUB_BITS - 1) buckets per power of two, about 3% precision) and its total CPU time, so
+//"stats" can show percentiles without keeping every sample. Samples are microseconds of CLOCK_MONOTONIC time.
+#define HISTOGRAM_SUB_BITS 6    //values below 2^HISTOGRAM_SUB_BITS get a bucket each
+#define HISTOGRAM_MAX_BITS 41   //larger values (25 days) are counted in the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+#define STATS_TABLE_SIZE 64     //initial number of slots, always a power of 2
+
+typedef struct histogram
+{
+     uint32_t counts[HISTOGRAM_BUCKETS];
+     long total;        //number of samples
+     uint64_t max;      //largest sample, kept exactly
+}histogram;
+
+typedef struct command_stats
+{
+     char *name;
+     histogram wall;              //wall clock time of each run
+     long long user_usec;         //CPU time of all runs
+     long long sys_usec;
+     long max_rss;                //largest resident set seen, in KB
+     long voluntary_switches;
+     long involuntary_switches;
+}command_stats;
+
+struct
+{
+     command_stats **entries;  //open addressed by name with linear probing, NULL is empty
+     int size;
+     int count;
+}stats_table;
+
+histogram spawn_latency[2];       //time the shell was blocked in each engine, fork to exec for posix_spawn()
+struct rusage foreground_usage;   //children of foreground commands since "time" last cleared it
+
+//Pipelines: each stage is a command between "|"s. Stages that are only a redirection ("< file" or "> file")
+//and pure built ins are handled by the shell, which moves their data with splice(). Other built ins get a
+//forked copy of the shell, so "cd dir | cat" changes the directory of that copy only
+#define STAGE_EXTERNAL 0  //started with the spawn engine, a built in that isn't pure as a fork of the shell
+#define STAGE_BUILTIN 1   //pure built in, run in the shell
+#define STAGE_FILE 2      //only a redirection, spliced by the shell
+#define STAGE_FAILED 3    //command not found or could not be started
+
+#define PUMP_CHUNK (1 << 20)   //most bytes moved by one splice()
+#define PUMP_BUFSIZE 65536     //copy buffer for descriptors that can't be spliced
+
+typedef struct stage
+{
+     char **args;         //NULL terminated where the "|" was
+     int num_args;
+     int kind;
+     const char *path;    //resolved command for STAGE_EXTERNAL, NULL for a built in in a forked shell
+     redirect *redirects; //applied after the pipes, so they win over them
+     int num_redirects;
+     int input_fd;        //pipe the shell still holds (or the file of a redirection only stage), -1 for none
+     int output_fd;
+     int output_pipe;     //1 if output_fd is the pipe to the next stage
+     int buffer_fd;       //memfd a built in writes its piped output to, spliced into output_fd later, -1 for none
+     pid_t pid;
+     int status;          //waitpid() status, or exit status of a built in
+     struct timespec start_time;
+}stage;
+
+typedef struct splice_pair
+{
+     int in;
+     int out;
+     int in_pipe;         //which ends are pipes that poll() has to wait on
+     int out_pipe;
+     int done;
+}splice_pair;
+
+#define FAN_OUT_PIPE (1 << 20) //size asked for the fan out pipes, each target's pipe must hold at least what the source does
+
+//One copy of a fan out ("cmd >& a.log b.log |> gzip"): a file or the stdin pipe of a consumer command
+typedef struct fan_target
+{
+     int fd;              //file or consumer pipe the copy ends up in
+     int fd_pipe;         //1 if fd is a pipe that poll() has to wait on
+     int pipe_fds[2];     //the target's own pipe, filled from the source by tee() and emptied into fd by splice()
+     size_t pending;      //bytes waiting in pipe_fds
+     int done;
+}fan_target;
+
+typedef struct fan_out
+{
+     int source;          //read end of the pipe the last stage writes to
+     int source_write;    //its write end, until it is handed to the last stage
+     fan_target *targets;
+     int num_targets;
+     int active;          //targets that still take data
+     int eof;
+}fan_out;
+
+int pipe_buffer_size = 0;  //F_SETPIPE_SZ for pipeline pipes, 0 keeps the kernel default (set with "pipesize")
+
+//Built in "parallel": runs a command once per argument with at most N children at a time
+#define PARALLEL_SEPARATOR ":::"   //arguments after it are the inputs, without it input lines are read
+#define PARALLEL_PLACEHOLDER "{}"  //replaced by the input, which is appended when no word has it
+#define PARALLEL_BUFSIZE 65536     //initial size of the input line buffer
+#define PARALLEL_MAX_FAILED 101    //exit status is the number of failed tasks up to this (like GNU parallel)
+
+typedef struct parallel_source
+{
+     char **args;      //inputs given after ":::", NULL when reading lines
+     int input_fd;     //where lines are read from
+     char *buffer;
+     size_t size;
+     size_t start;
+     size_t end;
+     int eof;
+}parallel_source;
+
+typedef struct parallel_slot
+{
+     pid_t pid;        //-1 if the slot is free
+     int pidfd;        //readable once the task exits, -1 if not used
+     int output_fd;    //memfd collecting the task's output for -g, -1 otherwise
+     struct timespec start_time;
+     command_stats *stats;
+}parallel_slot;
+
+//Shell options
+int interactive = 1;  //print the prompt, off in batch mode (script, -c, or stdin not a terminal) unless -i is given
+int errexit = 0;      //-e: stop at the first command that fails
+
+//Commands smallsh_execute() handles itself
+const char *builtin_names[] = { "cd", "status", "exit", "spawn", "hash", "jobs", "pipesize", "parallel", "time", "stats",
+                                "echo", "true", "false", "pwd", "test", "[", "printf", "sleep", "on", "placement",
+                                "limit", "group", "wait", "output", "timeout", NULL };
+
+//Built ins that stand in for a program of the same name so scripts don't pay a spawn for them. "command name" runs
+//the program instead, and so does starting one in the background, which needs a process to be a job.
+const char *fast_path_names[] = { "echo", "true", "false", "pwd", "test", "[", "printf", "sleep", NULL };
+
+//Built ins that only print and set a status, so a pipeline stage runs them in the shell. Any other built in in a
+//pipeline runs in a forked copy of the shell, except "wait": the copy has no children to wait for.
+const char *pure_builtin_names[] = { "echo", "true", "false", "pwd", "test", "[", "printf", "sleep", "status", "jobs", NULL };
+
+volatile sig_atomic_t sleep_interrupted = 0; //set by SIGINT while the "sleep" built in waits
+
+//Deadlines ("timeout"): a command still running at its deadline gets SIGTERM, and SIGKILL once the grace period is
+//over too. One timerfd in the event loop is armed for the next step of the foreground command's or a background job's.
+#define DEADLINE_NONE 0
+#define DEADLINE_RUNNING 1     //at is when SIGTERM is sent
+#define DEADLINE_TERM 2        //SIGTERM was sent, at is when SIGKILL is
+#define DEADLINE_KILL 3        //SIGKILL was sent
+#define TIMEOUT_GRACE (5 * 1000000LL)  //default microseconds from SIGTERM to SIGKILL
+#define TIMED_OUT_STATUS 124           //exit status of a command that timed out, like timeout(1)
+
+typedef struct deadline
+{
+     int state;
+     long long at;        //CLOCK_MONOTONIC microseconds
+     long long grace;
+}deadline;
+
+long long command_timeout = 0;              //"timeout DURATION command": microseconds for the command being started, 0 for none
+long long command_grace = TIMEOUT_GRACE;
+long long default_timeout = 0;              //"timeout -d DURATION": for every command started after it
+long long default_grace = TIMEOUT_GRACE;
+long long exit_grace = TIMEOUT_GRACE;       //"timeout -x GRACE": how long background jobs get after SIGTERM when the shell exits
+
+//Table of background jobs, used to report them and to stop the ones still running once shell is exiting (To prevent orphans).
+//Jobs live in a slab of slots reused through a free list and are found by pid through an open addressed index,
+//so starting and reaping a job are O(1) and memory stays flat no matter how many jobs a session starts.
+#define JOB_TABLE_SIZE 64       //initial number of slots, always a power of 2
+#define JOB_COMMAND_LENGTH 64   //how much of the command line is kept for "jobs"
+
+//A slot only has two states: a job is reported as soon as it is reaped and its slot is freed right away
+#define JOB_FREE 0      //slot is unused
+#define JOB_RUNNING 1   //started and not reaped yet
+
+typedef struct job
+{
+     int job_id;                        //small number shown by "jobs", 0 for pipeline stages reported through another job
+     pid_t pid;                         //the process id of the child
+     pid_t pgid;                        //its process group
+     int state;
+     struct timespec start_time;        //CLOCK_MONOTONIC time the job was started
+     int pidfd;                         //readable once the job exits, -1 if not used
+     deadline limit;                    //"timeout" of the reported job, pipeline stages have none
+     command_stats *stats;              //where its run time is recorded, NULL for the splice helper
+     resource_group *group;             //its "limit" or "group" cgroup, NULL for none
+     char command[JOB_COMMAND_LENGTH];
+     int next_free;                     //next slot on the free list while the slot is unused
+}job;
+
+typedef struct job_table
+{
+     job *slots;
+     int num_slots;
+     int free_slot;    //head of the free list, -1 if every slot is used
+     int *index;       //pid -> slot + 1 (0 is empty), linear probing
+     int index_size;
+     int count;        //number of running jobs
+     int next_job_id;
+}job_table;
+
+//The foreground command while the shell waits for it with a deadline, stages from first on are not reaped yet
+struct
+{
+     deadline limit;
+     stage *stages;
+     int first;
+     int total;
+}foreground_wait;
+
+//Event loop read_line() waits in: stdin plus one pidfd per background job (or a SIGCHLD signalfd
+//on kernels without pidfds) so finished jobs are reaped and reported while the shell waits for input.
+#define INPUT_BUFSIZE 4096   //initial size of the stdin buffer, it grows for longer lines
+#define BATCH_BUFSIZE (1 << 20) //stdin buffer size when stdin is not a terminal
+#define EVENT_BATCH 64       //events handled per epoll_wait()
+#define EVENT_STDIN 0        //epoll data for stdin, job pidfds use their pid
+#define EVENT_SIGCHLD ((uint64_t)-1)
+#define EVENT_FOREGROUND ((uint64_t)-2)  //pidfd of the foreground command being waited for
+#define EVENT_TIMER ((uint64_t)-3)       //timerfd for the next deadline
+#define EVENT_OUTPUT ((uint64_t)1 << 32) //captured output pipes: this bit plus the pipe's descriptor
+#define EVENT_POLL_MS 50     //how often jobs that got no pidfd are checked with wait4()
+#define EVENT_RESCAN_MS 1000 //how often "wait" checks every job with wait4() in case a wakeup was missed
+#define EVENTS_STDIN 1       //smallsh_events_wait() result bits
+#define EVENTS_REPORTED 2
+#define EVENTS_FOREGROUND 4
+
+struct
+{
+     int epoll_fd;
+     int use_pidfd;       //1 if every job gets a pidfd, 0 if the signalfd is used
+     int signal_fd;
+     int stdin_watched;   //0 if stdin can't be polled (a regular file), it is then always readable
+     int input_fd;        //where commands are read from, stdin unless a script can't be mapped
+     char *input;         //bytes read from stdin not yet returned as lines
+     size_t input_size;
+     size_t input_start;
+     size_t input_end;
+     int input_eof;
+     int jobs_only;       //1 while "wait" runs, stdin is out of the epoll set then
+     int timer_fd;        //deadlines, see smallsh_deadline_check()
+     long long timer_at;  //when timer_fd goes off, 0 if it isn't armed
+     int unwatched;       //running jobs that got no pidfd (out of descriptors), polled every EVENT_POLL_MS
+}event_loop;
+
+//Captured background output ("output on"): stdout and stderr of every stage of a background job go into one pipe
+//that the event loop drains into a ring of CAPTURE_RING bytes for the job. When the ring fills up it is written out
+//to an unlinked spill file and starts over, so nothing is lost; only if no spill file can be made does the ring
+//wrap and drop the oldest bytes. Rings come out of a global memory cap, with none left a job spills straight to its
+//file. "output job" replays the file (mapped) and then the ring. Captures outlive their job until CAPTURE_KEEP
+//finished ones are kept, then the oldest finished one is dropped.
+#define CAPTURE_RING (64 * 1024)
+#define CAPTURE_KEEP 64
+#define CAPTURE_DEFAULT_CAP (64LL * 1024 * 1024)
+
+typedef struct job_output
+{
+     int job_id;
+     pid_t pid;                         //the job's reported pid
+     char command[JOB_COMMAND_LENGTH];
+     int pipe_fd;                       //read end, -1 once every writer has closed it
+     char *ring;                        //NULL until output arrives, or while the cap leaves no room
+     size_t ring_start;                 //oldest byte in the ring
+     size_t ring_length;
+     int spill_fd;                      //spill file, -1 until the ring first fills
+     size_t spilled;                    //bytes in the spill file
+     size_t total;                      //bytes captured, including dropped ones
+     struct job_output *next;
+}job_output;
+
+struct
 {
-     int bg_pid; //the process id of the child
-     struct bg_child  * next;
-}bg_child;
+     int enabled;             //capture jobs started from now on
+     long long memory_cap;    //bytes all rings together may use
+     long long memory_used;
+     job_output *first;       //oldest first
+     job_output *last;
+     job_output **by_fd;      //pipe descriptor -> capture
+     int by_fd_size;
+     int open_pipes;          //while >0 the foreground wait goes through the event loop
+     int finished;            //captures whose job has closed its output
+     int idle_rings;          //finished captures still holding a ring
+     job_output *follow;      //capture "output -f" is writing out as it arrives
+}capture = { 0, CAPTURE_DEFAULT_CAP, 0, NULL, NULL, NULL, 0, 0, 0, 0, NULL };
+
+//Command path table (like bash's "hash"): maps command names to the file execvp() would have found so $PATH
+//is searched once per name instead of on every command. Entries are dropped when $PATH or the mtime of a
+//directory in it changes.
+//Only directories before the first relative one (an empty entry is ".") are remembered, what is found in or
+//after it depends on the current directory and is looked up again every time.
+#define PATH_HASH_SIZE 64 //initial number of slots, always a power of 2
+#define PATH_DEFAULT "/usr/local/bin:/usr/bin:/bin" //what execvp() searches when $PATH is unset
+#define COMMAND_NOT_FOUND 127  //exit status of a command that couldn't be found or started
+
+typedef struct path_hash_entry
+{
+     char *name;     //command name, NULL for an empty slot
+     char *path;     //resolved path passed to exec
+     int dir_index;  //which $PATH directory it was found in
+     int hits;       //number of times it has been used
+}path_hash_entry;
+
+typedef struct path_dir
+{
+     char *dir;               //directory from $PATH (points into path_copy)
+     struct timespec mtime;   //modification time when the table was built
+}path_dir;
+
+struct
+{
+     path_hash_entry *entries; //open addressed table with linear probing
+     int size;
+     int count;
+     char *path_env;          //value of $PATH the table was built for (PATH_DEFAULT when unset)
+     char *path_copy;         //$PATH split in place into dirs
+     path_dir *dirs;
+     int num_dirs;
+     int first_relative;      //index of the first relative directory, num_dirs if there is none
+}path_hash;
+
+//Pathname expansion: unquoted *, ?, [...] and a "**" component (any number of directories) are matched against
+//directory listings read with large getdents64() calls. Listings are cached by device and inode and reused while
+//the directory's mtime is unchanged, unless the listing was read so soon after that mtime that a change in the same
+//clock tick could have been missed. Listings are dropped oldest first once they take more than DIR_CACHE_CAP bytes.
+#define DIR_CACHE_BUCKETS 1024
+#define DIR_CACHE_CAP (64LL * 1024 * 1024)
+#define DIR_READ_BUFSIZE (1 << 20)        //getdents64() buffer
+#define DIR_CACHE_RACY_NS 2000000000LL    //a listing read this soon after its mtime is read again next time
+
+typedef struct linux_dirent64
+{
+     uint64_t d_ino;
+     int64_t d_off;
+     unsigned short d_reclen;
+     unsigned char d_type;
+     char d_name[];
+}linux_dirent64;
+
+typedef struct dir_listing
+{
+     dev_t dev;
+     ino_t ino;
+     struct timespec mtime;
+     int racy;                  //read within DIR_CACHE_RACY_NS of mtime, not trusted next time
+     char *names;               //NUL terminated names back to back
+     uint32_t *offsets;         //count + 1 offsets into names, so each name's length is known
+     unsigned char *types;      //d_type of each name, DT_UNKNOWN where the file system doesn't say
+     int count;
+     size_t bytes;              //what the listing takes out of DIR_CACHE_CAP
+     int pinned;                //in use by the expansion running now, it isn't dropped or replaced
+     struct dir_listing *next;  //hash chain
+     struct dir_listing *newer; //use order, for dropping the oldest
+     struct dir_listing *older;
+}dir_listing;
+
+struct
+{
+     dir_listing *buckets[DIR_CACHE_BUCKETS];
+     dir_listing *newest;
+     dir_listing *oldest;
+     size_t bytes;
+     char *buffer;              //DIR_READ_BUFSIZE for getdents64(), allocated on first use
+}dir_cache;
+
+//A compiled pattern component: runs of literal text, "?", "*" and [...] classes
+#define GLOB_OP_LITERAL 0
+#define GLOB_OP_ANY 1
+#define GLOB_OP_STAR 2
+#define GLOB_OP_CLASS 3
+
+typedef struct glob_op
+{
+     int type;
+     const char *text;          //GLOB_OP_LITERAL
+     size_t length;
+     unsigned char set[32];     //GLOB_OP_CLASS: one bit per byte that matches
+}glob_op;
+
+typedef struct glob_component
+{
+     glob_op *ops;
+     int num_ops;
+     int wild;                  //0 for plain text, which is looked up instead of matched
+     int globstar;              //"**"
+     int dot;                   //starts with a literal ".", only then are hidden names matched
+     size_t min_length;         //bytes a name needs at least to match
+     const char *text;          //plain text of a component that isn't wild
+     size_t length;
+}glob_component;
+
+typedef struct glob_state
+{
+     glob_component *components;
+     int num_components;
+     int dirs_only;             //the pattern ended in "/"
+     char *path;                //directory being matched in, with its trailing "/" (PATH_MAX)
+     char *text;                //matches back to back, NUL terminated, doubled in the command arena as it fills
+     size_t text_used;
+     size_t text_size;
+     size_t *offsets;           //where each match starts in text
+     int count;
+     int capacity;
+}glob_state;
 
 
 /*************************************
 FUNCTION PROTOTYPES
 *************************************/
 pid_t getpid(void);  //Used to get the process id of the program
-char *read_line();   //Will get user_input
+char *read_line(job_table *jobs);   //Will get user_input
 char **parse_line(char *user_input, int *num_args); //will parse through the line and tokenize the command and arguments into an array
-int smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, bg_child *head); //checks user input for built in commands, if not passes the command and arguments to smallsh_launch()
-int smallsh_launch(char **args, int num_args, int background_process, int *signal_flag, int *terminating_signal, bg_child *head); //will fork() the program and checks for redirection and pass any commands to exec()
-int smallsh_redirect_check(int input_flag, int output_flag); //checks for redirection requests made by user
-void smallsh_bg_status_check(); //waits for completed child processes and prints the exit status or terminating signal
-void smallsh_bg_list_insert(bg_child *pointer, int bg_pid); //inserts and allocates memory for new background process id into the linked list
+char smallsh_quote_char(char c); //the marker parse_line() keeps for a quoted character
+char *smallsh_intern_operator(char *token); //maps an unquoted operator token to its shell_operators entry
+char *smallsh_list_operator(const char *text, const char *end); //the ";", "&&" or "||" at text, if there is one
+int smallsh_run_line(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //runs a parsed line, a command or a command tree
+int smallsh_block_start(char **args, int num_args); //checks if a line is a list or a block
+int smallsh_run_block(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //reads the rest of a block, parses it and runs it
+char **smallsh_block_append(char **tokens, int *count, char **more, int num_more); //adds a line's tokens to the block
+command_node *smallsh_node_new(int type); //allocates a command tree node
+command_node *smallsh_parse_list(token_cursor *cursor, int *status, const char **terminators); //commands up to a reserved word
+command_node *smallsh_parse_and_or(token_cursor *cursor, int *status); //commands joined by "&&" and "||"
+command_node *smallsh_parse_command(token_cursor *cursor, int *status); //a block or a simple command
+command_node *smallsh_parse_if(token_cursor *cursor, int *status); //the rest of an "if" or "elif"
+int smallsh_parse_expect(token_cursor *cursor, int *status, const char *keyword); //takes a reserved word that has to come next
+void smallsh_parse_error(token_cursor *cursor, int *status); //reports an unexpected token
+int smallsh_is_keyword(const char *token, const char *keyword); //checks for a reserved word
+int smallsh_is_name(const char *text, size_t length); //checks for a variable name
+const char *smallsh_variable_get(const char *name); //value of a "for" variable, or of the environment variable
+int smallsh_run_node(command_node *node, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //runs a command tree
+void smallsh_block_interrupt(int signal_number); //SIGINT handler while a block runs
+char **smallsh_expand(char **args, int *num_args, int exit_status); //expands $variables and glob patterns in a command's words
+size_t smallsh_expand_word(const char *word, char *out, int exit_status); //expands one word, or measures it if out is NULL
+void smallsh_glob_unquote(char *word); //turns quoted glob character markers back into the characters
+char **smallsh_glob(const char *pattern, int *count); //pathname expansion of one word, sorted matches in the command arena
+int smallsh_glob_compile(char *text, glob_component *component); //compiles one "/" separated pattern component
+int smallsh_glob_match(const glob_component *component, const char *name, size_t length); //matches a name against a compiled component
+void smallsh_glob_walk(glob_state *state, int index, size_t path_length); //matches components from index on below the directory in path
+int smallsh_glob_path(glob_state *state, size_t path_length, const char *name, size_t length); //puts path + name in the path buffer
+void smallsh_glob_add(glob_state *state, size_t length, int slash); //adds the path buffer as a match
+int smallsh_glob_is_dir(glob_state *state, size_t length, unsigned char type, int follow); //checks if a listed name is a directory
+int smallsh_glob_compare(const void *a, const void *b, void *text); //qsort_r() order for matches
+dir_listing *smallsh_dir_cache_get(const char *path); //a directory's listing, from the cache or read with getdents64()
+dir_listing *smallsh_dir_cache_read(int fd, const struct stat *info); //reads a directory into a new listing
+void smallsh_dir_cache_drop(dir_listing *listing); //takes a listing out of the cache and frees it
+const char *smallsh_find_special_scalar(const char *text, const char *end); //finds the next delimiter, quote, backslash or list operator character
+#ifdef TOKENIZER_X86
+const char *smallsh_find_special_sse2(const char *text, const char *end); //SSE2 version
+const char *smallsh_find_special_avx2(const char *text, const char *end); //AVX2 version
+#endif
+const char *smallsh_tokenizer_init(const char *isa); //picks the smallsh_find_special() version
+void *smallsh_arena_alloc(arena *pool, size_t size); //allocates from the per-command arena
+void smallsh_arena_reset(arena *pool); //releases everything in the arena
+int smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //checks user input for built in commands, if not passes the command and arguments to smallsh_launch()
+int smallsh_launch(char **args, int num_args, int background_process, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //starts a command or pipeline and waits for it if it is in the foreground
+void smallsh_stages_close(stage *stages, int num_stages); //closes descriptors the shell holds for pipeline stages
+int smallsh_builtin_stage(stage *builtin, int input_fd, int output_fd, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //runs a built in pipeline stage
+int smallsh_builtin_redirect(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //runs a built in with its redirections
+int smallsh_builtin_run(char **args, int num_args, int input_fd, int output_fd, const redirect *redirects, int num_redirects, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //runs a built in with its descriptors moved
+void smallsh_splice_pump(splice_pair *pairs, int num_pairs, fan_out *fan); //moves data between descriptors with splice()
+fan_out *smallsh_fan_out_open(char **words, int num_words, stage *consumers); //opens the files and pipes of a fan out
+int smallsh_fan_out_step(fan_out *fan, struct pollfd *waits, int *num_waits); //moves what a fan out can without blocking
+void smallsh_fan_out_drop(fan_out *fan, fan_target *target); //closes a fan out target
+void smallsh_fan_out_close(fan_out *fan); //closes every descriptor of a fan out
+int smallsh_write_all(int fd, const char *buffer, size_t length); //write() loop
+pid_t smallsh_spawn(spawn_request *request); //starts a child with the selected engine and records spawn latency
+pid_t smallsh_spawn_fork(spawn_request *request); //fork() engine, the child sets up its descriptors before exec()
+pid_t smallsh_spawn_posix(spawn_request *request); //posix_spawn() engine, descriptors, process group and SIGINT reset are spawn file actions and attributes
+void smallsh_spawn_report(); //prints the spawn engine in use and its average spawn latency
+int smallsh_on_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //built in "on"
+int smallsh_placement_builtin(char **args); //built in "placement"
+int smallsh_placement_parse(char **args, placement *place, const char *name); //reads placement options
+void smallsh_placement_print(const placement *place); //prints placement options
+int smallsh_placement_cpu(const placement *place); //picks the next round robin CPU
+int smallsh_placement_apply(const placement *place, int cpu); //applies a placement in the child
+int smallsh_cpulist_parse(const char *text, cpu_set_t *cpus); //reads a CPU list like "0-3,8"
+void smallsh_cpulist_format(const cpu_set_t *cpus, char *buffer, size_t size); //writes a CPU list
+int smallsh_limit_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //built in "limit"
+int smallsh_group_builtin(char **args); //built in "group"
+int smallsh_limits_parse(char **args, resource_limits *limits, char **group_name, const char *name); //reads limit options
+int smallsh_size_parse(const char *text, long long *value); //reads a byte count like "512M"
+int smallsh_cgroup_init(); //creates the shell's smallsh-<pid> cgroup
+int smallsh_cgroup_write(int dir_fd, const char *file, const char *text); //writes a cgroup control file
+long long smallsh_cgroup_read(int dir_fd, const char *file, const char *key); //reads a number from a cgroup file
+resource_group *smallsh_group_create(const char *name); //creates a cgroup leaf
+void smallsh_group_set_limits(resource_group *group, const resource_limits *limits); //writes a group's limits
+resource_group *smallsh_group_find(const char *name); //looks up a named group
+void smallsh_group_release(resource_group *group); //drops a reference, removing the cgroup with the last one
+int smallsh_group_enter(const resource_group *group); //moves the calling child into a group
+double smallsh_group_pressure(const resource_group *group, const char *file); //reads "some avg10" of a pressure file
+void smallsh_group_print(resource_group *group, const char *indent); //prints a group's limits, usage and pressure
+void smallsh_groups_free(); //removes the named groups and smallsh-<pid>
+int smallsh_redirect_open(char **args, int *num_args, redirect **redirects, int *num_redirects); //opens the redirection files of a command in the shell
+void smallsh_redirect_close(redirect *redirects, int num_redirects); //closes the files opened for redirections
+char *smallsh_intern_redirect(char *token); //maps an unquoted descriptor redirection to its redirect_words entry
+int smallsh_is_redirect(const char *token); //checks if a token is a redirection operator
+int smallsh_find_redirect(char **args, int num_args); //finds a redirection in args
+int smallsh_is_operator(const char *token, const char *op); //checks if a token is a shell operator
+int smallsh_find_operator(char **args, int num_args, const char *op); //finds an operator in args
+int smallsh_is_builtin(const char *name); //checks if a command is a built in
+int smallsh_is_fast_path(const char *name); //checks if a built in stands in for a program
+int smallsh_is_pure_builtin(const char *name); //checks if a built in can run in the shell as a pipeline stage
+int smallsh_fast_path_forked(int background_process); //checks if fast path built ins have to run as programs
+void smallsh_echo_builtin(char **args); //built in "echo"
+int smallsh_pwd_builtin(); //built in "pwd"
+int smallsh_test_builtin(char **args); //built in "test" and "["
+int smallsh_test_expression(char **operands, int count); //evaluates the operands of "test"
+int smallsh_test_integer(const char *text, long long *value); //reads an integer operand of "test"
+int smallsh_printf_builtin(char **args); //built in "printf"
+int smallsh_sleep_builtin(char **args, int *signal_flag, int *terminating_signal, job_table *jobs); //built in "sleep"
+void smallsh_sleep_interrupt(int signal_number); //SIGINT handler while "sleep" waits
+int smallsh_pipesize_builtin(char **args); //built in "pipesize"
+int smallsh_parallel_builtin(char **args, job_table *jobs); //built in "parallel"
+char *smallsh_parallel_next(parallel_source *source); //next input for "parallel"
+char **smallsh_parallel_command(char **command, int num_words, const char *input, char **task_args, char **scratch, size_t *scratch_size); //fills in a "parallel" task's arguments
+void smallsh_parallel_flush(int output_fd, int target_fd); //copies a task's grouped output and empties its memfd
+void smallsh_bg_status_check(job_table *jobs); //waits for completed child processes and prints the exit status or terminating signal
+void smallsh_job_reap(job_table *jobs, job *finished, int bg_status, struct rusage *usage); //prints how a background job ended and removes it
+void smallsh_events_init(); //sets up the epoll event loop for stdin and background jobs
+void smallsh_input_string(char *commands); //reads commands from a string (-c) instead of stdin
+int smallsh_input_file(const char *filename); //reads commands from a script file instead of stdin
+int smallsh_serve(const char *path, int num_workers); //--serve: runs command lines sent to a unix socket
+pid_t smallsh_serve_fork(int listen_fd, sigset_t *worker_mask); //starts a server worker
+void smallsh_serve_worker(int listen_fd); //a server worker's loop
+void smallsh_serve_request(int client_fd, char *line, job_table *jobs); //runs one request and writes its trailer
+int smallsh_pidfd_open(pid_t pid); //pidfd_open() wrapper
+void smallsh_events_watch(job *new_job); //adds a background job's pidfd to the event loop
+int smallsh_events_wait(job_table *jobs, int timeout); //waits for input and reaps background jobs that exit
+int smallsh_bg_scan(job_table *jobs, int unwatched); //wait4(WNOHANG) on each running job (or each one without a pidfd)
+void smallsh_events_jobs_only(int on); //takes stdin out of the event loop while the shell waits for jobs
+void smallsh_events_foreground(pid_t pid, job_table *jobs); //waits for a foreground child while output is being captured
+int smallsh_output_builtin(char **args, job_table *jobs); //built in "output"
+job_output *smallsh_capture_start(int pipe_fd, job *reported); //starts capturing a job's output pipe
+void smallsh_capture_drain(job_output *current); //moves what is in a capture pipe into its ring or spill file
+int smallsh_capture_store(job_output *current, const char *data, size_t length); //adds output to a capture
+int smallsh_capture_spill(job_output *current); //writes a capture's ring out to its spill file
+int smallsh_capture_ring(job_output *current); //gets a ring for a capture within the memory cap
+void smallsh_capture_write(job_output *current, int fd); //replays a capture's output
+job_output *smallsh_capture_find(const char *spec); //looks up a capture by %job or pid
+void smallsh_capture_free(job_output *current); //drops a capture
+void smallsh_job_table_init(job_table *jobs); //sets up an empty job table
+void smallsh_job_table_free(job_table *jobs); //releases the job table
+int smallsh_job_index_slot(job_table *jobs, pid_t pid); //finds the index position of a pid
+job *smallsh_job_insert(job_table *jobs, pid_t pid, pid_t pgid, const char *command); //adds a new background job
+job *smallsh_job_find(job_table *jobs, pid_t pid); //looks up a job by pid
+void smallsh_job_remove(job_table *jobs, job *old_job); //removes a reaped job
+void smallsh_jobs_builtin(char **args, job_table *jobs); //built in "jobs"
+int smallsh_wait_builtin(char **args, job_table *jobs); //built in "wait"
+void smallsh_jobs_shutdown(job_table *jobs); //stops the running background jobs when the shell exits
+int smallsh_time_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //built in "time"
+void smallsh_stats_builtin(char **args); //built in "stats"
+command_stats *smallsh_stats_find(const char *name); //finds or adds the accounting entry of a command name
+void smallsh_stats_record(command_stats *entry, const struct timespec *start_time, const struct rusage *usage); //records one finished run
+void smallsh_usage_add(struct rusage *total, const struct rusage *usage); //adds a child's rusage to a total
+void smallsh_histogram_record(histogram *samples, uint64_t value); //adds a sample to a histogram
+uint64_t smallsh_histogram_percentile(histogram *samples, double percentile); //reads a percentile from a histogram
+uint64_t smallsh_histogram_bucket_start(int bucket); //smallest value counted in a bucket
+long long smallsh_usec_since(const struct timespec *start_time); //CLOCK_MONOTONIC microseconds since start_time
+long long smallsh_usec_now(); //CLOCK_MONOTONIC in microseconds
+int smallsh_duration_parse(const char *text, long long *usec); //reads a duration like "1.5", "30s" or "2m"
+int smallsh_timeout_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs); //built in "timeout"
+void smallsh_deadline_start(deadline *limit, long long timeout, long long grace); //starts a deadline and arms the timer for it
+int smallsh_deadline_step(deadline *limit, long long now); //moves a due deadline on, returns the signal to send
+int smallsh_deadline_foreground(); //signals the foreground command if its deadline is due
+void smallsh_deadline_check(job_table *jobs); //signals the commands whose deadline is due and rearms the timer
+void smallsh_deadline_arm(long long at); //arms the timer if at comes before what it is set for
+char *smallsh_format_usec(long long usec, char *buffer, size_t size); //formats a duration for "time" and "stats"
+unsigned int smallsh_hash_string(const char *name); //FNV-1a hash used by the command path table
+void smallsh_hash_clear(); //empties the command path table and re-reads $PATH
+int smallsh_hash_dirs_changed(int last_dir); //checks the $PATH directories for modifications
+path_hash_entry *smallsh_hash_insert(const char *name, const char *path, int dir_index); //adds a resolved command to the table
+const char *smallsh_hash_lookup(const char *name); //resolves a command name to a path, searching $PATH only on a miss
+int smallsh_hash_builtin(char **args); //built in "hash" and "hash -r"
 
 
-int main()
+#ifndef SMALLSH_NO_MAIN //benchmarks include this file and drive its functions from their own main()
+int main(int argc, char *argv[])
 {
-     //init linkedlist of bg_processes
-     bg_child *head, *current;
-     head = (bg_child *)malloc(sizeof(bg_child));
-     current = head;
-     current->bg_pid = -1;
-     current->next = NULL;
+     //init table of bg_processes
+     job_table jobs;
+     smallsh_job_table_init(&jobs);
 
      char *user_input;        //variable for holding user input
      char **args;             //array for all arguments entered by user
      int num_args;            //the number of arguments including the command
-     int smallsh_status;      //variable to determine when to exit the smallsh loop
+     int smallsh_status = 1;  //variable to determine when to exit the smallsh loop
      int exit_status = 0;     //variable to track exit status of last ran foreground command
-     int signal_flag = 0;     //flag for if a foreground process was terminated (false == 0, true == 1)
+     int signal_flag = 0;     //flag for if a foreground process was terminated (false == 0, true == 1, timed out == 2)
      int terminating_signal;  //holds the terminating signal number if signal flag is set
+     char *command_string = NULL; //commands given with -c
+     int force_interactive = 0;   //-i shows the prompt even when stdin is not a terminal
+     char *serve_path = NULL;     //--serve socket
+     int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+     int option;
+     struct option long_options[] = {
+          { "serve", required_argument, NULL, 's' },
+          { "workers", required_argument, NULL, 'w' },
+          { NULL, 0, NULL, 0 }
+     };
 
 
      /*********************************************************************
@@ -84,72 +908,226 @@ int main()
      act.sa_handler = SIG_IGN;
      //sigfillset(&(act.sa_mask));
      sigaction(SIGINT, &act, NULL);
+     sigaction(SIGPIPE, &act, NULL); //a pipeline stage that exits early must not kill the shell while it splices
+
+     //allow comparing the engines without touching the scripts being run
+     if ((getenv("SMALLSH_SPAWN") != NULL) && (strcmp(getenv("SMALLSH_SPAWN"), "fork") == 0))
+     {
+          spawn_mode = SPAWN_FORK;
+     }
+
+     smallsh_tokenizer_init(getenv("SMALLSH_TOKENIZER"));
+
+     /*********************************************************************
+     Batch mode: "smallsh script", "smallsh -c commands" or a stdin that is
+     not a terminal runs without the prompt, -e stops at the first failure.
+     "smallsh --serve socket" runs command lines sent to a socket instead.
+     **********************************************************************/
+     while ((option = getopt_long(argc, argv, "+c:ei", long_options, NULL)) != -1)
+     {
+          switch (option)
+          {
+          case 'c':
+               command_string = optarg;
+               break;
+          case 'e':
+               errexit = 1;
+               break;
+          case 'i':
+               force_interactive = 1;
+               break;
+          case 's':
+               serve_path = optarg;
+               break;
+          case 'w':
+               num_workers = atoi(optarg);
+               break;
+          default:
+               printf("usage: smallsh [-ei] [-c commands | script]\n");
+               printf("       smallsh --serve socket [--workers N]\n");
+               return 2;
+          }
+     }
+
+     //each worker sets up its own event loop
+     if (serve_path != NULL)
+     {
+          return smallsh_serve(serve_path, (num_workers > 0) ? num_workers : 1);
+     }
+
+     smallsh_events_init();
+
+     if (command_string != NULL)
+     {
+          smallsh_input_string(command_string);
+     }
+     else if (optind < argc)
+     {
+          if (smallsh_input_file(argv[optind]) == -1)
+          {
+               printf("smallsh: cannot open %s\n", argv[optind]);
+               return 1;
+          }
+     }
+
+     interactive = force_interactive || ((command_string == NULL) && (optind >= argc) && isatty(0));
 
      /********************
      MAIN SMALLSH LOOP
      *********************/
      do
      {
+          //everything the last line allocated goes back to the arena
+          smallsh_arena_reset(&command_arena);
+
           //check for completed background processes
-          smallsh_bg_status_check();
+          smallsh_bg_status_check(&jobs);
 
           //print prompt
-          printf(": ");
-          fflush(stdout); //flush prompt according to assignment directions
+          if (interactive == 1)
+          {
+               printf("%s", prompt);
+               fflush(stdout); //flush prompt according to assignment directions
+          }
 
-          //get user input
-          user_input = read_line();
+          //get user input, end of input is the same as "exit"
+          user_input = read_line(&jobs);
+          if (user_input == NULL)
+          {
+               break;
+          }
 
           //process user input
           args = parse_line(user_input, &num_args);
 
           //find out what user has entered and execute any commands
-          smallsh_status = smallsh_execute(args, num_args, &exit_status, &signal_flag, &terminating_signal, head);
+          smallsh_status = smallsh_run_line(args, num_args, &exit_status, &signal_flag, &terminating_signal, &jobs);
 
-          free(user_input);
-          free(args);
+          //-e: a failed command ends the script, its status becomes the shell's
+          if (smallsh_status == BLOCK_STOP)
+          {
+               if ((errexit == 1) && (exit_status != 0))
+               {
+                    break;
+               }
+               smallsh_status = BLOCK_NEXT;
+          }
 
-     } while (smallsh_status); //smallsh_execute will always return 1 except if user has entered command "exit"
+     } while (smallsh_status); //BLOCK_EXIT (0) once the user has entered command "exit"
 
 
-     //kill any running background processes to prevent orphans
-     current = head;
-     while (current != NULL)
-     {
-          if (current->bg_pid != -1) //head has bg_pid of -1
-          {
+     //stop the background jobs still running to prevent orphans, every one is reaped so their cgroups can go too
+     smallsh_jobs_shutdown(&jobs);
+     smallsh_groups_free();
 
-               kill(current->bg_pid, SIGKILL);
-          }
+     smallsh_job_table_free(&jobs);
 
-          current = current->next;
-     }
+     fflush(stdout);
 
-     //free the linked list - Credit: http://stackoverflow.com/questions/7025328/linkedlist-how-to-free-the-memory-allocated-using-malloc
-     while ((current = head) != NULL) // set currrent to head, stop if list empty.
+     //"exit" ends with 0, end of input or -e ends with the status of the last command
+     if (smallsh_status == 0)
      {
-          head = head->next;
-          free(current);              // delete saved pointer.
+          return 0;
      }
-
-
-     return 0;
+     return exit_status;
 }
+#endif
 
 
 /**********************************************************************
-** Function: char *read_line()
-** Description: This function will get user input and allocate buffer through getline()
-** Credit: http://stephen-brennan.com/2015/01/16/write-a-shell-in-c/
+** Function: char *read_line(job_table *jobs)
+** Description: This function will return the next line of user input.
+**              stdin is read in chunks into a buffer that is reused
+**              for every line. While waiting for input, background
+**              jobs that finish are reported as they happen.
+**              Returns NULL at the end of input.
 **
-** Parameters: none
+** Parameters: pointer to the job table
 **********************************************************************/
-char *read_line()
+char *read_line(job_table *jobs)
 {
-     char *line = NULL;       //"the manpage for getline() specifies that the first argument should be freeable, so line should be initialized to NULL"-From the article
-     ssize_t buffer_size = 0; // getline will be able to dynamically allocate a buffer size
-     getline(&line, &buffer_size, stdin);
-     return line;
+     char *line;
+     char *newline;
+     ssize_t bytes;
+     int ready;
+
+     while (1)
+     {
+          //return the next complete line already in the buffer
+          newline = memchr(event_loop.input + event_loop.input_start, '\n', event_loop.input_end - event_loop.input_start);
+          if (newline != NULL)
+          {
+               line = event_loop.input + event_loop.input_start;
+               *newline = '\0';
+               event_loop.input_start = (newline - event_loop.input) + 1;
+               return line;
+          }
+
+          if (event_loop.input_eof == 1)
+          {
+               if (event_loop.input_start == event_loop.input_end)
+               {
+                    return NULL;
+               }
+
+               //last line had no newline, a mapped script has no spare byte for the '\0' so the line is copied
+               if (event_loop.input_end == event_loop.input_size)
+               {
+                    size_t length = event_loop.input_end - event_loop.input_start;
+                    char *copy = malloc(length + 1);
+
+                    memcpy(copy, event_loop.input + event_loop.input_start, length);
+                    event_loop.input = copy;
+                    event_loop.input_start = 0;
+                    event_loop.input_end = length;
+                    event_loop.input_size = length + 1;
+               }
+
+               line = event_loop.input + event_loop.input_start;
+               event_loop.input[event_loop.input_end] = '\0';
+               event_loop.input_start = event_loop.input_end;
+               return line;
+          }
+
+          //move the partial line to the front and grow the buffer if the line fills it (one byte is kept for the '\0')
+          if (event_loop.input_start > 0)
+          {
+               memmove(event_loop.input, event_loop.input + event_loop.input_start, event_loop.input_end - event_loop.input_start);
+               event_loop.input_end -= event_loop.input_start;
+               event_loop.input_start = 0;
+          }
+          if (event_loop.input_end + 1 >= event_loop.input_size)
+          {
+               event_loop.input_size *= 2;
+               event_loop.input = realloc(event_loop.input, event_loop.input_size);
+          }
+
+          //wait for input, jobs that finish meanwhile are printed and the prompt is shown again
+          if (event_loop.input_fd == 0)
+          {
+               do
+               {
+                    ready = smallsh_events_wait(jobs, -1);
+
+                    if ((ready & EVENTS_REPORTED) && !(ready & EVENTS_STDIN) && (interactive == 1))
+                    {
+                         printf("%s", prompt);
+                         fflush(stdout);
+                    }
+               } while (!(ready & EVENTS_STDIN));
+          }
+
+          bytes = read(event_loop.input_fd, event_loop.input + event_loop.input_end, event_loop.input_size - event_loop.input_end - 1);
+
+          if (bytes > 0)
+          {
+               event_loop.input_end += bytes;
+          }
+          else if ((bytes == 0) || (errno != EINTR))
+          {
+               event_loop.input_eof = 1;
+          }
+     }
 }
 
 /**********************************************************************
@@ -157,32 +1135,148 @@ char *read_line()
 ** Description: This function will tokenize the user_input line
 **              and store the command and arguments into an array.
 **              It will also set the variable for number of arguments.
+**              Words are split in place: the end of a plain word is
+**              found with smallsh_find_special() (SSE2/AVX2 when the
+**              CPU has it) and quoted words are unquoted in place.
+**              '...' is taken literally, "..." allows \" \\ \$ \`
+**              and a \ outside quotes escapes the next character.
+**              A quoted "$", "*", "?" or "[" is stored as its marker
+**              (smallsh_quote_char()) so expansion leaves it alone.
+**              Unquoted operators point at the shell_operators table
+**              so a quoted "|" or ">" is just a word. An unquoted ";",
+**              "&&" or "||" ends a word even without a space, so
+**              "echo a;echo b" is two commands. A word starting
+**              with # begins a comment. The array comes from the
+**              command arena, nothing here touches the heap.
 ** Credit: http://stephen-brennan.com/2015/01/16/write-a-shell-in-c/
 **
 ** Parameters: the user_input line and pointer to num_args (reference)
 **********************************************************************/
 char **parse_line(char *user_input, int *num_args)
 {
+     char *end = user_input + strlen(user_input);
+     char *read = user_input;
      int buffer_size = TOKEN_BUFSIZE;
      int position = 0;
-     char *token;
-     char **tokens = malloc(buffer_size * sizeof(char*));
-
-     token = strtok(user_input, TOKEN_DELIM);
+     char **tokens = smallsh_arena_alloc(&command_arena, buffer_size * sizeof(char*));
 
-     while (token != NULL)
+     while (1)
      {
-          tokens[position] = token;
+          char *token;
+          char *token_end;
+          char *separator = NULL; //";", "&&" or "||" that ended the word
+          int quoted = 0;
 
-          position++;
+          //skip the delimiters before the next word
+          while ((read < end) && (token_class[(unsigned char)*read] == TOKEN_CLASS_DELIM))
+          {
+               read++;
+          }
+
+          if ((read == end) || (*read == '#')) //end of line or a comment
+          {
+               break;
+          }
+
+          token = read;
+          read = (char *)smallsh_find_special(read, end);
+          token_end = read;
+
+          //a quote or backslash: unquote the rest of the word in place, token_end trails read
+          while ((read < end) && (token_class[(unsigned char)*read] != TOKEN_CLASS_DELIM))
+          {
+               char c;
+
+               if (token_class[(unsigned char)*read] & TOKEN_CLASS_BREAK)
+               {
+                    separator = smallsh_list_operator(read, end);
+                    if (separator != NULL)
+                    {
+                         read += strlen(separator);
+                         break;
+                    }
+                    *token_end++ = *read++; //a lone "&" or "|" stays part of the word, like in "2>&1"
+                    continue;
+               }
+
+               c = *read++;
+               quoted |= ((token_class[(unsigned char)c] & TOKEN_CLASS_QUOTE) != 0);
+
+               if (c == '\'')
+               {
+                    while ((read < end) && (*read != '\''))
+                    {
+                         *token_end++ = smallsh_quote_char(*read);
+                         read++;
+                    }
+               }
+               else if (c == '"')
+               {
+                    while ((read < end) && (*read != '"'))
+                    {
+                         if ((*read == '\\') && (read + 1 < end) && (strchr("\"\\$`", read[1]) != NULL))
+                         {
+                              read++;
+                              if (*read == '$')
+                              {
+                                   *read = EXPAND_LITERAL_DOLLAR;
+                              }
+                         }
+                         *token_end++ = (*read == '$') ? '$' : smallsh_quote_char(*read); //a "$" still expands in double quotes
+                         read++;
+                    }
+               }
+               else if (c == '\\')
+               {
+                    if (read < end)
+                    {
+                         *token_end++ = smallsh_quote_char(*read);
+                         read++;
+                    }
+                    continue;
+               }
+               else
+               {
+                    *token_end++ = c;
+                    continue;
+               }
 
-          if (position >= buffer_size) //need to reallocate more memory 
+               if (read == end)
+               {
+                    printf("smallsh: unterminated %c quote\n", c);
+                    *num_args = 0;
+                    tokens[0] = NULL;
+                    return tokens;
+               }
+               read++; //closing quote
+          }
+
+          if ((separator == NULL) && (read < end))
+          {
+               read++; //step over the delimiter that is about to be overwritten
+          }
+          *token_end = '\0';
+
+          //"done;", "a&&b" or "x;echo" are split into the words and the operators between them, a bare operator is no word
+          if ((token_end > token) || (quoted == 1))
+          {
+               tokens[position] = (quoted == 1) ? token : smallsh_intern_operator(token);
+               position++;
+          }
+          if (separator != NULL)
           {
-               buffer_size += TOKEN_BUFSIZE;
-               tokens = realloc(tokens, buffer_size * sizeof(char*));
+               tokens[position] = separator;
+               position++;
           }
 
-          token = strtok(NULL, TOKEN_DELIM);
+          if (position >= buffer_size - 1) //keep room for a word and its operator, the old array stays in the arena until it is reset
+          {
+               char **larger = smallsh_arena_alloc(&command_arena, buffer_size * 2 * sizeof(char*));
+
+               memcpy(larger, tokens, buffer_size * sizeof(char*));
+               tokens = larger;
+               buffer_size *= 2;
+          }
      }
 
      tokens[position] = NULL; //add NULL to end of array for when passed to exec()
@@ -192,343 +1286,8875 @@ char **parse_line(char *user_input, int *num_args)
      return tokens;
 }
 
-/*********************************************************************************************************************
-** Function: smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal)
-** Description: Compares the args array to any built in commands, if not it will pass the command to exec()
-**
-** Parameters: the args array, number of elements, pointer to exit status, signal_flag, and terminating_signal
-***********************************************************************************************************************/
-int smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, bg_child *head)
+/**********************************************************************
+** Function: smallsh_quote_char(char c)
+** Description: returns the byte parse_line() keeps for a quoted or
+**              escaped character: the markers for "$", "*", "?" and
+**              "[" that expansion leaves alone, anything else as is
+** Parameters: the character
+**********************************************************************/
+char smallsh_quote_char(char c)
 {
-
-     int background_proccess = 0; //variable for checking if a command is to be executed as a background process. (0 == false, 1 == true)
-
-     //Compare arguments with built in functions
-
-     if ((args[0] == NULL) || (strcmp(args[0], "#") == 0)) //if command is empty or a comment
+     if (c == '$')
      {
-          return 1; //do nothing and reprint prompt
+          return EXPAND_LITERAL_DOLLAR;
      }
-     /* Built in command: "cd" should support both relative and absolute path */
-     else if (strcmp(args[0], "cd") == 0)
+     if (c == '*')
      {
-          //change to directory specified in the HOME environment variable
-          if (args[1] == NULL)
-          {
-               //credit: http://www.cplusplus.com/reference/cstdlib/getenv/
-               char* home_path;
-               home_path = getenv("HOME");
+          return GLOB_LITERAL_STAR;
+     }
+     if (c == '?')
+     {
+          return GLOB_LITERAL_QUESTION;
+     }
+     if (c == '[')
+     {
+          return GLOB_LITERAL_BRACKET;
+     }
 
-               if (home_path != NULL)
+     return c;
+}
+
+/**********************************************************************
+** Function: smallsh_intern_operator(char *token)
+** Description: returns the shell_operators entry for an unquoted
+**              operator, or the token itself for a normal word
+** Parameters: the unquoted token
+**********************************************************************/
+char *smallsh_intern_operator(char *token)
+{
+     int i;
+
+     if (((token_class[(unsigned char)token[0]] & TOKEN_CLASS_OPERATOR) == 0) || (token[1] != '\0' && token[2] != '\0'))
+     {
+          return smallsh_intern_redirect(token); //operators are one or two characters, "2>" or "2>&1" is a redirection
+     }
+
+     for (i = 0; shell_operators[i] != NULL; i++)
+     {
+          if (strcmp(token, shell_operators[i]) == 0)
+          {
+               return (char *)shell_operators[i];
+          }
+     }
+
+     return token;
+}
+
+/**********************************************************************
+** Function: smallsh_list_operator(const char *text, const char *end)
+** Description: returns the shell_operators entry for the ";", "&&"
+**              or "||" that starts at text, or NULL if there is none.
+**              These end an unquoted word wherever they are.
+** Parameters: start and end of the text
+**********************************************************************/
+char *smallsh_list_operator(const char *text, const char *end)
+{
+     if (*text == ';')
+     {
+          return (char *)shell_operators[SHELL_OPERATOR_SEMICOLON];
+     }
+     if ((text + 1 < end) && (text[1] == text[0]) && ((*text == '&') || (*text == '|')))
+     {
+          return smallsh_intern_operator((*text == '&') ? "&&" : "||");
+     }
+
+     return NULL;
+}
+
+/**********************************************************************
+** Function: smallsh_find_special_scalar(const char *text, const char *end)
+** Description: returns the first delimiter, quote, backslash, ";",
+**              "&" or "|" in [text, end), or end. Used when the CPU
+**              has no SIMD support and for the tail the vector
+**              versions leave.
+** Parameters: start and end of the text
+**********************************************************************/
+const char *smallsh_find_special_scalar(const char *text, const char *end)
+{
+     while ((text < end) && ((token_class[(unsigned char)*text] & (TOKEN_CLASS_DELIM | TOKEN_CLASS_QUOTE | TOKEN_CLASS_BREAK)) == 0))
+     {
+          text++;
+     }
+
+     return text;
+}
+
+#ifdef TOKENIZER_X86
+/**********************************************************************
+** Function: smallsh_find_special_sse2(const char *text, const char *end)
+** Description: SSE2 version of smallsh_find_special_scalar(), checks
+**              16 bytes per step
+** Parameters: start and end of the text
+**********************************************************************/
+__attribute__((target("sse2")))
+const char *smallsh_find_special_sse2(const char *text, const char *end)
+{
+     while (end - text >= 16)
+     {
+          __m128i block = _mm_loadu_si128((const __m128i *)text);
+          __m128i hits = _mm_or_si128(
+               _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+                            _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')))),
+               _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\a')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\''))),
+                            _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')))));
+          __m128i breaks = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(';')),
+                                        _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('&')), _mm_cmpeq_epi8(block, _mm_set1_epi8('|'))));
+          int mask = _mm_movemask_epi8(_mm_or_si128(hits, breaks));
+
+          if (mask != 0)
+          {
+               return text + __builtin_ctz(mask);
+          }
+          text += 16;
+     }
+
+     return smallsh_find_special_scalar(text, end);
+}
+
+/**********************************************************************
+** Function: smallsh_find_special_avx2(const char *text, const char *end)
+** Description: AVX2 version of smallsh_find_special_scalar(), checks
+**              32 bytes per step
+** Parameters: start and end of the text
+**********************************************************************/
+__attribute__((target("avx2")))
+const char *smallsh_find_special_avx2(const char *text, const char *end)
+{
+     while (end - text >= 32)
+     {
+          __m256i block = _mm256_loadu_si256((const __m256i *)text);
+          __m256i hits = _mm256_or_si256(
+               _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t'))),
+                               _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')))),
+               _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\a')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\''))),
+                               _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\')))));
+          __m256i breaks = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(';')),
+                                           _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('|'))));
+          unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(hits, breaks));
+
+          if (mask != 0)
+          {
+               return text + __builtin_ctz(mask);
+          }
+          text += 32;
+     }
+
+     return smallsh_find_special_sse2(text, end);
+}
+#endif
+
+/**********************************************************************
+** Function: smallsh_tokenizer_init(const char *isa)
+** Description: picks the smallsh_find_special() version, "scalar",
+**              "sse2" or "avx2", or the best the CPU supports when
+**              isa is NULL. Returns the name of the one picked.
+** Parameters: the requested version or NULL
+**********************************************************************/
+const char *smallsh_tokenizer_init(const char *isa)
+{
+     smallsh_find_special = smallsh_find_special_scalar;
+
+#ifdef TOKENIZER_X86
+     __builtin_cpu_init();
+
+     if (((isa == NULL) || (strcmp(isa, "avx2") == 0)) && __builtin_cpu_supports("avx2"))
+     {
+          smallsh_find_special = smallsh_find_special_avx2;
+          return "avx2";
+     }
+     if (((isa == NULL) || (strcmp(isa, "sse2") == 0)) && __builtin_cpu_supports("sse2"))
+     {
+          smallsh_find_special = smallsh_find_special_sse2;
+          return "sse2";
+     }
+#endif
+
+     return "scalar";
+}
+
+/**********************************************************************
+** Function: smallsh_arena_alloc(arena *pool, size_t size)
+** Description: returns size bytes (16 byte aligned) from the arena.
+**              Blocks are only allocated the first time the arena
+**              needs to get that big, after a reset they are reused.
+**              Anything over ARENA_LARGE_SIZE gets its own block
+**              that the next reset frees.
+** Parameters: the arena and the number of bytes
+**********************************************************************/
+void *smallsh_arena_alloc(arena *pool, size_t size)
+{
+     arena_block *block = pool->current;
+     void *memory;
+
+     size = (size + 15) & ~(size_t)15;
+
+     if (size > ARENA_LARGE_SIZE)
+     {
+          block = malloc(sizeof(arena_block) + size);
+          block->size = size;
+          block->used = size;
+          block->next = pool->large;
+          pool->large = block;
+          return block->data;
+     }
+
+     //move on to the next block that fits, keeping the ones passed over for after the next reset
+     while ((block != NULL) && (block->used + size > block->size))
+     {
+          block = block->next;
+     }
+
+     if (block == NULL)
+     {
+          size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+
+          block = malloc(sizeof(arena_block) + block_size);
+          block->size = block_size;
+          block->used = 0;
+          block->next = NULL;
+
+          if (pool->last == NULL)
+          {
+               pool->first = block;
+          }
+          else
+          {
+               pool->last->next = block;
+          }
+          pool->last = block;
+     }
+
+     pool->current = block;
+     memory = block->data + block->used;
+     block->used += size;
+
+     return memory;
+}
+
+/**********************************************************************
+** Function: smallsh_arena_reset(arena *pool)
+** Description: releases everything allocated from the arena at once
+**              (done before each command line)
+** Parameters: the arena
+**********************************************************************/
+void smallsh_arena_reset(arena *pool)
+{
+     arena_block *block;
+
+     for (block = pool->first; block != NULL; block = block->next)
+     {
+          block->used = 0;
+     }
+
+     while (pool->large != NULL)
+     {
+          block = pool->large;
+          pool->large = block->next;
+          free(block);
+     }
+
+     pool->current = pool->first;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_run_line(char **args, int num_args, int *exit_status, int *signal_flag,
+**                            int *terminating_signal, job_table *jobs)
+** Description: runs a parsed line: lists and blocks through the command tree, anything else straight
+**              through smallsh_execute(). Returns BLOCK_EXIT if "exit" ran, BLOCK_STOP if -e saw a
+**              failure or SIGINT stopped a block, and BLOCK_NEXT otherwise.
+** Parameters: the line's tokens, how many there are, the shell's status variables and the job table
+********************************************************************************************************/
+int smallsh_run_line(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     if (smallsh_block_start(args, num_args))
+     {
+          return smallsh_run_block(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+
+     args = smallsh_expand(args, &num_args, *exit_status);
+     if (smallsh_execute(args, num_args, exit_status, signal_flag, terminating_signal, jobs) == 0)
+     {
+          return BLOCK_EXIT;
+     }
+
+     return ((errexit == 1) && (*exit_status != 0)) ? BLOCK_STOP : BLOCK_NEXT;
+}
+
+/**********************************************************************
+** Function: smallsh_block_start(char **args, int num_args)
+** Description: returns 1 if a line has to go through the command
+**              tree: it starts with a reserved word, has a ";", "&&",
+**              "||" or an "&" that isn't the last word, or ends in
+**              a "|" that the next line continues
+** Parameters: the line's tokens and how many there are
+**********************************************************************/
+int smallsh_block_start(char **args, int num_args)
+{
+     int i;
+
+     if (num_args == 0)
+     {
+          return 0;
+     }
+
+     for (i = 0; reserved_words[i] != NULL; i++)
+     {
+          if (strcmp(args[0], reserved_words[i]) == 0)
+          {
+               return 1;
+          }
+     }
+
+     if (smallsh_is_operator(args[num_args - 1], "|"))
+     {
+          return 1;
+     }
+
+     for (i = 0; i < num_args; i++)
+     {
+          if ((args[i] == shell_operators[SHELL_OPERATOR_SEMICOLON]) || smallsh_is_operator(args[i], "&&") || smallsh_is_operator(args[i], "||"))
+          {
+               return 1;
+          }
+          if ((i < num_args - 1) && smallsh_is_operator(args[i], "&"))
+          {
+               return 1;
+          }
+     }
+
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_run_block(char **args, int num_args, int *exit_status, int *signal_flag,
+**                             int *terminating_signal, job_table *jobs)
+** Description: parses a line into a command tree, reading more lines with a "> " prompt while a block
+**              or a trailing "&&", "||" or "|" is still open, then runs the tree. SIGINT stops the
+**              whole block instead of only the command it hits. Returns BLOCK_EXIT if "exit" ran,
+**              BLOCK_STOP if the block was cut short and BLOCK_NEXT otherwise.
+** Parameters: the line's tokens, how many there are, the shell's status variables and the job table
+********************************************************************************************************/
+int smallsh_run_block(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     struct sigaction act, saved;
+     command_node *tree;
+     char **tokens = NULL;
+     int count = 0;
+     int status;
+     int result;
+
+     tokens = smallsh_block_append(tokens, &count, args, num_args);
+
+     while (1)
+     {
+          token_cursor cursor = { tokens, 0, count };
+          char *separator = (char *)shell_operators[SHELL_OPERATOR_SEMICOLON];
+          char *user_input;
+          char **more;
+          int num_more;
+
+          status = PARSE_OK;
+          tree = smallsh_parse_list(&cursor, &status, NULL);
+          if (status != PARSE_INCOMPLETE)
+          {
+               break;
+          }
+
+          prompt = "> ";
+          if (interactive == 1)
+          {
+               printf("%s", prompt);
+               fflush(stdout);
+          }
+          user_input = read_line(jobs);
+          prompt = ": ";
+
+          if (user_input == NULL)
+          {
+               printf("smallsh: syntax error: unexpected end of input\n");
+               status = PARSE_ERROR;
+               break;
+          }
+
+          //a line ends like a ";", unless it ended in an operator that takes the next line
+          more = parse_line(user_input, &num_more);
+          if (!smallsh_is_operator(tokens[count - 1], "|") && !smallsh_is_operator(tokens[count - 1], "&&") && !smallsh_is_operator(tokens[count - 1], "||"))
+          {
+               tokens = smallsh_block_append(tokens, &count, &separator, 1);
+          }
+          tokens = smallsh_block_append(tokens, &count, more, num_more);
+     }
+
+     if (status == PARSE_ERROR)
+     {
+          smallsh_arena_reset(&block_arena);
+          *exit_status = 2;
+          fflush(stdout);
+          return BLOCK_NEXT;
+     }
+
+     //SIGINT stops the block, the shell itself still ignores it
+     block_interrupted = 0;
+     act.sa_handler = smallsh_block_interrupt;
+     act.sa_flags = SA_RESTART;
+     sigemptyset(&act.sa_mask);
+     sigaction(SIGINT, &act, &saved);
+
+     result = smallsh_run_node(tree, exit_status, signal_flag, terminating_signal, jobs);
+
+     sigaction(SIGINT, &saved, NULL);
+     smallsh_arena_reset(&block_arena);
+
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_block_append(char **tokens, int *count,
+**                                char **more, int num_more)
+** Description: returns the block's tokens with more added, both in
+**              block_arena. Words are copied since the line they
+**              point into is read over by the next line, operators
+**              keep their interned pointers.
+** Parameters: the block's tokens (NULL to start), their count and
+**             the tokens to add
+**********************************************************************/
+char **smallsh_block_append(char **tokens, int *count, char **more, int num_more)
+{
+     char **grown = smallsh_arena_alloc(&block_arena, (*count + num_more + 1) * sizeof(char *));
+     int i;
+
+     if (*count > 0)
+     {
+          memcpy(grown, tokens, *count * sizeof(char *));
+     }
+
+     for (i = 0; i < num_more; i++)
+     {
+          char *token = more[i];
+
+          if (!smallsh_is_operator(token, token) && !smallsh_is_redirect(token))
+          {
+               size_t length = strlen(token) + 1;
+
+               token = smallsh_arena_alloc(&block_arena, length);
+               memcpy(token, more[i], length);
+          }
+          grown[*count + i] = token;
+     }
+
+     *count += num_more;
+     grown[*count] = NULL;
+
+     return grown;
+}
+
+/**********************************************************************
+** Function: smallsh_node_new(int type)
+** Description: returns a zeroed command tree node from block_arena
+** Parameters: the node type
+**********************************************************************/
+command_node *smallsh_node_new(int type)
+{
+     command_node *node = smallsh_arena_alloc(&block_arena, sizeof(command_node));
+
+     memset(node, 0, sizeof(command_node));
+     node->type = type;
+
+     return node;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_parse_list(token_cursor *cursor, int *status, const char **terminators)
+** Description: parses "&&"/"||" lists separated by ";" until one of the terminators comes up at a command
+**              position (left for the caller) or the tokens run out, which leaves status at
+**              PARSE_INCOMPLETE inside a block. Returns the list, NULL if it was empty.
+** Parameters: the token cursor, the parse status and a NULL terminated list of reserved words that end
+**             the list (NULL at the top level)
+********************************************************************************************************/
+command_node *smallsh_parse_list(token_cursor *cursor, int *status, const char **terminators)
+{
+     command_node *list = NULL;
+
+     while (*status == PARSE_OK)
+     {
+          command_node *next;
+          int i;
+
+          //empty commands and line ends
+          while ((cursor->position < cursor->count) && (cursor->tokens[cursor->position] == shell_operators[SHELL_OPERATOR_SEMICOLON]))
+          {
+               cursor->position++;
+          }
+
+          if (cursor->position == cursor->count)
+          {
+               if (terminators != NULL)
                {
-                    chdir(home_path);
+                    *status = PARSE_INCOMPLETE;
                }
+               break;
+          }
+
+          for (i = 0; (terminators != NULL) && (terminators[i] != NULL); i++)
+          {
+               if (smallsh_is_keyword(cursor->tokens[cursor->position], terminators[i]))
+               {
+                    return list;
+               }
+          }
+
+          next = smallsh_parse_and_or(cursor, status);
+          if (next == NULL)
+          {
+               break;
+          }
+
+          if (list == NULL)
+          {
+               list = next;
           }
-          //change to specified directory, if not print error
           else
           {
-               if (chdir(args[1]) != 0)
+               command_node *node = smallsh_node_new(NODE_LIST);
+               node->left = list;
+               node->right = next;
+               list = node;
+          }
+
+          //after a block only a ";" or a reserved word can follow, "fi done" is fine, "fi echo" isn't ("a & b" is)
+          if ((cursor->position < cursor->count) && (cursor->tokens[cursor->position] != shell_operators[SHELL_OPERATOR_SEMICOLON])
+              && !smallsh_is_operator(cursor->tokens[cursor->position - 1], "&"))
+          {
+               int terminator = 0;
+
+               for (i = 0; (terminators != NULL) && (terminators[i] != NULL); i++)
                {
-                    printf("smallsh: Could not find the directory \"%s\"\n", args[1]);
-                    *exit_status = 1;
+                    terminator |= smallsh_is_keyword(cursor->tokens[cursor->position], terminators[i]);
+               }
+               if (terminator == 0)
+               {
+                    smallsh_parse_error(cursor, status);
                }
           }
+     }
+
+     return list;
+}
+
+/**********************************************************************
+** Function: smallsh_parse_and_or(token_cursor *cursor, int *status)
+** Description: parses commands joined by "&&" and "||", which group
+**              left to right. The command after the operator may be
+**              on the next line. Returns NULL on an error.
+** Parameters: the token cursor and the parse status
+**********************************************************************/
+command_node *smallsh_parse_and_or(token_cursor *cursor, int *status)
+{
+     command_node *left = smallsh_parse_command(cursor, status);
+
+     while ((left != NULL) && (cursor->position < cursor->count))
+     {
+          char *op = cursor->tokens[cursor->position];
+          command_node *node;
+
+          if (!smallsh_is_operator(op, "&&") && !smallsh_is_operator(op, "||"))
+          {
+               break;
+          }
+          cursor->position++;
+
+          node = smallsh_node_new(smallsh_is_operator(op, "&&") ? NODE_AND : NODE_OR);
+          node->left = left;
+          node->right = smallsh_parse_command(cursor, status);
+          if (node->right == NULL)
+          {
+               return NULL;
+          }
+          left = node;
+     }
+
+     return left;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_parse_command(token_cursor *cursor, int *status)
+** Description: parses a while, until, for or if block, or a simple command: the words up to a ";", "&&",
+**              "||" or the end, with a trailing "&" kept as its last word so smallsh_execute() starts it
+**              in the background. Pipelines and redirections stay in the words. Returns NULL on an error
+**              or when the tokens run out.
+** Parameters: the token cursor and the parse status
+********************************************************************************************************/
+command_node *smallsh_parse_command(token_cursor *cursor, int *status)
+{
+     const char *do_words[] = { "do", NULL };
+     const char *done_words[] = { "done", NULL };
+     command_node *node;
+     char *word;
+     int start;
+     int i;
+
+     if (cursor->position == cursor->count)
+     {
+          *status = PARSE_INCOMPLETE;
+          return NULL;
+     }
+     word = cursor->tokens[cursor->position];
+
+     if (smallsh_is_keyword(word, "if"))
+     {
+          cursor->position++;
+          return smallsh_parse_if(cursor, status);
+     }
+
+     if (smallsh_is_keyword(word, "while") || smallsh_is_keyword(word, "until"))
+     {
+          node = smallsh_node_new(smallsh_is_keyword(word, "while") ? NODE_WHILE : NODE_UNTIL);
+          cursor->position++;
+
+          node->left = smallsh_parse_list(cursor, status, do_words);
+          if ((*status == PARSE_OK) && (node->left == NULL))
+          {
+               smallsh_parse_error(cursor, status);
+          }
+          if (!smallsh_parse_expect(cursor, status, "do"))
+          {
+               return NULL;
+          }
+          node->right = smallsh_parse_list(cursor, status, done_words);
+          if (!smallsh_parse_expect(cursor, status, "done"))
+          {
+               return NULL;
+          }
+          return node;
+     }
+
+     //"for NAME in words ; do list done", without "in" there is nothing to loop over
+     if (smallsh_is_keyword(word, "for"))
+     {
+          node = smallsh_node_new(NODE_FOR);
+          cursor->position++;
+
+          if (cursor->position == cursor->count)
+          {
+               *status = PARSE_INCOMPLETE;
+               return NULL;
+          }
+          node->name = cursor->tokens[cursor->position];
+          if (!smallsh_is_name(node->name, strlen(node->name)))
+          {
+               printf("smallsh: for: invalid variable name %s\n", node->name);
+               *status = PARSE_ERROR;
+               return NULL;
+          }
+          cursor->position++;
+
+          if ((cursor->position < cursor->count) && smallsh_is_keyword(cursor->tokens[cursor->position], "in"))
+          {
+               cursor->position++;
+               node->words = &cursor->tokens[cursor->position];
+               while ((cursor->position < cursor->count) && (cursor->tokens[cursor->position] != shell_operators[SHELL_OPERATOR_SEMICOLON]))
+               {
+                    cursor->position++;
+               }
+               node->num_words = &cursor->tokens[cursor->position] - node->words;
+          }
+
+          while ((cursor->position < cursor->count) && (cursor->tokens[cursor->position] == shell_operators[SHELL_OPERATOR_SEMICOLON]))
+          {
+               cursor->position++;
+          }
+          if (!smallsh_parse_expect(cursor, status, "do"))
+          {
+               return NULL;
+          }
+          node->right = smallsh_parse_list(cursor, status, done_words);
+          if (!smallsh_parse_expect(cursor, status, "done"))
+          {
+               return NULL;
+          }
+          return node;
+     }
+
+     //the other reserved words only continue or close a block
+     for (i = 0; reserved_words[i] != NULL; i++)
+     {
+          if (smallsh_is_keyword(word, reserved_words[i]))
+          {
+               smallsh_parse_error(cursor, status);
+               return NULL;
+          }
+     }
+
+     node = smallsh_node_new(NODE_COMMAND);
+     node->words = &cursor->tokens[cursor->position];
+     start = cursor->position;
+
+     while (cursor->position < cursor->count)
+     {
+          char *token = cursor->tokens[cursor->position];
+
+          if ((token == shell_operators[SHELL_OPERATOR_SEMICOLON]) || smallsh_is_operator(token, "&&") || smallsh_is_operator(token, "||"))
+          {
+               break;
+          }
+          cursor->position++;
+          if (smallsh_is_operator(token, "&"))
+          {
+               break;
+          }
+     }
+
+     node->num_words = cursor->position - start;
+     if (node->num_words == 0)
+     {
+          smallsh_parse_error(cursor, status);
+          return NULL;
+     }
+
+     //"a |" at the end of a line, the pipeline goes on on the next one
+     if ((cursor->position == cursor->count) && smallsh_is_operator(node->words[node->num_words - 1], "|"))
+     {
+          *status = PARSE_INCOMPLETE;
+          return NULL;
+     }
+
+     return node;
+}
+
+/**********************************************************************
+** Function: smallsh_parse_if(token_cursor *cursor, int *status)
+** Description: parses the rest of an "if" (or "elif") once the word
+**              itself has been taken: the condition, "then" and its
+**              list, then an "elif", which becomes a nested NODE_IF
+**              in the else branch, or an "else" list, and "fi".
+**              Returns NULL on an error.
+** Parameters: the token cursor and the parse status
+**********************************************************************/
+command_node *smallsh_parse_if(token_cursor *cursor, int *status)
+{
+     const char *then_words[] = { "then", NULL };
+     const char *branch_words[] = { "elif", "else", "fi", NULL };
+     const char *fi_words[] = { "fi", NULL };
+     command_node *node = smallsh_node_new(NODE_IF);
+
+     node->left = smallsh_parse_list(cursor, status, then_words);
+     if ((*status == PARSE_OK) && (node->left == NULL))
+     {
+          smallsh_parse_error(cursor, status);
+     }
+     if (!smallsh_parse_expect(cursor, status, "then"))
+     {
+          return NULL;
+     }
+
+     node->right = smallsh_parse_list(cursor, status, branch_words);
+     if (*status != PARSE_OK)
+     {
+          return NULL;
+     }
+
+     if (smallsh_is_keyword(cursor->tokens[cursor->position], "elif"))
+     {
+          cursor->position++;
+          node->other = smallsh_parse_if(cursor, status);
+          return (node->other == NULL) ? NULL : node;
+     }
+
+     if (smallsh_is_keyword(cursor->tokens[cursor->position], "else"))
+     {
+          cursor->position++;
+          node->other = smallsh_parse_list(cursor, status, fi_words);
+     }
+
+     if (!smallsh_parse_expect(cursor, status, "fi"))
+     {
+          return NULL;
+     }
+
+     return node;
+}
+
+/**********************************************************************
+** Function: smallsh_parse_expect(token_cursor *cursor, int *status,
+**                                const char *keyword)
+** Description: takes the reserved word that has to come next. Returns
+**              1 if it was there, 0 if the status was already bad,
+**              the tokens ran out or something else came up.
+** Parameters: the token cursor, the parse status and the word
+**********************************************************************/
+int smallsh_parse_expect(token_cursor *cursor, int *status, const char *keyword)
+{
+     if (*status != PARSE_OK)
+     {
+          return 0;
+     }
+
+     if (cursor->position == cursor->count)
+     {
+          *status = PARSE_INCOMPLETE;
+          return 0;
+     }
+
+     if (!smallsh_is_keyword(cursor->tokens[cursor->position], keyword))
+     {
+          smallsh_parse_error(cursor, status);
+          return 0;
+     }
+
+     cursor->position++;
+     return 1;
+}
+
+/**********************************************************************
+** Function: smallsh_parse_error(token_cursor *cursor, int *status)
+** Description: reports the token at the cursor as unexpected and sets
+**              the status to PARSE_ERROR
+** Parameters: the token cursor and the parse status
+**********************************************************************/
+void smallsh_parse_error(token_cursor *cursor, int *status)
+{
+     if (cursor->position < cursor->count)
+     {
+          printf("smallsh: syntax error near %s\n", cursor->tokens[cursor->position]);
+     }
+     else
+     {
+          printf("smallsh: syntax error: unexpected end of input\n");
+     }
+
+     *status = PARSE_ERROR;
+}
+
+/**********************************************************************
+** Function: smallsh_is_keyword(const char *token, const char *keyword)
+** Description: returns 1 if the token is the reserved word. Operators
+**              never match since no reserved word is spelled like one.
+** Parameters: the token (may be NULL) and the word
+**********************************************************************/
+int smallsh_is_keyword(const char *token, const char *keyword)
+{
+     return (token != NULL) && (strcmp(token, keyword) == 0);
+}
+
+/**********************************************************************
+** Function: smallsh_is_name(const char *text, size_t length)
+** Description: returns 1 if the first length characters of text are
+**              a variable name: a letter or "_", then letters, digits
+**              and "_"
+** Parameters: the text and how much of it to check
+**********************************************************************/
+int smallsh_is_name(const char *text, size_t length)
+{
+     size_t i;
+
+     if ((length == 0) || isdigit((unsigned char)text[0]))
+     {
+          return 0;
+     }
+
+     for (i = 0; i < length; i++)
+     {
+          if (!isalnum((unsigned char)text[i]) && (text[i] != '_'))
+          {
+               return 0;
+          }
+     }
+
+     return 1;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_run_node(command_node *node, int *exit_status, int *signal_flag,
+**                            int *terminating_signal, job_table *jobs)
+** Description: runs a command tree. Each command gets a fresh command arena and a background job check,
+**              the same as a line typed at the prompt, and its words are expanded every time it runs.
+**              Conditions (of if, while, until and the left of "&&"/"||") don't trigger -e. A while or
+**              until loop ends with the status of its last body run, an "if" without a branch taken
+**              with 0. Returns BLOCK_EXIT, BLOCK_STOP or BLOCK_NEXT like smallsh_run_block().
+** Parameters: the tree (may be NULL), the shell's status variables and the job table
+********************************************************************************************************/
+int smallsh_run_node(command_node *node, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     int result = BLOCK_NEXT;
+
+     if (node == NULL)
+     {
+          return BLOCK_NEXT;
+     }
+     if (block_interrupted == 1)
+     {
+          return BLOCK_STOP;
+     }
+
+     if (node->type == NODE_COMMAND)
+     {
+          char **args;
+          int num_args = node->num_words;
+
+          //smallsh_execute() cuts up the words it gets, so it gets a copy
+          smallsh_arena_reset(&command_arena);
+          smallsh_bg_status_check(jobs);
+
+          args = smallsh_arena_alloc(&command_arena, (node->num_words + 1) * sizeof(char *));
+          memcpy(args, node->words, node->num_words * sizeof(char *));
+          args[node->num_words] = NULL;
+          args = smallsh_expand(args, &num_args, *exit_status);
+
+          if (smallsh_execute(args, num_args, exit_status, signal_flag, terminating_signal, jobs) == 0)
+          {
+               return BLOCK_EXIT;
+          }
+          if ((block_interrupted == 1) || ((*signal_flag == 1) && (*terminating_signal == SIGINT)))
+          {
+               return BLOCK_STOP;
+          }
+          if ((errexit == 1) && (*exit_status != 0) && (condition_depth == 0))
+          {
+               return BLOCK_STOP;
+          }
+     }
+     else if (node->type == NODE_LIST)
+     {
+          result = smallsh_run_node(node->left, exit_status, signal_flag, terminating_signal, jobs);
+          if (result == BLOCK_NEXT)
+          {
+               result = smallsh_run_node(node->right, exit_status, signal_flag, terminating_signal, jobs);
+          }
+     }
+     else if ((node->type == NODE_AND) || (node->type == NODE_OR))
+     {
+          condition_depth++;
+          result = smallsh_run_node(node->left, exit_status, signal_flag, terminating_signal, jobs);
+          condition_depth--;
+
+          if ((result == BLOCK_NEXT) && ((*exit_status == 0) == (node->type == NODE_AND)))
+          {
+               result = smallsh_run_node(node->right, exit_status, signal_flag, terminating_signal, jobs);
+          }
+     }
+     else if (node->type == NODE_IF)
+     {
+          condition_depth++;
+          result = smallsh_run_node(node->left, exit_status, signal_flag, terminating_signal, jobs);
+          condition_depth--;
+
+          if (result != BLOCK_NEXT)
+          {
+               return result;
+          }
+
+          if (*exit_status == 0)
+          {
+               result = smallsh_run_node(node->right, exit_status, signal_flag, terminating_signal, jobs);
+          }
+          else if (node->other != NULL)
+          {
+               result = smallsh_run_node(node->other, exit_status, signal_flag, terminating_signal, jobs);
+          }
+          else
+          {
+               *exit_status = 0;
+          }
+     }
+     else if ((node->type == NODE_WHILE) || (node->type == NODE_UNTIL))
+     {
+          int body_status = 0;
+
+          while (1)
+          {
+               condition_depth++;
+               result = smallsh_run_node(node->left, exit_status, signal_flag, terminating_signal, jobs);
+               condition_depth--;
+
+               if ((result != BLOCK_NEXT) || ((*exit_status == 0) != (node->type == NODE_WHILE)))
+               {
+                    break;
+               }
+
+               result = smallsh_run_node(node->right, exit_status, signal_flag, terminating_signal, jobs);
+               if (result != BLOCK_NEXT)
+               {
+                    break;
+               }
+               body_status = *exit_status;
+          }
+
+          if (result == BLOCK_NEXT)
+          {
+               *exit_status = body_status;
+          }
+     }
+     else if (node->type == NODE_FOR)
+     {
+          shell_variable binding;
+          char **words;
+          char **values;
+          int num_values = node->num_words;
+          int i;
+
+          //the list is expanded once, before the first run of the body resets the command arena
+          smallsh_arena_reset(&command_arena);
+          words = smallsh_arena_alloc(&command_arena, (node->num_words + 1) * sizeof(char *));
+          memcpy(words, node->words, node->num_words * sizeof(char *));
+          words[node->num_words] = NULL;
+          words = smallsh_expand(words, &num_values, *exit_status);
+
+          values = malloc((num_values + 1) * sizeof(char *));
+          for (i = 0; i < num_values; i++)
+          {
+               values[i] = strdup(words[i]);
+          }
+
+          //bound for the body only, the commands in it don't get it in their environment
+          binding.name = node->name;
+          binding.value = NULL;
+          binding.next = shell_variables;
+          shell_variables = &binding;
+
+          *exit_status = 0;
+          for (i = 0; (i < num_values) && (result == BLOCK_NEXT); i++)
+          {
+               binding.value = values[i];
+               result = smallsh_run_node(node->right, exit_status, signal_flag, terminating_signal, jobs);
+          }
+
+          shell_variables = binding.next;
+
+          for (i = 0; i < num_values; i++)
+          {
+               free(values[i]);
+          }
+          free(values);
+     }
+
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_block_interrupt(int signal_number)
+** Description: SIGINT handler while a block runs, the block stops
+**              after the command it is in
+** Parameters: the signal number
+**********************************************************************/
+void smallsh_block_interrupt(int signal_number)
+{
+     (void)signal_number; //only SIGINT is handled here
+     block_interrupted = 1;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_expand(char **args, int *num_args, int exit_status)
+** Description: expands "$?" (the last status), "$$" (the shell's pid), "$!" (the last background pid),
+**              "$NAME" and "${NAME}" ("for" or environment variables, empty if unset). A "$" that doesn't start
+**              one of those stays as it is, and one that was quoted or escaped was marked by parse_line().
+**              Then a word with an unquoted "*", "?" or "[" is replaced by the paths it matches, sorted,
+**              or kept as it is if nothing matches. A redirection target is only replaced by a single
+**              match. Returns args itself when nothing needs expanding, else a copy in the command arena,
+**              and updates num_args.
+** Parameters: the command's words (NULL terminated), where their count is and the last exit status
+********************************************************************************************************/
+char **smallsh_expand(char **args, int *num_args, int exit_status)
+{
+     char **words = NULL;  //built once the words differ from args, doubled in the command arena as it fills
+     int num_words = 0;
+     int capacity = 0;
+     int i;
+
+     for (i = 0; i < *num_args; i++)
+     {
+          char *word = args[i];
+          char **matches = NULL;
+          int num_matches = 0;
+          int j;
+
+          if (strpbrk(word, EXPAND_SPECIAL) != NULL)
+          {
+               size_t length = smallsh_expand_word(args[i], NULL, exit_status);
+
+               word = smallsh_arena_alloc(&command_arena, length + 1);
+               smallsh_expand_word(args[i], word, exit_status);
+          }
+
+          if (strpbrk(word, GLOB_SPECIAL) != NULL)
+          {
+               if (strpbrk(word, "*?[") != NULL)
+               {
+                    matches = smallsh_glob(word, &num_matches);
+                    if ((matches != NULL) && (num_matches > 1) && (i > 0) && smallsh_is_redirect(args[i - 1]))
+                    {
+                         matches = NULL; //ambiguous, the target stays the pattern
+                    }
+               }
+
+               if ((matches == NULL) && (strpbrk(word, GLOB_LITERALS) != NULL))
+               {
+                    if (word == args[i])
+                    {
+                         word = smallsh_arena_alloc(&command_arena, strlen(args[i]) + 1);
+                         strcpy(word, args[i]);
+                    }
+                    smallsh_glob_unquote(word);
+               }
+          }
+
+          if ((words == NULL) && ((word != args[i]) || (matches != NULL)))
+          {
+               capacity = *num_args + 16;
+               words = smallsh_arena_alloc(&command_arena, capacity * sizeof(char *));
+               memcpy(words, args, i * sizeof(char *));
+               num_words = i;
+          }
+          if (words == NULL)
+          {
+               continue;
+          }
+
+          if (matches == NULL)
+          {
+               matches = &word;
+               num_matches = 1;
+          }
+          if (num_words + num_matches >= capacity) //keeps room for the NULL, the old array stays in the arena until it is reset
+          {
+               char **larger;
+
+               capacity = (num_words + num_matches) * 2;
+               larger = smallsh_arena_alloc(&command_arena, capacity * sizeof(char *));
+               memcpy(larger, words, num_words * sizeof(char *));
+               words = larger;
+          }
+          for (j = 0; j < num_matches; j++)
+          {
+               words[num_words++] = matches[j];
+          }
+     }
+
+     if (words == NULL)
+     {
+          return args;
+     }
+
+     words[num_words] = NULL;
+     *num_args = num_words;
+
+     return words;
+}
+
+/**********************************************************************
+** Function: smallsh_variable_get(const char *name)
+** Description: returns the value "$name" expands to: the innermost
+**              "for" variable of that name, else the environment
+**              variable, NULL if neither is set
+** Parameters: the variable name
+**********************************************************************/
+const char *smallsh_variable_get(const char *name)
+{
+     shell_variable *current;
+
+     for (current = shell_variables; current != NULL; current = current->next)
+     {
+          if (strcmp(current->name, name) == 0)
+          {
+               return current->value;
+          }
+     }
+
+     return getenv(name);
+}
+
+/**********************************************************************
+** Function: smallsh_expand_word(const char *word, char *out,
+**                               int exit_status)
+** Description: returns the length of the word once expanded and, if
+**              out isn't NULL, writes it there with its terminator.
+**              Called once to size the copy and once to fill it.
+** Parameters: the word, where to write it and the last exit status
+**********************************************************************/
+size_t smallsh_expand_word(const char *word, char *out, int exit_status)
+{
+     char number[24];
+     char name[NAME_MAX];
+     size_t length = 0;
+
+     while (*word != '\0')
+     {
+          const char *piece = word;
+          size_t piece_length = 1;
+          const char *end;
+
+          if (*word == EXPAND_LITERAL_DOLLAR)
+          {
+               piece = "$";
+               word++;
+          }
+          else if ((*word != '$') || (word[1] == '\0'))
+          {
+               word++;
+          }
+          else if ((word[1] == '?') || (word[1] == '$') || (word[1] == '!'))
+          {
+               long value = (word[1] == '?') ? exit_status : ((word[1] == '$') ? (long)getpid() : (long)last_background_pid);
+
+               snprintf(number, sizeof(number), "%ld", value);
+               piece = number;
+               piece_length = strlen(number);
+               word += 2;
+          }
+          else
+          {
+               int braced = (word[1] == '{');
+               const char *start = word + 1 + braced;
+
+               for (end = start; isalnum((unsigned char)*end) || (*end == '_'); end++)
+               {
+               }
+
+               if (!smallsh_is_name(start, end - start) || ((size_t)(end - start) >= sizeof(name)) || (braced && (*end != '}')))
+               {
+                    word++; //not a variable, the "$" is kept
+               }
+               else
+               {
+                    memcpy(name, start, end - start);
+                    name[end - start] = '\0';
+                    piece = smallsh_variable_get(name);
+                    piece_length = (piece == NULL) ? 0 : strlen(piece);
+                    word = end + braced;
+               }
+          }
+
+          if ((out != NULL) && (piece_length > 0))
+          {
+               memcpy(out + length, piece, piece_length);
+          }
+          length += piece_length;
+     }
+
+     if (out != NULL)
+     {
+          out[length] = '\0';
+     }
+
+     return length;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_unquote(char *word)
+** Description: turns the markers parse_line() left for quoted "*",
+**              "?" and "[" back into the characters, in place
+** Parameters: the word
+**********************************************************************/
+void smallsh_glob_unquote(char *word)
+{
+     for (word = strpbrk(word, GLOB_LITERALS); word != NULL; word = strpbrk(word + 1, GLOB_LITERALS))
+     {
+          *word = (*word == GLOB_LITERAL_STAR) ? '*' : ((*word == GLOB_LITERAL_QUESTION) ? '?' : '[');
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_glob(const char *pattern, int *count)
+** Description: pathname expansion of one word. The pattern is cut at "/" into components that are
+**              compiled once, plain components are looked up with one lstat() at the end and the others
+**              are matched against cached directory listings. A "**" component matches any number of
+**              directories (not following symbolic links), and a pattern that ends with "/" only matches
+**              directories. Names starting with "." only match a component that starts with ".".
+**              Everything, the compiled pattern and the matches, comes from the command arena. Returns the
+**              sorted matches and sets count, or NULL if nothing matched (or the word has nothing to match).
+** Parameters: the expanded word and where to store the number of matches
+********************************************************************************************************/
+char **smallsh_glob(const char *pattern, int *count)
+{
+     glob_state state;
+     char *spec = smallsh_arena_alloc(&command_arena, strlen(pattern) + 1);
+     char *component;
+     char **matches = NULL;
+     int wild = 0;
+     int i;
+
+     strcpy(spec, pattern);
+     memset(&state, 0, sizeof(state));
+     state.components = smallsh_arena_alloc(&command_arena, ((strlen(spec) / 2) + 1) * sizeof(glob_component));
+     state.dirs_only = (spec[0] != '\0') && (spec[strlen(spec) - 1] == '/');
+
+     for (component = strtok(spec, "/"); component != NULL; component = strtok(NULL, "/"))
+     {
+          wild |= smallsh_glob_compile(component, &state.components[state.num_components++]);
+     }
+
+     if (wild && (state.num_components > 0))
+     {
+          state.path = smallsh_arena_alloc(&command_arena, PATH_MAX);
+          state.path[0] = '/';
+          smallsh_glob_walk(&state, 0, (pattern[0] == '/') ? 1 : 0);
+     }
+
+     if (state.count > 0)
+     {
+          qsort_r(state.offsets, state.count, sizeof(size_t), smallsh_glob_compare, state.text);
+
+          //the words point into the text, which stays in the arena with them
+          matches = smallsh_arena_alloc(&command_arena, state.count * sizeof(char *));
+          for (i = 0; i < state.count; i++)
+          {
+               matches[i] = state.text + state.offsets[i];
+          }
+          *count = state.count;
+     }
+
+     return matches;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_compile(char *text, glob_component *component)
+** Description: compiles a pattern component into runs of literal
+**              text, "?", "*" and [...] classes ("!" or "^" negates,
+**              "a-z" is a range, a leading "]" is a member and an
+**              unclosed "[" is literal). Literal runs are compacted
+**              in place with quoted characters turned back. Returns
+**              1 if the component has anything to match.
+** Parameters: the component (NUL terminated, rewritten) and where to
+**             store the compiled component
+**********************************************************************/
+int smallsh_glob_compile(char *text, glob_component *component)
+{
+     char *read = text;
+     char *write = text;
+     glob_op *op = NULL;
+
+     memset(component, 0, sizeof(glob_component));
+     component->ops = smallsh_arena_alloc(&command_arena, (strlen(text) + 1) * sizeof(glob_op));
+     component->dot = (text[0] == '.');
+     component->globstar = (strcmp(text, "**") == 0);
+
+     while (*read != '\0')
+     {
+          char *close = NULL;
+
+          if (*read == '[')
+          {
+               //the closing "]" can't be the first member
+               close = read + 1 + ((read[1] == '!') || (read[1] == '^'));
+               close = strchr(close + (*close == ']'), ']');
+          }
+
+          if (*read == '*')
+          {
+               if ((op == NULL) || (op->type != GLOB_OP_STAR))
+               {
+                    op = &component->ops[component->num_ops++];
+                    op->type = GLOB_OP_STAR;
+               }
+               read++;
+          }
+          else if (*read == '?')
+          {
+               op = &component->ops[component->num_ops++];
+               op->type = GLOB_OP_ANY;
+               component->min_length++;
+               read++;
+          }
+          else if (close != NULL)
+          {
+               int negate = (read[1] == '!') || (read[1] == '^');
+               int i;
+
+               op = &component->ops[component->num_ops++];
+               op->type = GLOB_OP_CLASS;
+               memset(op->set, 0, sizeof(op->set));
+               component->min_length++;
+
+               for (read += 1 + negate; read < close; read++)
+               {
+                    unsigned char first = *read;
+                    unsigned char last = first;
+
+                    if ((read[1] == '-') && (read + 2 < close))
+                    {
+                         last = read[2];
+                         read += 2;
+                    }
+                    for (i = first; i <= last; i++)
+                    {
+                         unsigned char member = i;
+
+                         member = (member == GLOB_LITERAL_STAR) ? '*' : ((member == GLOB_LITERAL_QUESTION) ? '?' : ((member == GLOB_LITERAL_BRACKET) ? '[' : member));
+                         op->set[member / 8] |= 1 << (member % 8);
+                    }
+               }
+               if (negate)
+               {
+                    for (i = 0; i < 32; i++)
+                    {
+                         op->set[i] = ~op->set[i];
+                    }
+               }
+               read = close + 1;
+          }
+          else
+          {
+               char c = *read++;
+
+               if ((op == NULL) || (op->type != GLOB_OP_LITERAL))
+               {
+                    op = &component->ops[component->num_ops++];
+                    op->type = GLOB_OP_LITERAL;
+                    op->text = write;
+                    op->length = 0;
+               }
+               *write++ = (c == GLOB_LITERAL_STAR) ? '*' : ((c == GLOB_LITERAL_QUESTION) ? '?' : ((c == GLOB_LITERAL_BRACKET) ? '[' : c));
+               op->length++;
+               component->min_length++;
+          }
+     }
+     *write = '\0';
+
+     component->wild = !((component->num_ops == 0) || ((component->num_ops == 1) && (component->ops[0].type == GLOB_OP_LITERAL)));
+     component->text = text;
+     component->length = write - text;
+
+     return component->wild;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_match(const glob_component *component,
+**                              const char *name, size_t length)
+** Description: returns 1 if the name matches the component. Names
+**              that are too short or miss a literal prefix or suffix
+**              are turned away first. A "*" is backtracked to one
+**              byte at a time, jumping with memchr() to where the
+**              literal after it could start.
+** Parameters: the compiled component and the name
+**********************************************************************/
+int smallsh_glob_match(const glob_component *component, const char *name, size_t length)
+{
+     const glob_op *ops = component->ops;
+     const glob_op *last = &ops[component->num_ops - 1];
+     int num_ops = component->num_ops;
+     int op = 0;
+     int star = -1;
+     size_t at = 0;
+     size_t star_at = 0;
+
+     if (length < component->min_length)
+     {
+          return 0;
+     }
+     if ((ops[0].type == GLOB_OP_LITERAL) && (memcmp(name, ops[0].text, ops[0].length) != 0))
+     {
+          return 0;
+     }
+     if ((last->type == GLOB_OP_LITERAL) && (memcmp(name + length - last->length, last->text, last->length) != 0))
+     {
+          return 0;
+     }
+
+     while ((op < num_ops) || (at < length))
+     {
+          if (op < num_ops)
+          {
+               const glob_op *current = &ops[op];
+
+               if (current->type == GLOB_OP_STAR)
+               {
+                    star = op++;
+                    star_at = at;
+                    continue;
+               }
+               if ((current->type == GLOB_OP_LITERAL) && (length - at >= current->length) && (memcmp(name + at, current->text, current->length) == 0))
+               {
+                    at += current->length;
+                    op++;
+                    continue;
+               }
+               if ((current->type == GLOB_OP_ANY) && (at < length))
+               {
+                    at++;
+                    op++;
+                    continue;
+               }
+               if ((current->type == GLOB_OP_CLASS) && (at < length) && (current->set[(unsigned char)name[at] / 8] & (1 << ((unsigned char)name[at] % 8))))
+               {
+                    at++;
+                    op++;
+                    continue;
+               }
+          }
+
+          //no match here, the last "*" takes one more byte
+          if ((star == -1) || (star_at >= length))
+          {
+               return 0;
+          }
+          star_at++;
+          op = star + 1;
+          if ((op < num_ops) && (ops[op].type == GLOB_OP_LITERAL))
+          {
+               const char *next = memchr(name + star_at, ops[op].text[0], length - star_at);
+
+               if (next == NULL)
+               {
+                    return 0;
+               }
+               star_at = next - name;
+          }
+          at = star_at;
+     }
+
+     return 1;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_walk(glob_state *state, int index,
+**                             size_t path_length)
+** Description: matches the components from index on below the
+**              directory the path buffer holds (path_length bytes
+**              ending in "/", or none for the current directory),
+**              adding what matches the last one
+** Parameters: the expansion, the component and the directory
+**********************************************************************/
+void smallsh_glob_walk(glob_state *state, int index, size_t path_length)
+{
+     glob_component *component = &state->components[index];
+     int last = (index == state->num_components - 1);
+     dir_listing *listing;
+     int i;
+
+     if (!component->wild && !component->globstar)
+     {
+          struct stat info;
+
+          if (!smallsh_glob_path(state, path_length, component->text, component->length))
+          {
+               return;
+          }
+          if (!last)
+          {
+               state->path[path_length + component->length] = '/';
+               smallsh_glob_walk(state, index + 1, path_length + component->length + 1);
+          }
+          else if (state->dirs_only ? ((stat(state->path, &info) == 0) && S_ISDIR(info.st_mode)) : (lstat(state->path, &info) == 0))
+          {
+               smallsh_glob_add(state, path_length + component->length, state->dirs_only);
+          }
+          return;
+     }
+
+     //"**" first matches no directory at all
+     if (component->globstar && !last)
+     {
+          smallsh_glob_walk(state, index + 1, path_length);
+     }
+
+     state->path[path_length] = '\0';
+     listing = smallsh_dir_cache_get((path_length == 0) ? "." : state->path);
+     if (listing == NULL)
+     {
+          return;
+     }
+     listing->pinned++;
+
+     for (i = 0; i < listing->count; i++)
+     {
+          const char *name = listing->names + listing->offsets[i];
+          size_t length = listing->offsets[i + 1] - listing->offsets[i] - 1;
+          unsigned char type = listing->types[i];
+
+          if ((name[0] == '.') && !component->dot)
+          {
+               continue;
+          }
+
+          if (component->globstar)
+          {
+               int is_dir;
+
+               if (!smallsh_glob_path(state, path_length, name, length))
+               {
+                    continue;
+               }
+               is_dir = smallsh_glob_is_dir(state, path_length + length, type, 0);
+               if (last && (is_dir || !state->dirs_only))
+               {
+                    smallsh_glob_add(state, path_length + length, state->dirs_only);
+               }
+               if (is_dir)
+               {
+                    state->path[path_length + length] = '/';
+                    smallsh_glob_walk(state, index, path_length + length + 1);
+               }
+               continue;
+          }
+
+          if (!smallsh_glob_match(component, name, length) || !smallsh_glob_path(state, path_length, name, length))
+          {
+               continue;
+          }
+
+          if (last && !state->dirs_only)
+          {
+               smallsh_glob_add(state, path_length + length, 0);
+          }
+          else if (smallsh_glob_is_dir(state, path_length + length, type, 1))
+          {
+               if (last)
+               {
+                    smallsh_glob_add(state, path_length + length, 1);
+               }
+               else
+               {
+                    state->path[path_length + length] = '/';
+                    smallsh_glob_walk(state, index + 1, path_length + length + 1);
+               }
+          }
+     }
+
+     listing->pinned--;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_path(glob_state *state, size_t path_length,
+**                             const char *name, size_t length)
+** Description: puts name (and a terminator) after the first
+**              path_length bytes of the PATH_MAX path buffer, leaving
+**              room for a "/" after. Returns 0 if it doesn't fit.
+** Parameters: the expansion, the directory part and the name
+**********************************************************************/
+int smallsh_glob_path(glob_state *state, size_t path_length, const char *name, size_t length)
+{
+     if (path_length + length + 2 > PATH_MAX)
+     {
+          return 0;
+     }
+
+     memcpy(state->path + path_length, name, length);
+     state->path[path_length + length] = '\0';
+
+     return 1;
+}
+
+/**********************************************************************
+** Function: smallsh_glob_add(glob_state *state, size_t length,
+**                            int slash)
+** Description: adds the first length bytes of the path buffer (and a
+**              "/" if slash is set) to the matches. The text and
+**              offsets double in the command arena when they fill,
+**              the arrays they outgrow stay there until it is reset.
+** Parameters: the expansion, the path's length and the slash flag
+**********************************************************************/
+void smallsh_glob_add(glob_state *state, size_t length, int slash)
+{
+     if (state->count == state->capacity)
+     {
+          size_t *larger;
+
+          state->capacity = (state->capacity == 0) ? 64 : state->capacity * 2;
+          larger = smallsh_arena_alloc(&command_arena, state->capacity * sizeof(size_t));
+          if (state->count > 0)
+          {
+               memcpy(larger, state->offsets, state->count * sizeof(size_t));
+          }
+          state->offsets = larger;
+     }
+     if (state->text_used + length + 2 > state->text_size)
+     {
+          char *larger;
+
+          state->text_size = (state->text_size == 0) ? 4096 : state->text_size * 2;
+          if (state->text_used + length + 2 > state->text_size)
+          {
+               state->text_size = state->text_used + length + 2;
+          }
+          larger = smallsh_arena_alloc(&command_arena, state->text_size);
+          if (state->text_used > 0)
+          {
+               memcpy(larger, state->text, state->text_used);
+          }
+          state->text = larger;
+     }
+
+     state->offsets[state->count++] = state->text_used;
+     memcpy(state->text + state->text_used, state->path, length);
+     state->text_used += length;
+     if (slash)
+     {
+          state->text[state->text_used++] = '/';
+     }
+     state->text[state->text_used++] = '\0';
+}
+
+/**********************************************************************
+** Function: smallsh_glob_is_dir(glob_state *state, size_t length,
+**                               unsigned char type, int follow)
+** Description: returns 1 if the name in the path buffer is a
+**              directory, from its listed type where the file system
+**              gave one, else with stat() (follow set) or lstat()
+** Parameters: the expansion, the path's length, the listed type and
+**             whether a symbolic link to a directory counts
+**********************************************************************/
+int smallsh_glob_is_dir(glob_state *state, size_t length, unsigned char type, int follow)
+{
+     struct stat info;
+
+     if ((type == DT_DIR) || ((type != DT_UNKNOWN) && ((type != DT_LNK) || !follow)))
+     {
+          return type == DT_DIR;
+     }
+
+     state->path[length] = '\0';
+     if ((follow ? stat(state->path, &info) : lstat(state->path, &info)) == -1)
+     {
+          return 0;
+     }
+
+     return S_ISDIR(info.st_mode);
+}
+
+/**********************************************************************
+** Function: smallsh_glob_compare(const void *a, const void *b,
+**                                void *text)
+** Description: orders matches by byte value for qsort_r()
+** Parameters: the two match offsets and the text they are in
+**********************************************************************/
+int smallsh_glob_compare(const void *a, const void *b, void *text)
+{
+     return strcmp((char *)text + *(const size_t *)a, (char *)text + *(const size_t *)b);
+}
+
+/**********************************************************************
+** Function: smallsh_dir_cache_get(const char *path)
+** Description: returns the listing of a directory. A cached listing
+**              is used while the directory's mtime is the one it was
+**              read at (and it wasn't read too close to that mtime to
+**              tell), or while an expansion is still using it. Else
+**              the directory is read again. Returns NULL if it can't
+**              be read.
+** Parameters: the directory
+**********************************************************************/
+dir_listing *smallsh_dir_cache_get(const char *path)
+{
+     struct stat info;
+     dir_listing *listing;
+     dir_listing **bucket;
+     int fd;
+
+     if ((stat(path, &info) == -1) || !S_ISDIR(info.st_mode))
+     {
+          return NULL;
+     }
+
+     bucket = &dir_cache.buckets[((uint64_t)info.st_dev * 31 + info.st_ino) % DIR_CACHE_BUCKETS];
+     for (listing = *bucket; listing != NULL; listing = listing->next)
+     {
+          if ((listing->dev == info.st_dev) && (listing->ino == info.st_ino))
+          {
+               break;
+          }
+     }
+
+     if ((listing != NULL) && (listing->pinned == 0) && (listing->racy || (listing->mtime.tv_sec != info.st_mtim.tv_sec) || (listing->mtime.tv_nsec != info.st_mtim.tv_nsec)))
+     {
+          smallsh_dir_cache_drop(listing);
+          listing = NULL;
+     }
+
+     if (listing == NULL)
+     {
+          fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+          if (fd == -1)
+          {
+               return NULL;
+          }
+          //the listing is for the directory as it was opened, a change while reading shows in its mtime next time
+          if (fstat(fd, &info) == 0)
+          {
+               listing = smallsh_dir_cache_read(fd, &info);
+          }
+          close(fd);
+          if (listing == NULL)
+          {
+               return NULL;
+          }
+
+          bucket = &dir_cache.buckets[((uint64_t)info.st_dev * 31 + info.st_ino) % DIR_CACHE_BUCKETS];
+          listing->next = *bucket;
+          *bucket = listing;
+          dir_cache.bytes += listing->bytes;
+     }
+     else if (listing != dir_cache.newest)
+     {
+          //take it out of the use order to put it at the front below
+          listing->newer->older = listing->older;
+          if (listing->older != NULL)
+          {
+               listing->older->newer = listing->newer;
+          }
+          else
+          {
+               dir_cache.oldest = listing->newer;
+          }
+     }
+
+     if (listing != dir_cache.newest)
+     {
+          listing->newer = NULL;
+          listing->older = dir_cache.newest;
+          if (dir_cache.newest != NULL)
+          {
+               dir_cache.newest->newer = listing;
+          }
+          dir_cache.newest = listing;
+          if (dir_cache.oldest == NULL)
+          {
+               dir_cache.oldest = listing;
+          }
+     }
+
+     //drop the least recently used listings nobody is using, the new one stays even if it alone is over the cap
+     while (dir_cache.bytes > DIR_CACHE_CAP)
+     {
+          dir_listing *oldest = dir_cache.oldest;
+
+          while ((oldest != NULL) && ((oldest->pinned > 0) || (oldest == listing)))
+          {
+               oldest = oldest->newer;
+          }
+          if (oldest == NULL)
+          {
+               break;
+          }
+          smallsh_dir_cache_drop(oldest);
+     }
+
+     return listing;
+}
+
+/**********************************************************************
+** Function: smallsh_dir_cache_read(int fd, const struct stat *info)
+** Description: reads an open directory with getdents64() into a new
+**              listing, without "." and "..". Returns NULL if the
+**              directory can't be read.
+** Parameters: the directory and its fstat()
+**********************************************************************/
+dir_listing *smallsh_dir_cache_read(int fd, const struct stat *info)
+{
+     dir_listing *listing = calloc(1, sizeof(dir_listing));
+     size_t names_size = 4096;
+     size_t names_used = 0;
+     int capacity = 64;
+     struct timespec now;
+     long bytes;
+
+     if (dir_cache.buffer == NULL)
+     {
+          dir_cache.buffer = malloc(DIR_READ_BUFSIZE);
+     }
+
+     listing->names = malloc(names_size);
+     listing->offsets = malloc((capacity + 1) * sizeof(uint32_t));
+     listing->types = malloc(capacity);
+
+     while ((bytes = syscall(SYS_getdents64, fd, dir_cache.buffer, DIR_READ_BUFSIZE)) > 0)
+     {
+          long position = 0;
+
+          while (position < bytes)
+          {
+               linux_dirent64 *entry = (linux_dirent64 *)(dir_cache.buffer + position);
+               size_t length = strlen(entry->d_name) + 1;
+
+               position += entry->d_reclen;
+               if ((entry->d_name[0] == '.') && ((length == 2) || ((length == 3) && (entry->d_name[1] == '.'))))
+               {
+                    continue;
+               }
+
+               if (listing->count == capacity)
+               {
+                    capacity *= 2;
+                    listing->offsets = realloc(listing->offsets, (capacity + 1) * sizeof(uint32_t));
+                    listing->types = realloc(listing->types, capacity);
+               }
+               while (names_used + length > names_size)
+               {
+                    names_size *= 2;
+                    listing->names = realloc(listing->names, names_size);
+               }
+
+               memcpy(listing->names + names_used, entry->d_name, length);
+               listing->offsets[listing->count] = names_used;
+               listing->types[listing->count] = entry->d_type;
+               listing->count++;
+               names_used += length;
+          }
+     }
+
+     if (bytes == -1)
+     {
+          free(listing->names);
+          free(listing->offsets);
+          free(listing->types);
+          free(listing);
+          return NULL;
+     }
+
+     listing->offsets[listing->count] = names_used;
+     listing->dev = info->st_dev;
+     listing->ino = info->st_ino;
+     listing->mtime = info->st_mtim;
+     listing->bytes = sizeof(dir_listing) + names_size + ((capacity + 1) * sizeof(uint32_t)) + capacity;
+
+     //a change within the same mtime tick as the one read wouldn't show, so a fresh mtime isn't trusted
+     clock_gettime(CLOCK_REALTIME, &now);
+     listing->racy = ((now.tv_sec - info->st_mtim.tv_sec) * 1000000000LL) + (now.tv_nsec - info->st_mtim.tv_nsec) < DIR_CACHE_RACY_NS;
+
+     return listing;
+}
+
+/**********************************************************************
+** Function: smallsh_dir_cache_drop(dir_listing *listing)
+** Description: takes a listing out of its hash chain and the use
+**              order and frees it
+** Parameters: the listing
+**********************************************************************/
+void smallsh_dir_cache_drop(dir_listing *listing)
+{
+     dir_listing **link = &dir_cache.buckets[((uint64_t)listing->dev * 31 + listing->ino) % DIR_CACHE_BUCKETS];
+
+     while (*link != listing)
+     {
+          link = &(*link)->next;
+     }
+     *link = listing->next;
+
+     if (listing->newer != NULL)
+     {
+          listing->newer->older = listing->older;
+     }
+     else
+     {
+          dir_cache.newest = listing->older;
+     }
+     if (listing->older != NULL)
+     {
+          listing->older->newer = listing->newer;
+     }
+     else
+     {
+          dir_cache.oldest = listing->newer;
+     }
+
+     dir_cache.bytes -= listing->bytes;
+     free(listing->names);
+     free(listing->offsets);
+     free(listing->types);
+     free(listing);
+}
+
+/*********************************************************************************************************************
+** Function: smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal)
+** Description: Compares the args array to any built in commands, if not it will pass the command to exec()
+**
+** Parameters: the args array, number of elements, pointer to exit status, signal_flag, and terminating_signal
+***********************************************************************************************************************/
+int smallsh_execute(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+
+     int background_proccess = 0; //variable for checking if a command is to be executed as a background process. (0 == false, 1 == true)
+
+     //Compare arguments with built in functions
+
+     if ((args[0] == NULL) || (strcmp(args[0], "#") == 0)) //if command is empty or a comment
+     {
+          return 1; //do nothing and reprint prompt
+     }
+     /* Built in command: "time" runs the rest of the line, a whole pipeline included, and reports its resource usage */
+     else if (strcmp(args[0], "time") == 0)
+     {
+          return smallsh_time_builtin(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+     /* Built in command: "on cpus=... nice=... sched=... numa=... rr command" places the command, a whole pipeline included */
+     else if (strcmp(args[0], "on") == 0)
+     {
+          return smallsh_on_builtin(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+     /* Built in command: "limit memory=... cpu=... pids=... group=... command" runs the command in a cgroup */
+     else if (strcmp(args[0], "limit") == 0)
+     {
+          return smallsh_limit_builtin(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+     /* Built in command: "timeout [-k GRACE] DURATION command" gives the command, a whole pipeline included, a deadline */
+     else if (strcmp(args[0], "timeout") == 0)
+     {
+          return smallsh_timeout_builtin(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+     /* A pipeline or fan out is started as a whole by smallsh_launch(), even when some of its stages are built ins */
+     else if ((smallsh_find_operator(args, num_args, "|") > -1) || (smallsh_find_operator(args, num_args, ">&") > -1) || (smallsh_find_operator(args, num_args, "|>") > -1))
+     {
+          //not a built in, fall through to smallsh_launch()
+     }
+     /* "command name" runs the program even when there is a built in with its name, so do background fast path built ins
+        and ones under "timeout", "on" or "limit", which need a process to signal, place or put in a cgroup */
+     else if ((strcmp(args[0], "command") == 0) || (smallsh_is_fast_path(args[0]) && smallsh_fast_path_forked(smallsh_is_operator(args[num_args - 1], "&"))))
+     {
+          //not a built in, fall through to smallsh_launch()
+     }
+     /* A built in with redirections runs with its descriptors moved, without forking */
+     else if (smallsh_is_builtin(args[0]) && (smallsh_find_redirect(args, num_args) > -1))
+     {
+          return smallsh_builtin_redirect(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+     }
+     /* Built in command: "cd" should support both relative and absolute path */
+     else if (strcmp(args[0], "cd") == 0)
+     {
+          *exit_status = 0;
+
+          //change to directory specified in the HOME environment variable
+          if (args[1] == NULL)
+          {
+               //credit: http://www.cplusplus.com/reference/cstdlib/getenv/
+               char* home_path;
+               home_path = getenv("HOME");
+
+               if (home_path != NULL)
+               {
+                    chdir(home_path);
+               }
+          }
+          //change to specified directory, if not print error
+          else
+          {
+               if (chdir(args[1]) != 0)
+               {
+                    printf("smallsh: Could not find the directory \"%s\"\n", args[1]);
+                    *exit_status = 1;
+               }
+          }
+
+          return 1; //reprint prompt
+
+     }
+     /* Built in command: "status" */
+     else if (strcmp(args[0], "status") == 0)
+     {
+          if (*signal_flag == 0) //no signals were set
+          {
+               printf("Exit value: %d\n", *exit_status);
+          }
+          else if (*signal_flag == 2) //killed by "timeout", or it exited on its own after SIGTERM
+          {
+               if (*terminating_signal != 0)
+               {
+                    printf("Timed out, terminated by signal %d\n", *terminating_signal);
+               }
+               else
+               {
+                    printf("Timed out\n");
+               }
+          }
+          else
+          {
+               printf("Terminated by signal %d\n", *terminating_signal);
+          }
+          return 1; //reprint prompt
+     }
+     /* Built in command: "spawn" selects the engine used to start commands or reports spawn latency */
+     else if (strcmp(args[0], "spawn") == 0)
+     {
+          *exit_status = 0;
+
+          if (args[1] == NULL)
+          {
+               smallsh_spawn_report();
+          }
+          else if (strcmp(args[1], "fork") == 0)
+          {
+               spawn_mode = SPAWN_FORK;
+          }
+          else if (strcmp(args[1], "posix") == 0)
+          {
+               spawn_mode = SPAWN_POSIX;
+          }
+          else
+          {
+               printf("smallsh: spawn: expected \"fork\" or \"posix\"\n");
+               *exit_status = 1;
+          }
+          return 1; //reprint prompt
+     }
+     /* Built in command: "hash" lists, adds or ("hash -r") forgets remembered command paths */
+     else if (strcmp(args[0], "hash") == 0)
+     {
+          *exit_status = smallsh_hash_builtin(args);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "jobs" lists the running background jobs, "jobs -l" adds their cgroup usage and pressure */
+     else if (strcmp(args[0], "jobs") == 0)
+     {
+          smallsh_jobs_builtin(args, jobs);
+          *exit_status = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "output on|off" captures background output, "output %job" replays it */
+     else if (strcmp(args[0], "output") == 0)
+     {
+          *exit_status = smallsh_output_builtin(args, jobs);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "wait" waits for every background job, "wait pid..." for those */
+     else if (strcmp(args[0], "wait") == 0)
+     {
+          *exit_status = smallsh_wait_builtin(args, jobs);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "pipesize" shows or sets the pipe buffer size used between pipeline stages */
+     else if (strcmp(args[0], "pipesize") == 0)
+     {
+          *exit_status = smallsh_pipesize_builtin(args);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "parallel" runs a command for each input with a bounded number of children */
+     else if (strcmp(args[0], "parallel") == 0)
+     {
+          *exit_status = smallsh_parallel_builtin(args, jobs);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "stats" shows the latency percentiles and CPU time of each command run so far */
+     else if (strcmp(args[0], "stats") == 0)
+     {
+          smallsh_stats_builtin(args);
+          *exit_status = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "echo" prints its arguments, "-n" leaves out the newline */
+     else if (strcmp(args[0], "echo") == 0)
+     {
+          smallsh_echo_builtin(args);
+          *exit_status = 0;
+          *signal_flag = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "true" and "false" only set the status */
+     else if ((strcmp(args[0], "true") == 0) || (strcmp(args[0], "false") == 0))
+     {
+          *exit_status = (args[0][0] == 'f');
+          *signal_flag = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "pwd" */
+     else if (strcmp(args[0], "pwd") == 0)
+     {
+          *exit_status = smallsh_pwd_builtin();
+          *signal_flag = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "test" and "[" check files, strings and integers */
+     else if ((strcmp(args[0], "test") == 0) || (strcmp(args[0], "[") == 0))
+     {
+          *exit_status = smallsh_test_builtin(args);
+          *signal_flag = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "printf" */
+     else if (strcmp(args[0], "printf") == 0)
+     {
+          *exit_status = smallsh_printf_builtin(args);
+          *signal_flag = 0;
+          return 1; //reprint prompt
+     }
+     /* Built in command: "sleep", SIGINT still cuts it short */
+     else if (strcmp(args[0], "sleep") == 0)
+     {
+          *exit_status = smallsh_sleep_builtin(args, signal_flag, terminating_signal, jobs);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "placement" shows or sets the placement of background jobs started without "on" */
+     else if (strcmp(args[0], "placement") == 0)
+     {
+          *exit_status = smallsh_placement_builtin(args);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "group" lists, creates or changes, or ("group -d") removes named cgroups for "limit group=" */
+     else if (strcmp(args[0], "group") == 0)
+     {
+          *exit_status = smallsh_group_builtin(args);
+          return 1; //reprint prompt
+     }
+     /* Built in command: "exit" */
+     else if (strcmp(args[0], "exit") == 0)
+     {
+          return 0; //End the smallsh shell loop
+     }
+
+     /* Check if the command will be run in the background*/
+     if (smallsh_is_operator(args[num_args - 1], "&")) // The "&" argument must always be last argument, but the last element is array is NULL
+     {
+          background_proccess = 1; //set to true
+          args[num_args - 1] = NULL; //remove the"&" argument from the array
+     }
+
+     /* Not a built in command */
+     //Pass the arguments to be exec()
+     *exit_status = smallsh_launch(args, num_args, background_proccess, exit_status, signal_flag, terminating_signal, jobs);
+
+     return 1; //reprint prompt
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_launch(char **args, int num_args, int background_process, int *exit_status, int *signal_flag,
+**                          int *terminating_signal, job_table *jobs)
+** Description: This function will start a command or a pipeline ("cmd | cmd | ...") and wait for it if it is in the
+**              foreground. All external stages are started before anything is waited for so they run at the same time,
+**              and a background pipeline gets its own process group. Pure built in stages run in the shell, others in a
+**              forked copy of it, and stages that are only a "<" or ">" redirection are done by the shell itself; both are moved into their pipe with
+**              splice() so the bytes never pass through userspace. Commands are resolved through the command path table
+**              first so an unknown command costs no fork. Returns the exit status of the last stage.
+**
+** Parameters: Pointers to exit_status (read by "status" in a pipeline), terminating_signal, signal_flag to set them depending
+**             on execution of foreground command, and the job table for background ones
+******************************************************************************************************************************/
+int smallsh_launch(char **args, int num_args, int background_process, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     stage *stages;
+     splice_pair *pairs;
+     fan_out *fan = NULL;      //">&" files and "|>" consumers that get a copy of the last stage's output
+     int num_stages = 1;
+     int num_consumers = 0;
+     int total;                //pipeline stages and fan out consumers
+     int fan_start = -1;       //where the fan out starts in args
+     int num_pairs = 0;
+     int pipe_fds[2];
+     pid_t pgid = -1;          //process group of a background pipeline, foreground stages stay in the shell's group
+     pid_t pump_pid = -1;      //helper that runs the splices for a background pipeline
+     pid_t reported_pid = -1;  //the pid "Background pid ... has begun" is printed for
+     job *reported_job = NULL;
+     int capture_fds[2] = { -1, -1 };  //"output on": the background job's stdout and stderr pipe
+     const placement *place = command_placement;  //"on" for this command, or the session default for background jobs
+     int cpu = -1;             //round robin CPU shared by every stage of the job
+     long long timeout = (command_timeout != 0) ? command_timeout : default_timeout; //"timeout" or the session default, none unless > 0
+     long long grace = (command_timeout != 0) ? command_grace : default_grace;
+     char command[JOB_COMMAND_LENGTH];
+     int last_status = 0;
+     int status;
+     int length = 0;
+     int start = 0;
+     int i;
+
+     //Counter for preventing segmentation fault when background command (Due to num_arrays being one less)
+     int counter = num_args;
+     if (background_process == 1)
+     {
+          counter = (num_args - 1);
+     }
+
+     //keep the command line for "jobs" before it is cut up into stages and redirects
+     command[0] = '\0';
+     for (i = 0; (i < counter) && (length < JOB_COMMAND_LENGTH); i++)
+     {
+          length += snprintf(command + length, JOB_COMMAND_LENGTH - length, (i == 0) ? "%s" : " %s", args[i]);
+     }
+
+     /* A fan out takes the rest of the line, each "|>" in it starts a consumer that runs like a stage of its own */
+     for (i = 0; i < counter; i++)
+     {
+          if ((fan_start == -1) && (smallsh_is_operator(args[i], ">&") || smallsh_is_operator(args[i], "|>")))
+          {
+               fan_start = i;
+          }
+          if ((fan_start != -1) && smallsh_is_operator(args[i], "|>"))
+          {
+               num_consumers++;
+          }
+     }
+     if (fan_start != -1)
+     {
+          counter = fan_start;
+     }
+
+     /* Split the arguments into stages at each "|" */
+     for (i = 0; i < counter; i++)
+     {
+          if (smallsh_is_operator(args[i], "|"))
+          {
+               num_stages++;
+          }
+     }
+
+     total = num_stages + num_consumers;
+     stages = smallsh_arena_alloc(&command_arena, total * sizeof(stage));
+     pairs = smallsh_arena_alloc(&command_arena, total * sizeof(splice_pair)); //at most one splice per stage
+     memset(stages, 0, total * sizeof(stage));
+
+     if (fan_start != -1)
+     {
+          fan = smallsh_fan_out_open(&args[fan_start], ((background_process == 1) ? (num_args - 1) : num_args) - fan_start, &stages[num_stages]);
+          if (fan == NULL)
+          {
+               return 1;
+          }
+     }
+
+     num_stages = 0;
+     for (i = 0; i <= counter; i++)
+     {
+          if ((i == counter) || smallsh_is_operator(args[i], "|"))
+          {
+               stages[num_stages].args = &args[start];
+               stages[num_stages].num_args = i - start;
+               stages[num_stages].input_fd = -1;
+               stages[num_stages].output_fd = -1;
+               stages[num_stages].buffer_fd = -1;
+               stages[num_stages].pid = -1;
+               args[i] = NULL;
+               num_stages++;
+               start = i + 1;
+          }
+     }
+
+     /* Open each stage's redirection and decide how it will run, before anything is started */
+     for (i = 0; i < total; i++)
+     {
+          int external = 0;
+
+          if (stages[i].num_args == 0)
+          {
+               printf("smallsh: syntax error near \"%s\"\n", (i < num_stages) ? "|" : "|>");
+               smallsh_stages_close(stages, total);
+               smallsh_fan_out_close(fan);
+               return 1;
+          }
+
+          if (smallsh_redirect_open(stages[i].args, &stages[i].num_args, &stages[i].redirects, &stages[i].num_redirects) == -1)
+          {
+               smallsh_stages_close(stages, total);
+               smallsh_fan_out_close(fan);
+               return 1;
+          }
+
+          if ((stages[i].args[0] != NULL) && (strcmp(stages[i].args[0], "command") == 0) && (stages[i].args[1] != NULL))
+          {
+               stages[i].args++; //"command name": the program, never the built in
+               stages[i].num_args--;
+               external = 1;
+          }
+
+          if (stages[i].args[0] == NULL)
+          {
+               int j;
+
+               //only redirections: the shell splices its last input file to its last output file, it takes the descriptors
+               stages[i].kind = STAGE_FILE;
+               for (j = 0; j < stages[i].num_redirects; j++)
+               {
+                    redirect *current = &stages[i].redirects[j];
+                    int *target = (current->fd == 0) ? &stages[i].input_fd : ((current->fd == 1) ? &stages[i].output_fd : NULL);
+
+                    if ((target != NULL) && (current->opened == 1))
+                    {
+                         if (*target != -1)
+                         {
+                              close(*target);
+                         }
+                         *target = current->source_fd;
+                         current->opened = 0;
+                    }
+               }
+          }
+          else if ((external == 0) && (i < num_stages) && smallsh_is_pure_builtin(stages[i].args[0]) && !(smallsh_fast_path_forked(background_process) && smallsh_is_fast_path(stages[i].args[0])))
+          {
+               stages[i].kind = STAGE_BUILTIN; //a consumer is fed while the shell pumps, it has to be a program
+          }
+          else if ((external == 0) && (strcmp(stages[i].args[0], "wait") == 0))
+          {
+               printf("smallsh: wait: only the shell itself can wait for its jobs, not a pipeline stage\n");
+               stages[i].kind = STAGE_FAILED;
+          }
+          else if ((external == 0) && smallsh_is_builtin(stages[i].args[0]) && !smallsh_is_fast_path(stages[i].args[0]))
+          {
+               stages[i].path = NULL; //the built in runs in a forked copy of the shell, its changes stay there
+               stages[i].kind = STAGE_EXTERNAL;
+          }
+          else
+          {
+               stages[i].path = smallsh_hash_lookup(stages[i].args[0]);
+               stages[i].kind = STAGE_EXTERNAL;
+
+               if (stages[i].path == NULL)
+               {
+                    printf("smallsh: %s: command not found\n", stages[i].args[0]);
+                    stages[i].kind = STAGE_FAILED;
+               }
+          }
+     }
+
+     /* Connect the stages with pipes, a redirection only stage's own file wins over the pipe */
+     for (i = 0; i < num_stages - 1; i++)
+     {
+          if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+          {
+               printf("smallsh: cannot create pipe: %s\n", strerror(errno));
+               smallsh_stages_close(stages, total);
+               smallsh_fan_out_close(fan);
+               return 1;
+          }
+
+          if (pipe_buffer_size > 0)
+          {
+               fcntl(pipe_fds[1], F_SETPIPE_SZ, pipe_buffer_size); //best effort, limited by /proc/sys/fs/pipe-max-size
+          }
+
+          if (stages[i].output_fd == -1)
+          {
+               stages[i].output_fd = pipe_fds[1];
+               stages[i].output_pipe = 1;
+          }
+          else
+          {
+               close(pipe_fds[1]);
+          }
+
+          if (stages[i + 1].input_fd == -1)
+          {
+               stages[i + 1].input_fd = pipe_fds[0];
+          }
+          else
+          {
+               close(pipe_fds[0]);
+          }
+     }
+
+     //the last stage writes into the fan out's source pipe, like a pipe to a next stage
+     if (fan != NULL)
+     {
+          i = num_stages - 1;
+          if (stages[i].output_fd == -1)
+          {
+               stages[i].output_fd = fan->source_write;
+               stages[i].output_pipe = 1;
+          }
+          else
+          {
+               close(fan->source_write);
+          }
+          fan->source_write = -1;
+     }
+
+     //a built in's piped output is buffered so it can never block on a pipe that nothing is draining yet
+     for (i = 0; i < num_stages; i++)
+     {
+          if ((stages[i].kind == STAGE_BUILTIN) && (stages[i].output_pipe == 1))
+          {
+               stages[i].buffer_fd = memfd_create("smallsh-builtin", MFD_CLOEXEC);
+
+               if (stages[i].buffer_fd == -1)
+               {
+                    printf("smallsh: cannot buffer built in output: %s\n", strerror(errno));
+                    smallsh_stages_close(stages, total);
+                    smallsh_fan_out_close(fan);
+                    return 1;
+               }
+          }
+     }
+
+     if ((place == NULL) && (background_process == 1) && (default_placement.active == 1))
+     {
+          place = &default_placement;
+     }
+     if ((place != NULL) && (place->round_robin == 1) && (background_process == 1))
+     {
+          cpu = smallsh_placement_cpu(place);
+     }
+
+     if ((background_process == 1) && (capture.enabled == 1) && (pipe2(capture_fds, O_CLOEXEC) == -1))
+     {
+          capture_fds[0] = capture_fds[1] = -1;
+     }
+
+     /* Start every external stage */
+     for (i = 0; i < total; i++)
+     {
+          if (stages[i].kind == STAGE_EXTERNAL)
+          {
+               spawn_request request;
+
+               request.path = stages[i].path;
+               request.args = stages[i].args;
+               request.stdin_fd = stages[i].input_fd;
+               request.stdout_fd = stages[i].output_fd;
+               request.stdin_null = ((background_process == 1) && (stages[i].input_fd == -1));
+               request.redirects = stages[i].redirects;
+               request.num_redirects = stages[i].num_redirects;
+               request.pgid = (background_process == 1) ? ((pgid == -1) ? 0 : pgid) : -1;
+               request.place = place;
+               request.cpu = cpu;
+               request.group = command_group;
+               request.builtin_jobs = (stages[i].path == NULL) ? jobs : NULL;
+
+               //a captured job's stderr, and the stdout of the last stage or a consumer, go to its capture pipe unless redirected
+               if (capture_fds[1] != -1)
+               {
+                    redirect *redirects = smallsh_arena_alloc(&command_arena, (stages[i].num_redirects + 1) * sizeof(redirect));
+
+                    redirects[0].fd = 2;
+                    redirects[0].source_fd = capture_fds[1];
+                    redirects[0].opened = 0;
+                    memcpy(redirects + 1, stages[i].redirects, stages[i].num_redirects * sizeof(redirect));
+                    request.redirects = redirects;
+                    request.num_redirects = stages[i].num_redirects + 1;
+
+                    if ((i >= num_stages - 1) && (request.stdout_fd == -1))
+                    {
+                         request.stdout_fd = capture_fds[1];
+                    }
+               }
+
+               clock_gettime(CLOCK_MONOTONIC, &stages[i].start_time);
+               stages[i].pid = smallsh_spawn(&request);
+
+               if (stages[i].pid < 0) //the engine has already printed the error
+               {
+                    stages[i].kind = STAGE_FAILED;
+               }
+               else if ((background_process == 1) && (pgid == -1))
+               {
+                    pgid = stages[i].pid; //first stage leads the process group
+               }
+          }
+
+          if ((stages[i].kind != STAGE_FILE) && (stages[i].kind != STAGE_BUILTIN)) //the shell's copies aren't needed, except for the splices and built ins below
+          {
+               if (stages[i].input_fd != -1)
+               {
+                    close(stages[i].input_fd);
+                    stages[i].input_fd = -1;
+               }
+               if (stages[i].output_fd != -1)
+               {
+                    close(stages[i].output_fd);
+                    stages[i].output_fd = -1;
+               }
+          }
+     }
+
+     //the deadline covers the splices below as well, a fan out pump runs as long as the last stage does
+     if ((background_process == 0) && (timeout > 0))
+     {
+          foreground_wait.stages = stages;
+          foreground_wait.first = 0;
+          foreground_wait.total = total;
+          smallsh_deadline_start(&foreground_wait.limit, timeout, grace);
+     }
+
+     /* Run built in stages in the shell. Output headed for a pipe goes to a memfd first and is spliced in later
+        so a built in can never block on a pipe that nothing is draining yet. A built in reading from a stage the
+        shell feeds itself is handed that stage's memfd or file instead of the pipe, which is only filled later */
+     for (i = 0; i < total; i++)
+     {
+          int source_fd = -1; //data this stage would splice into its output pipe
+
+          if (stages[i].kind == STAGE_BUILTIN)
+          {
+               int output_fd = (stages[i].output_pipe == 1) ? stages[i].buffer_fd : stages[i].output_fd;
+
+               stages[i].status = smallsh_builtin_stage(&stages[i], stages[i].input_fd, output_fd, exit_status, signal_flag, terminating_signal, jobs);
+
+               if (stages[i].input_fd != -1)
+               {
+                    close(stages[i].input_fd);
+                    stages[i].input_fd = -1;
+               }
+
+               if (stages[i].output_pipe == 1)
+               {
+                    lseek(output_fd, 0, SEEK_SET);
+                    source_fd = output_fd;
+                    stages[i].buffer_fd = -1; //the splice below owns it now
+               }
+               else if (stages[i].output_fd != -1)
+               {
+                    close(stages[i].output_fd);
+                    stages[i].output_fd = -1;
+               }
+          }
+          else if ((stages[i].kind == STAGE_FILE) && (stages[i].input_fd != -1) && (stages[i].output_fd != -1))
+          {
+               source_fd = stages[i].input_fd;
+               stages[i].input_fd = -1;
+          }
+
+          if (source_fd == -1)
+          {
+               continue;
+          }
+
+          if ((stages[i].output_pipe == 1) && (i < num_stages - 1) && (stages[i + 1].kind == STAGE_BUILTIN))
+          {
+               close(stages[i].output_fd);
+               close(stages[i + 1].input_fd);
+               stages[i + 1].input_fd = source_fd;
+          }
+          else
+          {
+               pairs[num_pairs].in = source_fd;
+               pairs[num_pairs].out = stages[i].output_fd;
+               num_pairs++;
+          }
+          stages[i].output_fd = -1;
+     }
+     smallsh_stages_close(stages, total); //redirect only stages with nothing to move
+
+     /* Move the file, built in and fan out data, a background pipeline gets a helper process so the prompt comes back */
+     if ((num_pairs > 0) || (fan != NULL))
+     {
+          if (background_process == 0)
+          {
+               smallsh_splice_pump(pairs, num_pairs, fan);
+          }
+          else
+          {
+               pump_pid = fork();
+
+               if (pump_pid == 0)
+               {
+                    setpgid(0, (pgid == -1) ? 0 : pgid);
+                    smallsh_splice_pump(pairs, num_pairs, fan);
+                    _exit(0);
+               }
+
+               if (pump_pid < 0)
+               {
+                    printf("smallsh: Error forking!\n");
+               }
+               else if (pgid == -1)
+               {
+                    pgid = pump_pid;
+               }
+
+               for (i = 0; i < num_pairs; i++)
+               {
+                    close(pairs[i].in);
+                    close(pairs[i].out);
+               }
+               smallsh_fan_out_close(fan);
+          }
+     }
+
+     if (capture_fds[1] != -1)
+     {
+          close(capture_fds[1]); //the stages have their own copies
+     }
+
+     /********************************/
+     /*     This is the Parent       */
+     /********************************/
+     if (background_process == 1) //if set to true
+     {
+          //one job is reported for the pipeline: its last external stage or consumer, or the splice helper that is still
+          //writing the files of a fan out after the last stage is done
+          for (i = 0; i < total; i++)
+          {
+               if (stages[i].pid > 0)
+               {
+                    reported_pid = stages[i].pid;
+               }
+          }
+          if (((stages[total - 1].kind != STAGE_EXTERNAL) || ((fan != NULL) && (num_consumers == 0))) && (pump_pid > 0))
+          {
+               reported_pid = pump_pid;
+          }
+
+          //add the background processes to the job table and event loop, only reported_pid gets a job id
+          for (i = 0; i < total; i++)
+          {
+               if (stages[i].pid > 0)
+               {
+                    job *stage_job = smallsh_job_insert(jobs, stages[i].pid, pgid, (stages[i].pid == reported_pid) ? command : NULL);
+
+                    if (stages[i].pid == reported_pid)
+                    {
+                         reported_job = stage_job;
+                    }
+                    stage_job->stats = smallsh_stats_find(stages[i].args[0]);
+                    stage_job->start_time = stages[i].start_time;
+                    stage_job->group = command_group;
+                    if (command_group != NULL)
+                    {
+                         command_group->refs++; //the cgroup stays until its last job is reaped
+                    }
+                    smallsh_events_watch(stage_job);
+               }
+          }
+          if (pump_pid > 0)
+          {
+               job *pump_job = smallsh_job_insert(jobs, pump_pid, pgid, (pump_pid == reported_pid) ? command : NULL);
+
+               if (pump_pid == reported_pid)
+               {
+                    reported_job = pump_job;
+               }
+               smallsh_events_watch(pump_job);
+          }
+
+          if ((timeout > 0) && (reported_job != NULL))
+          {
+               smallsh_deadline_start(&reported_job->limit, timeout, grace); //the whole process group is signalled
+          }
+
+          if (capture_fds[0] != -1)
+          {
+               if (reported_job != NULL)
+               {
+                    smallsh_capture_start(capture_fds[0], reported_job);
+               }
+               else
+               {
+                    close(capture_fds[0]);
+               }
+          }
+
+          if (reported_pid > 0)
+          {
+               last_background_pid = reported_pid;
+               printf("Background pid %d has begun.\n", reported_pid);
+               fflush(stdout);
+          }
+
+          return 0;
+     }
+
+     //wait for every stage and consumer, the last stage decides the status
+     *signal_flag = 0; //set to false
+     for (i = 0; i < total; i++)
+     {
+          if (stages[i].pid > 0)
+          {
+               struct rusage usage;
+
+               foreground_wait.first = i;
+               if ((capture.open_pipes > 0) || (event_loop.timer_at != 0))
+               {
+                    smallsh_events_foreground(stages[i].pid, jobs); //background output keeps being drained and deadlines go off meanwhile
+               }
+
+               do
+               {
+                    wait4(stages[i].pid, &status, WUNTRACED, &usage); //wait unitl it is completed
+
+               } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+
+               stages[i].status = status;
+               smallsh_stats_record(smallsh_stats_find(stages[i].args[0]), &stages[i].start_time, &usage);
+               smallsh_usage_add(&foreground_usage, &usage);
+          }
+     }
+
+     i = num_stages - 1;
+     if (stages[i].kind == STAGE_EXTERNAL)
+     {
+          //Status and termination signals for foreground processes
+          if (WIFEXITED(stages[i].status))
+          {
+               last_status = WEXITSTATUS(stages[i].status); //return exit_status
+          }
+          else
+          {
+               *signal_flag = 1; //set to true
+               *terminating_signal = WTERMSIG(stages[i].status);
+               last_status = 1; //return exit status 1
+          }
+     }
+     else if (stages[i].kind == STAGE_BUILTIN)
+     {
+          last_status = stages[i].status;
+     }
+     else if (stages[i].kind == STAGE_FAILED)
+     {
+          last_status = COMMAND_NOT_FOUND;
+     }
+
+     if (foreground_wait.limit.state >= DEADLINE_TERM)
+     {
+          *signal_flag = 2; //timed out
+          *terminating_signal = ((stages[i].kind == STAGE_EXTERNAL) && WIFSIGNALED(stages[i].status)) ? WTERMSIG(stages[i].status) : 0;
+          last_status = TIMED_OUT_STATUS;
+     }
+     foreground_wait.limit.state = DEADLINE_NONE;
+     foreground_wait.stages = NULL;
+
+     return last_status;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_stages_close(stage *stages, int num_stages)
+** Description: closes the redirection and pipe descriptors the shell still holds for a pipeline's stages
+** Parameters: the stages and how many there are
+******************************************************************************************************************************/
+void smallsh_stages_close(stage *stages, int num_stages)
+{
+     int i;
+
+     for (i = 0; i < num_stages; i++)
+     {
+          smallsh_redirect_close(stages[i].redirects, stages[i].num_redirects);
+          stages[i].num_redirects = 0;
+
+          if (stages[i].input_fd != -1)
+          {
+               close(stages[i].input_fd);
+               stages[i].input_fd = -1;
+          }
+          if (stages[i].output_fd != -1)
+          {
+               close(stages[i].output_fd);
+               stages[i].output_fd = -1;
+          }
+          if (stages[i].buffer_fd != -1)
+          {
+               close(stages[i].buffer_fd);
+               stages[i].buffer_fd = -1;
+          }
+     }
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_builtin_stage(stage *builtin, int input_fd, int output_fd, int *exit_status, int *signal_flag,
+**                                 int *terminating_signal, job_table *jobs)
+** Description: runs a built in that is part of a pipeline in the shell with its stdin and stdout pointed at input_fd and
+**              output_fd (-1 leaves them alone). It works on copies of the status variables so the pipeline's result is
+**              only set once it finishes. Returns the built in's exit status.
+** Parameters: the stage, where its input comes from and its output goes, the shell's status variables and the job table
+******************************************************************************************************************************/
+int smallsh_builtin_stage(stage *builtin, int input_fd, int output_fd, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     int stage_exit_status = *exit_status;
+     int stage_signal_flag = *signal_flag;
+     int stage_terminating_signal = *terminating_signal;
+
+     smallsh_builtin_run(builtin->args, builtin->num_args, input_fd, output_fd, builtin->redirects, builtin->num_redirects, &stage_exit_status, &stage_signal_flag, &stage_terminating_signal, jobs);
+
+     return stage_exit_status;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_builtin_redirect(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal,
+**                                    job_table *jobs)
+** Description: runs a built in that has redirections. The files are opened like they are for a command and the built in
+**              runs in the shell with its descriptors moved there. Returns what smallsh_execute() returned for it.
+** Parameters: the args array, number of elements, the shell's status variables and the job table
+******************************************************************************************************************************/
+int smallsh_builtin_redirect(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     redirect *redirects;
+     int num_redirects;
+     int result;
+
+     if (smallsh_redirect_open(args, &num_args, &redirects, &num_redirects) == -1)
+     {
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     result = smallsh_builtin_run(args, num_args, -1, -1, redirects, num_redirects, exit_status, signal_flag, terminating_signal, jobs);
+
+     smallsh_redirect_close(redirects, num_redirects);
+
+     return result;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_builtin_run(char **args, int num_args, int input_fd, int output_fd, const redirect *redirects,
+**                               int num_redirects, int *exit_status, int *signal_flag, int *terminating_signal,
+**                               job_table *jobs)
+** Description: runs a built in with stdin and stdout moved to input_fd and output_fd (-1 leaves them alone), then its
+**              redirections applied in order, and puts the shell's own descriptors back afterwards. Returns what
+**              smallsh_execute() returned for it.
+** Parameters: the args array, number of elements, the descriptors, the redirections, the status variables and the job table
+******************************************************************************************************************************/
+int smallsh_builtin_run(char **args, int num_args, int input_fd, int output_fd, const redirect *redirects, int num_redirects, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     int saved[REDIRECT_MAX_FD + 1];  //the shell's descriptor, -1 if it wasn't open, -2 if it is untouched
+     int result;
+     int i;
+
+     for (i = 0; i <= REDIRECT_MAX_FD; i++)
+     {
+          saved[i] = -2;
+     }
+     fflush(stdout);
+
+     for (i = -2; i < num_redirects; i++)
+     {
+          int fd = (i == -2) ? 0 : ((i == -1) ? 1 : redirects[i].fd);
+          int source_fd = (i == -2) ? input_fd : ((i == -1) ? output_fd : redirects[i].source_fd);
+
+          if ((i < 0) && (source_fd == -1))
+          {
+               continue; //stdin or stdout stays
+          }
+
+          if (saved[fd] == -2)
+          {
+               saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+          }
+
+          if (source_fd == -1)
+          {
+               close(fd);
+          }
+          else if (source_fd != fd)
+          {
+               dup2(source_fd, fd);
+          }
+     }
+
+     result = smallsh_execute(args, num_args, exit_status, signal_flag, terminating_signal, jobs);
+
+     fflush(stdout);
+     for (i = 0; i <= REDIRECT_MAX_FD; i++)
+     {
+          if (saved[i] == -1)
+          {
+               close(i);
+          }
+          else if (saved[i] >= 0)
+          {
+               dup2(saved[i], i);
+               close(saved[i]);
+          }
+     }
+
+     return result;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_splice_pump(splice_pair *pairs, int num_pairs, fan_out *fan)
+** Description: moves data for every pair from its in descriptor to its out descriptor until in reaches end of file, using
+**              splice() so the data stays in kernel pipe buffers. Pairs are serviced together (one side of each is a pipe
+**              that may not be ready) and both descriptors of a pair are closed when it finishes. A pair whose ends can't
+**              be spliced (a terminal for example) is copied with read()/write() instead. The fan out, if there is one, is
+**              serviced in the same loop since a pair may be what feeds it.
+** Parameters: the pairs and how many there are, and the fan out or NULL
+******************************************************************************************************************************/
+void smallsh_splice_pump(splice_pair *pairs, int num_pairs, fan_out *fan)
+{
+     int num_fan_waits = (fan != NULL) ? (fan->num_targets + 1) : 0;
+     struct pollfd *waits = smallsh_arena_alloc(&command_arena, ((num_pairs * 2) + num_fan_waits) * sizeof(struct pollfd));
+     struct stat fd_info;
+     int active = num_pairs;
+     int i;
+
+     for (i = 0; i < num_pairs; i++)
+     {
+          pairs[i].in_pipe = ((fstat(pairs[i].in, &fd_info) == 0) && S_ISFIFO(fd_info.st_mode));
+          pairs[i].out_pipe = ((fstat(pairs[i].out, &fd_info) == 0) && S_ISFIFO(fd_info.st_mode));
+          pairs[i].done = 0;
+     }
+
+     while ((active > 0) || ((fan != NULL) && (fan->active > 0)))
+     {
+          int num_waits = 0;
+          int progress = 0;
+
+          if ((fan != NULL) && (fan->active > 0))
+          {
+               progress = smallsh_fan_out_step(fan, waits, &num_waits);
+          }
+
+          for (i = 0; i < num_pairs; i++)
+          {
+               ssize_t moved;
+
+               if (pairs[i].done == 1)
+               {
+                    continue;
+               }
+
+               moved = splice(pairs[i].in, NULL, pairs[i].out, NULL, PUMP_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+               if ((moved < 0) && (errno == EINVAL))
+               {
+                    char buffer[PUMP_BUFSIZE];
+
+                    moved = read(pairs[i].in, buffer, sizeof(buffer));
+                    if ((moved > 0) && (smallsh_write_all(pairs[i].out, buffer, moved) == -1))
+                    {
+                         moved = -1;
+                    }
+               }
+
+               if (moved > 0)
+               {
+                    progress = 1;
+               }
+               else if ((moved < 0) && (errno == EAGAIN))
+               {
+                    if (pairs[i].in_pipe)
+                    {
+                         waits[num_waits].fd = pairs[i].in;
+                         waits[num_waits].events = POLLIN;
+                         num_waits++;
+                    }
+                    if (pairs[i].out_pipe)
+                    {
+                         waits[num_waits].fd = pairs[i].out;
+                         waits[num_waits].events = POLLOUT;
+                         num_waits++;
+                    }
+               }
+               else //end of file, or the reader went away
+               {
+                    close(pairs[i].in);
+                    close(pairs[i].out);
+                    pairs[i].done = 1;
+                    active--;
+               }
+          }
+
+          if ((progress == 0) && (num_waits > 0))
+          {
+               poll(waits, num_waits, smallsh_deadline_foreground());
+          }
+     }
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_fan_out_open(char **words, int num_words, stage *consumers)
+** Description: reads a fan out, ">& file ... |> command ... |> command ...", where either part may be left out, and opens
+**              what it needs before anything is started: the files (truncated like ">"), the source pipe the last stage
+**              will write to, the stdin pipe of each consumer and one pipe per target that the pump tees into. Every
+**              target's pipe gets at least the capacity of the source, so a tee() into an empty one always takes all of
+**              the source. The consumers are filled in as stages with their stdin set. Returns the fan out from the command
+**              arena, or NULL after printing the error.
+** Parameters: the words from the ">&" or first "|>" to the end of the line, how many there are, and the stages reserved
+**             for the consumers
+******************************************************************************************************************************/
+fan_out *smallsh_fan_out_open(char **words, int num_words, stage *consumers)
+{
+     fan_out *fan = smallsh_arena_alloc(&command_arena, sizeof(fan_out));
+     int source_fds[2];
+     int num_consumers = 0;
+     int failed = 0;
+     int size;
+     int i;
+
+     fan->targets = smallsh_arena_alloc(&command_arena, num_words * sizeof(fan_target));
+     fan->num_targets = 0;
+     fan->active = 0;
+     fan->eof = 0;
+     fan->source = -1;
+     fan->source_write = -1;
+
+     for (i = (smallsh_is_operator(words[0], ">&") ? 1 : 0); i < num_words; i++)
+     {
+          fan_target *target = &fan->targets[fan->num_targets];
+
+          if (smallsh_is_operator(words[i], "|>"))
+          {
+               int start = i + 1;
+               int pipe_fds[2];
+
+               //the consumer's words run up to the next "|>", its own redirections are opened with the other stages
+               words[i] = NULL;
+               while ((i + 1 < num_words) && !smallsh_is_operator(words[i + 1], "|>"))
+               {
+                    i++;
+                    if (smallsh_is_operator(words[i], "|") || smallsh_is_operator(words[i], ">&"))
+                    {
+                         printf("smallsh: syntax error near \"%s\"\n", words[i]);
+                         failed = 1;
+                    }
+               }
+               if (failed == 1)
+               {
+                    break;
+               }
+
+               if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+               {
+                    printf("smallsh: cannot create pipe: %s\n", strerror(errno));
+                    failed = 1;
+                    break;
+               }
+               if (pipe_buffer_size > 0)
+               {
+                    fcntl(pipe_fds[1], F_SETPIPE_SZ, pipe_buffer_size);
+               }
+               consumers[num_consumers].args = &words[start];
+               consumers[num_consumers].num_args = i + 1 - start;
+               consumers[num_consumers].input_fd = pipe_fds[0];
+               consumers[num_consumers].output_fd = -1;
+               consumers[num_consumers].buffer_fd = -1;
+               consumers[num_consumers].pid = -1;
+               num_consumers++;
+
+               target->fd = pipe_fds[1];
+               target->fd_pipe = 1;
+          }
+          else if (smallsh_is_operator(words[i], words[i]) || smallsh_is_redirect(words[i]))
+          {
+               printf("smallsh: syntax error near \"%s\"\n", words[i]);
+               failed = 1;
+               break;
+          }
+          else
+          {
+               target->fd = open(words[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+               target->fd_pipe = 0;
+
+               if (target->fd == -1)
+               {
+                    printf("smallsh: cannot open %s for output\n", words[i]);
+                    failed = 1;
+                    break;
+               }
+          }
+
+          target->pipe_fds[0] = target->pipe_fds[1] = -1;
+          target->pending = 0;
+          target->done = 0;
+          fan->num_targets++;
+          fan->active++;
+     }
+
+     if ((failed == 0) && (fan->num_targets == 0))
+     {
+          printf("smallsh: syntax error near \">&\"\n");
+          failed = 1;
+     }
+
+     if ((failed == 0) && (pipe2(source_fds, O_CLOEXEC) == -1))
+     {
+          printf("smallsh: cannot create pipe: %s\n", strerror(errno));
+          failed = 1;
+     }
+     else if (failed == 0)
+     {
+          fan->source = source_fds[0];
+          fan->source_write = source_fds[1];
+          fcntl(fan->source, F_SETPIPE_SZ, FAN_OUT_PIPE); //best effort, limited by /proc/sys/fs/pipe-max-size
+          size = fcntl(fan->source, F_GETPIPE_SZ);
+     }
+
+     for (i = 0; (i < fan->num_targets) && (failed == 0); i++)
+     {
+          fan_target *target = &fan->targets[i];
+          int target_size;
+
+          if (pipe2(target->pipe_fds, O_CLOEXEC) == -1)
+          {
+               printf("smallsh: cannot create pipe: %s\n", strerror(errno));
+               target->pipe_fds[0] = target->pipe_fds[1] = -1;
+               failed = 1;
+               break;
+          }
+          fcntl(target->pipe_fds[1], F_SETPIPE_SZ, size);
+          target_size = fcntl(target->pipe_fds[1], F_GETPIPE_SZ);
+
+          //out of pipe pages for this user: the source shrinks instead, it is still empty
+          if (target_size < size)
+          {
+               fcntl(fan->source, F_SETPIPE_SZ, target_size);
+               size = fcntl(fan->source, F_GETPIPE_SZ);
+          }
+     }
+
+     if (failed == 1)
+     {
+          for (i = 0; i < num_consumers; i++)
+          {
+               close(consumers[i].input_fd);
+          }
+          smallsh_fan_out_close(fan);
+          return NULL;
+     }
+
+     return fan;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_fan_out_step(fan_out *fan, struct pollfd *waits, int *num_waits)
+** Description: moves what a fan out can without blocking. Each target's pipe is emptied into its file or consumer, and once
+**              all of them are empty the next round goes in: the source is tee()d into every target's pipe but the last and
+**              spliced into the last one, which takes it out of the source. A slow target holds up the next round, so the
+**              source fills and the last stage blocks instead of the shell buffering for it. A target whose consumer went
+**              away is dropped, and the source is closed when no target is left. Adds what it waits for to waits and
+**              returns 1 if anything moved.
+** Parameters: the fan out, and the poll() list and its length to add to
+******************************************************************************************************************************/
+int smallsh_fan_out_step(fan_out *fan, struct pollfd *waits, int *num_waits)
+{
+     fan_target *last = NULL;
+     size_t round = 0;
+     ssize_t moved;
+     int progress = 0;
+     int i;
+
+     /* Empty each target's pipe into its file or consumer */
+     for (i = 0; i < fan->num_targets; i++)
+     {
+          fan_target *target = &fan->targets[i];
+
+          if ((target->done == 1) || (target->pending == 0))
+          {
+               continue;
+          }
+
+          moved = splice(target->pipe_fds[0], NULL, target->fd, NULL, target->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+          if ((moved < 0) && (errno == EINVAL))
+          {
+               char buffer[PUMP_BUFSIZE];
+
+               moved = read(target->pipe_fds[0], buffer, (target->pending < sizeof(buffer)) ? target->pending : sizeof(buffer));
+               if ((moved > 0) && (smallsh_write_all(target->fd, buffer, moved) == -1))
+               {
+                    moved = -1;
+               }
+          }
+
+          if (moved > 0)
+          {
+               target->pending -= moved;
+               progress = 1;
+          }
+          else if ((moved < 0) && (errno == EAGAIN))
+          {
+               waits[*num_waits].fd = target->fd;
+               waits[*num_waits].events = POLLOUT;
+               (*num_waits)++;
+          }
+          else //the consumer went away or the file can't be written
+          {
+               smallsh_fan_out_drop(fan, target);
+          }
+     }
+
+     /* The next round waits for the slowest target */
+     for (i = 0; i < fan->num_targets; i++)
+     {
+          if (fan->targets[i].done == 0)
+          {
+               if (fan->targets[i].pending > 0)
+               {
+                    return progress;
+               }
+               last = &fan->targets[i];
+          }
+     }
+
+     if (fan->eof == 1)
+     {
+          for (i = 0; i < fan->num_targets; i++)
+          {
+               if (fan->targets[i].done == 0)
+               {
+                    smallsh_fan_out_drop(fan, &fan->targets[i]); //end of file for the consumer
+               }
+          }
+          return progress;
+     }
+
+     //an empty target pipe holds at least what the source does, so every tee() copies the same round
+     for (i = 0; (i < fan->num_targets) && (last != NULL); i++)
+     {
+          fan_target *target = &fan->targets[i];
+
+          if ((target->done == 1) || (target == last))
+          {
+               continue;
+          }
+
+          moved = tee(fan->source, target->pipe_fds[1], (round == 0) ? PUMP_CHUNK : round, SPLICE_F_NONBLOCK);
+
+          if ((round == 0) && (moved > 0))
+          {
+               round = moved;
+          }
+          else if ((round == 0) && ((moved == 0) || (errno != EAGAIN)))
+          {
+               fan->eof = 1;
+               break;
+          }
+          else if (round == 0) //nothing written yet
+          {
+               waits[*num_waits].fd = fan->source;
+               waits[*num_waits].events = POLLIN;
+               (*num_waits)++;
+               return progress;
+          }
+          else if (moved != (ssize_t)round)
+          {
+               printf("smallsh: fan out copy cut short\n");
+               smallsh_fan_out_drop(fan, target);
+               continue;
+          }
+
+          target->pending += round;
+     }
+
+     if ((fan->eof == 0) && (last != NULL) && (last->done == 0))
+     {
+          size_t wanted = (round == 0) ? PUMP_CHUNK : round;
+
+          moved = splice(fan->source, NULL, last->pipe_fds[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+          if (moved > 0)
+          {
+               last->pending += moved;
+               progress = 1;
+          }
+          else if ((round == 0) && (moved < 0) && (errno == EAGAIN))
+          {
+               waits[*num_waits].fd = fan->source;
+               waits[*num_waits].events = POLLIN;
+               (*num_waits)++;
+          }
+          else if (round == 0)
+          {
+               fan->eof = 1;
+          }
+
+          //the round is already in the other targets, it has to leave the source whole
+          while ((round > 0) && (last->pending < round))
+          {
+               moved = splice(fan->source, NULL, last->pipe_fds[1], NULL, round - last->pending, SPLICE_F_MOVE);
+               if (moved <= 0)
+               {
+                    printf("smallsh: fan out copy cut short\n");
+                    smallsh_fan_out_drop(fan, last);
+                    break;
+               }
+               last->pending += moved;
+          }
+     }
+
+     if (round > 0)
+     {
+          progress = 1;
+     }
+     if ((fan->eof == 1) && (fan->source != -1))
+     {
+          close(fan->source);
+          fan->source = -1;
+          progress = 1; //the targets are closed once they are empty, on the next step
+     }
+
+     return progress;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_fan_out_drop(fan_out *fan, fan_target *target)
+** Description: closes a fan out target and its pipe. The source is closed with the last target, so the stage writing to it
+**              gets SIGPIPE like it would writing to a pipe nobody reads.
+** Parameters: the fan out and the target
+******************************************************************************************************************************/
+void smallsh_fan_out_drop(fan_out *fan, fan_target *target)
+{
+     close(target->fd);
+     if (target->pipe_fds[0] != -1)
+     {
+          close(target->pipe_fds[0]);
+          close(target->pipe_fds[1]);
+     }
+     target->done = 1;
+     fan->active--;
+
+     if ((fan->active == 0) && (fan->source != -1))
+     {
+          close(fan->source);
+          fan->source = -1;
+          fan->eof = 1;
+     }
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_fan_out_close(fan_out *fan)
+** Description: closes every descriptor the shell still holds for a fan out, once a helper process has its own copies or
+**              the command failed to start. Nothing happens for NULL.
+** Parameters: the fan out or NULL
+******************************************************************************************************************************/
+void smallsh_fan_out_close(fan_out *fan)
+{
+     int i;
+
+     if (fan == NULL)
+     {
+          return;
+     }
+
+     for (i = 0; i < fan->num_targets; i++)
+     {
+          if (fan->targets[i].done == 0)
+          {
+               smallsh_fan_out_drop(fan, &fan->targets[i]);
+          }
+     }
+     if (fan->source != -1)
+     {
+          close(fan->source);
+          fan->source = -1;
+     }
+     if (fan->source_write != -1)
+     {
+          close(fan->source_write);
+          fan->source_write = -1;
+     }
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_write_all(int fd, const char *buffer, size_t length)
+** Description: writes the whole buffer, returns -1 on error
+** Parameters: the descriptor, the data and its length
+******************************************************************************************************************************/
+int smallsh_write_all(int fd, const char *buffer, size_t length)
+{
+     while (length > 0)
+     {
+          ssize_t written = write(fd, buffer, length);
+
+          if (written < 0)
+          {
+               if (errno == EINTR)
+               {
+                    continue;
+               }
+               if (errno == EAGAIN)
+               {
+                    struct pollfd wait_fd = { fd, POLLOUT, 0 };
+                    poll(&wait_fd, 1, -1);
+                    continue;
+               }
+               return -1;
+          }
+
+          buffer += written;
+          length -= written;
+     }
+
+     return 0;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_spawn(spawn_request *request)
+** Description: starts a child with the selected spawn engine, or the fork engine if it has a placement. The time the shell
+**              spends blocked starting the child is added to the engine's spawn latency totals. Returns the pid, or -1 after
+**              printing the error.
+** Parameters: what to run and how its stdin/stdout and process group are set up
+******************************************************************************************************************************/
+pid_t smallsh_spawn(spawn_request *request)
+{
+     struct timespec spawn_start, spawn_end;
+     int engine = spawn_mode;
+     pid_t pid;
+
+     fflush(stdout); //batch mode has no prompt flush, keep the shell's output ahead of the child's
+
+     //posix_spawn() can't set the CPU mask, nice value, cgroup or rlimits, a placed or limited child has to do it itself,
+     //and a built in needs a copy of the shell to run in
+     if (((request->place != NULL) && (request->place->active == 1)) || (request->group != NULL) || (request->builtin_jobs != NULL))
+     {
+          engine = SPAWN_FORK;
+     }
+
+     clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+
+     if (engine == SPAWN_POSIX)
+     {
+          pid = smallsh_spawn_posix(request);
+     }
+     else
+     {
+          pid = smallsh_spawn_fork(request);
+     }
+
+     clock_gettime(CLOCK_MONOTONIC, &spawn_end);
+
+     if (pid > 0)
+     {
+          long long nsec = ((spawn_end.tv_sec - spawn_start.tv_sec) * 1000000000LL) + (spawn_end.tv_nsec - spawn_start.tv_nsec);
+
+          spawn_count[engine]++;
+          spawn_nsec[engine] += nsec;
+          smallsh_histogram_record(&spawn_latency[engine], nsec / 1000);
+     }
+
+     return pid;
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_spawn_fork(spawn_request *request)
+** Description: fork() engine. The child restores SIGINT and SIGPIPE, joins the requested process group, applies its CPU
+**              and scheduling placement, moves the descriptors it was given onto stdin/stdout, does the redirections in
+**              order and then passes the command to exec(), or runs it as a built in for a pipeline stage.
+**              This is the fallback for smallsh_spawn_posix() and is selected with "spawn fork".
+**
+** Parameters: what to run and how its stdin/stdout and process group are set up
+******************************************************************************************************************************/
+pid_t smallsh_spawn_fork(spawn_request *request)
+{
+     pid_t pid;
+
+     pid = fork();
+
+     /********************************/
+     /* There was an error forking   */
+     /********************************/
+     if (pid < 0)
+     {
+          printf("smallsh: Error forking!\n");
+          return -1;
+     }
+     else if (pid > 0)
+     {
+          return pid; //parent goes back to smallsh_launch()
+     }
+
+     /********************************/
+     /*     This is the Child        */
+     /********************************/
+
+     //restore sigation to default for all foreground process - Credit: Professor Brewster from class discusion boards
+     struct sigaction act;
+     act.sa_handler = SIG_DFL;
+     act.sa_flags = 0;
+     sigemptyset(&act.sa_mask);
+     sigaction(SIGINT, &act, 0);
+     sigaction(SIGPIPE, &act, 0);
+
+     //unblock SIGCHLD, the shell may have blocked it for its signalfd
+     sigset_t empty_mask;
+     sigemptyset(&empty_mask);
+     sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+     if (request->pgid >= 0)
+     {
+          setpgid(0, request->pgid);
+     }
+
+     if ((request->place != NULL) && (smallsh_placement_apply(request->place, request->cpu) == -1))
+     {
+          printf("smallsh: cannot apply placement: %s\n", strerror(errno));
+          exit(1); //exit the child process
+     }
+
+     if ((request->group != NULL) && (smallsh_group_enter(request->group) == -1))
+     {
+          printf("smallsh: cannot apply limits: %s\n", strerror(errno));
+          exit(1); //exit the child process
+     }
+
+     //Credit: Lecture 12- "Pipes and Redirection"
+     if (request->stdin_fd != -1)
+     {
+          //redirect stdin to the specified file or pipe
+          if (dup2(request->stdin_fd, 0) == -1)
+          {
+               printf("smallsh: Could not redirect stdin for input file\n");
+               exit(1); //exit the child process
+          }
+     }
+     else if (request->stdin_null == 1)
+     {
+          int fd = open("/dev/null", O_RDONLY, 0644);  //redirect stdin to "/dev/null" 
+
+          if ((fd == -1) || (dup2(fd, 0) == -1))
+          {
+               printf("smallsh: Could not redirect stdin to \"/dev/null\"\n");
+               exit(1); //exit the child process
+          }
+
+          close(fd);
+     }
+
+     if (request->stdout_fd != -1)
+     {
+          //redirect stdout to the specified file or pipe
+          if (dup2(request->stdout_fd, 1) == -1)
+          {
+               printf("smallsh: Could not redirect stdout for output file\n");
+               exit(1); //exit the child process
+          }
+     }
+
+     //the redirections in order, their files were opened by the shell above REDIRECT_FD_BASE so none is overwritten first
+     int i;
+     for (i = 0; i < request->num_redirects; i++)
+     {
+          const redirect *current = &request->redirects[i];
+
+          if (current->source_fd == -1)
+          {
+               close(current->fd);
+          }
+          else if ((current->source_fd != current->fd) && (dup2(current->source_fd, current->fd) == -1))
+          {
+               printf("smallsh: Could not redirect descriptor %d\n", current->fd);
+               exit(1); //exit the child process
+          }
+     }
+
+     //a built in pipeline stage runs here, in the copy of the shell, and its status is the child's
+     if (request->builtin_jobs != NULL)
+     {
+          int builtin_exit_status = 0;
+          int builtin_signal_flag = 0;
+          int builtin_terminating_signal = 0;
+          int num_args = 0;
+
+          while (request->args[num_args] != NULL)
+          {
+               num_args++;
+          }
+          smallsh_builtin_run(request->args, num_args, -1, -1, NULL, 0, &builtin_exit_status, &builtin_signal_flag, &builtin_terminating_signal, request->builtin_jobs);
+          fflush(stdout);
+          _exit(builtin_exit_status);
+     }
+
+     //every other descriptor the shell opened is close-on-exec
+     execv(request->path, request->args);
+
+     printf("smallsh: no such file or directory\n"); //command not found
+     exit(COMMAND_NOT_FOUND); //exit the child process
+}
+
+/*****************************************************************************************************************************
+** Function: smallsh_spawn_posix(spawn_request *request)
+** Description: posix_spawn() engine. glibc starts the child with clone(CLONE_VM|CLONE_VFORK), so the shell's page tables
+**              are never copied. The pipes are dup2()'d onto stdin/stdout, background stdin is opened from "/dev/null"
+**              and the redirections are done in order as spawn file actions, while the process group and the SIGINT/SIGPIPE reset
+**              are spawn attributes.
+**
+** Parameters: what to run and how its stdin/stdout and process group are set up
+******************************************************************************************************************************/
+pid_t smallsh_spawn_posix(spawn_request *request)
+{
+     posix_spawn_file_actions_t actions;
+     posix_spawnattr_t attr;
+     sigset_t default_signals;
+     sigset_t empty_mask;
+     short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+     pid_t pid;
+     int error;
+     int i;
+
+     posix_spawn_file_actions_init(&actions);
+
+     if (request->stdin_fd != -1)
+     {
+          posix_spawn_file_actions_adddup2(&actions, request->stdin_fd, 0);
+     }
+     else if (request->stdin_null == 1) //user did not specify input redirect
+     {
+          posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0644);
+     }
+
+     if (request->stdout_fd != -1)
+     {
+          posix_spawn_file_actions_adddup2(&actions, request->stdout_fd, 1);
+     }
+
+     for (i = 0; i < request->num_redirects; i++)
+     {
+          if (request->redirects[i].source_fd == -1)
+          {
+               posix_spawn_file_actions_addclose(&actions, request->redirects[i].fd);
+          }
+          else
+          {
+               posix_spawn_file_actions_adddup2(&actions, request->redirects[i].source_fd, request->redirects[i].fd);
+          }
+     }
+
+     //restore SIGINT/SIGPIPE to default in the child, the shell itself ignores them, and unblock SIGCHLD
+     posix_spawnattr_init(&attr);
+     sigemptyset(&default_signals);
+     sigaddset(&default_signals, SIGINT);
+     sigaddset(&default_signals, SIGPIPE);
+     posix_spawnattr_setsigdefault(&attr, &default_signals);
+     sigemptyset(&empty_mask);
+     posix_spawnattr_setsigmask(&attr, &empty_mask);
+
+     if (request->pgid >= 0)
+     {
+          posix_spawnattr_setpgroup(&attr, request->pgid);
+          flags |= POSIX_SPAWN_SETPGROUP;
+     }
+#ifdef POSIX_SPAWN_USEVFORK
+     flags |= POSIX_SPAWN_USEVFORK;
+#endif
+     posix_spawnattr_setflags(&attr, flags);
+
+     error = posix_spawn(&pid, request->path, &actions, &attr, request->args, environ);
+
+     posix_spawnattr_destroy(&attr);
+     posix_spawn_file_actions_destroy(&actions);
+
+     if (error != 0)
+     {
+          if ((error == EAGAIN) || (error == ENOMEM))
+          {
+               printf("smallsh: Error forking!\n");
+          }
+          else
+          {
+               printf("smallsh: no such file or directory\n"); //command not found
+          }
+          return -1;
+     }
+
+     return pid;
+}
+
+/**********************************************************************
+** Function: smallsh_spawn_report()
+** Description: prints the spawn engine in use and the average time the
+**              shell was blocked starting a child with each engine
+** Parameters: none
+**********************************************************************/
+void smallsh_spawn_report()
+{
+     const char *names[2] = { "fork", "posix" };
+     int i;
+
+     printf("Spawn engine: %s\n", names[spawn_mode]);
+
+     for (i = 0; i < 2; i++)
+     {
+          double average = 0.0;
+
+          if (spawn_count[i] > 0)
+          {
+               average = (spawn_nsec[i] / 1000.0) / spawn_count[i];
+          }
+
+          printf("  %-5s %ld launches, average %.1f us\n", names[i], spawn_count[i], average);
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_on_builtin(char **args, int num_args,
+**                              int *exit_status, int *signal_flag,
+**                              int *terminating_signal, job_table *jobs)
+** Description: built in "on [cpus=LIST] [nice=N] [sched=POLICY]
+**              [numa=NODE] [rr] command": runs the rest of the line
+**              with the placement, which the children apply before
+**              exec(). Returns what smallsh_execute() returned.
+** Parameters: the args array starting at "on", its length, the
+**             shell's status variables and the job table
+**********************************************************************/
+int smallsh_on_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     placement place;
+     int used;
+     int result;
+
+     used = smallsh_placement_parse(args + 1, &place, "on");
+     if (used == -1)
+     {
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     if (args[used + 1] == NULL)
+     {
+          printf("usage: on [cpus=LIST] [nice=N] [sched=batch|idle|other] [numa=NODE] [rr] command [args]\n");
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     command_placement = &place;
+     result = smallsh_execute(args + used + 1, num_args - used - 1, exit_status, signal_flag, terminating_signal, jobs);
+     command_placement = NULL;
+
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_placement_builtin(char **args)
+** Description: built in "placement": with no arguments shows the
+**              session default for background jobs, "placement off"
+**              clears it and placement options (as for "on") set it.
+**              Foreground commands are never placed by the default.
+**              Returns the exit status.
+** Parameters: the args array
+**********************************************************************/
+int smallsh_placement_builtin(char **args)
+{
+     placement place;
+     int used;
+
+     if (args[1] == NULL)
+     {
+          smallsh_placement_print(&default_placement);
+          return 0;
+     }
+
+     if ((strcmp(args[1], "off") == 0) && (args[2] == NULL))
+     {
+          default_placement.active = 0;
+          return 0;
+     }
+
+     used = smallsh_placement_parse(args + 1, &place, "placement");
+     if (used == -1)
+     {
+          return 1;
+     }
+     if (args[used + 1] != NULL)
+     {
+          printf("smallsh: placement: unknown option %s\n", args[used + 1]);
+          return 1;
+     }
+
+     default_placement = place;
+     placement_next_cpu = 0;
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_placement_parse(char **args, placement *place,
+**                                   const char *name)
+** Description: reads the leading placement options of args into
+**              place: cpus=LIST, nice=N, sched=batch|idle|other,
+**              numa=NODE (binds memory and narrows the CPUs to the
+**              node's) and rr. Stops at the first other word and
+**              returns how many were used, or -1 after printing the
+**              error.
+** Parameters: the words, where to store them and the built in's name
+**             for errors
+**********************************************************************/
+int smallsh_placement_parse(char **args, placement *place, const char *name)
+{
+     int used;
+
+     memset(place, 0, sizeof(placement));
+     place->policy = -1;
+     place->numa_node = -1;
+
+     for (used = 0; args[used] != NULL; used++)
+     {
+          char *value = strchr(args[used], '=');
+          char *end;
+
+          if (strcmp(args[used], "rr") == 0)
+          {
+               place->round_robin = 1;
+               continue;
+          }
+          if (value == NULL)
+          {
+               break; //the command
+          }
+          value++;
+
+          if (strncmp(args[used], "cpus=", 5) == 0)
+          {
+               if (smallsh_cpulist_parse(value, &place->cpus) == -1)
+               {
+                    printf("smallsh: %s: invalid CPU list %s\n", name, value);
+                    return -1;
+               }
+               place->has_cpus = 1;
+          }
+          else if (strncmp(args[used], "nice=", 5) == 0)
+          {
+               place->nice = (int)strtol(value, &end, 10);
+               if ((*value == '\0') || (*end != '\0'))
+               {
+                    printf("smallsh: %s: invalid nice value %s\n", name, value);
+                    return -1;
+               }
+               place->has_nice = 1;
+          }
+          else if (strncmp(args[used], "sched=", 6) == 0)
+          {
+               if (strcmp(value, "batch") == 0)
+               {
+                    place->policy = SCHED_BATCH;
+               }
+               else if (strcmp(value, "idle") == 0)
+               {
+                    place->policy = SCHED_IDLE;
+               }
+               else if (strcmp(value, "other") == 0)
+               {
+                    place->policy = SCHED_OTHER;
+               }
+               else
+               {
+                    printf("smallsh: %s: scheduling class must be batch, idle or other\n", name);
+                    return -1;
+               }
+          }
+          else if (strncmp(args[used], "numa=", 5) == 0)
+          {
+               place->numa_node = (int)strtol(value, &end, 10);
+               if ((*value == '\0') || (*end != '\0') || (place->numa_node < 0) || (place->numa_node >= NUMA_MAX_NODES))
+               {
+                    printf("smallsh: %s: invalid NUMA node %s\n", name, value);
+                    return -1;
+               }
+          }
+          else
+          {
+               break; //a command argument like VAR=value
+          }
+     }
+
+     //a NUMA node's CPUs come from sysfs, cpus= can narrow them further
+     if (place->numa_node >= 0)
+     {
+          char path[64];
+          char list[4096];
+          cpu_set_t node_cpus;
+          FILE *file;
+
+          snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", place->numa_node);
+          file = fopen(path, "re");
+          if ((file == NULL) || (fgets(list, sizeof(list), file) == NULL) || (smallsh_cpulist_parse(list, &node_cpus) == -1))
+          {
+               printf("smallsh: %s: no NUMA node %d\n", name, place->numa_node);
+               if (file != NULL)
+               {
+                    fclose(file);
+               }
+               return -1;
+          }
+          fclose(file);
+
+          if (place->has_cpus == 1)
+          {
+               CPU_AND(&place->cpus, &place->cpus, &node_cpus);
+          }
+          else
+          {
+               place->cpus = node_cpus;
+               place->has_cpus = 1;
+          }
+     }
+
+     if ((place->has_cpus == 1) && (CPU_COUNT(&place->cpus) == 0))
+     {
+          printf("smallsh: %s: no CPUs left to run on\n", name);
+          return -1;
+     }
+
+     place->active = (place->has_cpus || place->has_nice || (place->policy != -1) || (place->numa_node != -1) || place->round_robin);
+     return used;
+}
+
+/**********************************************************************
+** Function: smallsh_placement_print(const placement *place)
+** Description: prints a placement the way it is written for "on"
+** Parameters: the placement
+**********************************************************************/
+void smallsh_placement_print(const placement *place)
+{
+     char cpus[1024];
+
+     if (place->active == 0)
+     {
+          printf("Placement: none\n");
+          return;
+     }
+
+     printf("Placement:");
+     if (place->has_cpus == 1)
+     {
+          smallsh_cpulist_format(&place->cpus, cpus, sizeof(cpus));
+          printf(" cpus=%s", cpus);
+     }
+     if (place->has_nice == 1)
+     {
+          printf(" nice=%d", place->nice);
+     }
+     if (place->policy != -1)
+     {
+          printf(" sched=%s", (place->policy == SCHED_BATCH) ? "batch" : (place->policy == SCHED_IDLE) ? "idle" : "other");
+     }
+     if (place->numa_node != -1)
+     {
+          printf(" numa=%d", place->numa_node);
+     }
+     if (place->round_robin == 1)
+     {
+          printf(" rr");
+     }
+     printf("\n");
+}
+
+/**********************************************************************
+** Function: smallsh_placement_cpu(const placement *place)
+** Description: returns the next CPU for round robin placement: the
+**              one after the last CPU handed out among the allowed
+**              ones (the placement's, or the shell's own mask)
+** Parameters: the placement
+**********************************************************************/
+int smallsh_placement_cpu(const placement *place)
+{
+     cpu_set_t allowed;
+     int i;
+
+     if (place->has_cpus == 1)
+     {
+          allowed = place->cpus;
+     }
+     else if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+     {
+          return -1;
+     }
+
+     for (i = 0; i < CPU_SETSIZE; i++)
+     {
+          int cpu = (placement_next_cpu + i) % CPU_SETSIZE;
+
+          if (CPU_ISSET(cpu, &allowed))
+          {
+               placement_next_cpu = cpu + 1;
+               return cpu;
+          }
+     }
+
+     return -1;
+}
+
+/**********************************************************************
+** Function: smallsh_placement_apply(const placement *place, int cpu)
+** Description: applies a placement to the calling process (the child
+**              between fork() and exec()): its CPU mask (or just cpu
+**              for round robin), NUMA memory binding, scheduling
+**              class and nice value. Returns -1 with errno set if one
+**              of them can't be applied.
+** Parameters: the placement and the round robin CPU or -1
+**********************************************************************/
+int smallsh_placement_apply(const placement *place, int cpu)
+{
+     if (cpu >= 0)
+     {
+          cpu_set_t single;
+
+          CPU_ZERO(&single);
+          CPU_SET(cpu, &single);
+          if (sched_setaffinity(0, sizeof(single), &single) == -1)
+          {
+               return -1;
+          }
+     }
+     else if ((place->has_cpus == 1) && (sched_setaffinity(0, sizeof(place->cpus), &place->cpus) == -1))
+     {
+          return -1;
+     }
+
+     if (place->numa_node >= 0)
+     {
+          unsigned long nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+          memset(nodes, 0, sizeof(nodes));
+          nodes[place->numa_node / (8 * sizeof(unsigned long))] |= 1UL << (place->numa_node % (8 * sizeof(unsigned long)));
+#ifdef SYS_set_mempolicy
+          if (syscall(SYS_set_mempolicy, MPOL_BIND, nodes, NUMA_MAX_NODES + 1) == -1)
+          {
+               return -1;
+          }
+#endif
+     }
+
+     if (place->policy != -1)
+     {
+          struct sched_param param;
+
+          param.sched_priority = 0;
+          if (sched_setscheduler(0, place->policy, &param) == -1)
+          {
+               return -1;
+          }
+     }
+
+     if (place->has_nice == 1)
+     {
+          errno = 0;
+          if ((nice(place->nice) == -1) && (errno != 0))
+          {
+               return -1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_cpulist_parse(const char *text, cpu_set_t *cpus)
+** Description: reads a CPU list like "0-3,8,10-11" (the format of
+**              sysfs cpulist files, a trailing newline is allowed)
+**              into cpus. Returns -1 if it isn't one.
+** Parameters: the list and the set to fill
+**********************************************************************/
+int smallsh_cpulist_parse(const char *text, cpu_set_t *cpus)
+{
+     CPU_ZERO(cpus);
+
+     while ((*text != '\0') && (*text != '\n'))
+     {
+          char *end;
+          long first = strtol(text, &end, 10);
+          long last = first;
+
+          if ((end == text) || (first < 0))
+          {
+               return -1;
+          }
+          text = end;
+
+          if (*text == '-')
+          {
+               text++;
+               last = strtol(text, &end, 10);
+               if ((end == text) || (last < first))
+               {
+                    return -1;
+               }
+               text = end;
+          }
+
+          if (last >= CPU_SETSIZE)
+          {
+               return -1;
+          }
+          for (; first <= last; first++)
+          {
+               CPU_SET(first, cpus);
+          }
+
+          if (*text == ',')
+          {
+               text++;
+          }
+          else if ((*text != '\0') && (*text != '\n'))
+          {
+               return -1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_cpulist_format(const cpu_set_t *cpus,
+**                                  char *buffer, size_t size)
+** Description: writes cpus as a CPU list with ranges, like "0-3,8"
+** Parameters: the set and the buffer to write to
+**********************************************************************/
+void smallsh_cpulist_format(const cpu_set_t *cpus, char *buffer, size_t size)
+{
+     size_t length = 0;
+     int cpu = 0;
+
+     buffer[0] = '\0';
+
+     while ((cpu < CPU_SETSIZE) && (length < size))
+     {
+          int last;
+
+          if (!CPU_ISSET(cpu, cpus))
+          {
+               cpu++;
+               continue;
+          }
+
+          for (last = cpu; (last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, cpus); last++)
+          {
+               //extend the range
+          }
+
+          if (last == cpu)
+          {
+               length += snprintf(buffer + length, size - length, (length == 0) ? "%d" : ",%d", cpu);
+          }
+          else
+          {
+               length += snprintf(buffer + length, size - length, (length == 0) ? "%d-%d" : ",%d-%d", cpu, last);
+          }
+          cpu = last + 1;
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_limit_builtin(char **args, int num_args,
+**                                 int *exit_status, int *signal_flag,
+**                                 int *terminating_signal, job_table *jobs)
+** Description: built in "limit [memory=SIZE] [cpu=N%|QUOTA/PERIOD]
+**              [pids=N] command" runs the rest of the line in a new
+**              cgroup leaf with those limits, "limit group=NAME
+**              command" in a named group. A background job keeps its
+**              leaf until it is reaped. Returns what smallsh_execute()
+**              returned.
+** Parameters: the args array starting at "limit", its length, the
+**             shell's status variables and the job table
+**********************************************************************/
+int smallsh_limit_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     resource_limits limits;
+     resource_group *group;
+     char *group_name = NULL;
+     int used;
+     int result;
+
+     used = smallsh_limits_parse(args + 1, &limits, &group_name, "limit");
+     if (used == -1)
+     {
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     if (args[used + 1] == NULL)
+     {
+          printf("usage: limit [memory=SIZE] [cpu=N%%|QUOTA/PERIOD] [pids=N] [group=NAME] command [args]\n");
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     if (group_name != NULL)
+     {
+          group = smallsh_group_find(group_name);
+          if (group == NULL)
+          {
+               printf("smallsh: limit: no group %s\n", group_name);
+               *exit_status = 1;
+               return 1; //reprint prompt
+          }
+          if ((limits.memory_max != -1) || (limits.cpu_quota != -1) || (limits.pids_max != -1))
+          {
+               printf("smallsh: limit: the limits of group %s are set with \"group\"\n", group_name);
+               *exit_status = 1;
+               return 1; //reprint prompt
+          }
+          group->refs++;
+     }
+     else
+     {
+          group = smallsh_group_create(NULL);
+          smallsh_group_set_limits(group, &limits);
+     }
+
+     command_group = group;
+     result = smallsh_execute(args + used + 1, num_args - used - 1, exit_status, signal_flag, terminating_signal, jobs);
+     command_group = NULL;
+
+     smallsh_group_release(group);
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_timeout_builtin(char **args, int num_args,
+**                                   int *exit_status, int *signal_flag,
+**                                   int *terminating_signal,
+**                                   job_table *jobs)
+** Description: built in "timeout [-k GRACE] DURATION command" runs the
+**              rest of the line with a deadline: SIGTERM when it is
+**              over, SIGKILL GRACE (5s) later. A foreground command
+**              that timed out has status 124 and "status" says so, a
+**              background job is reported as timed out. Fast path
+**              built ins run as programs so there is something to
+**              signal. "timeout [-k GRACE] -d DURATION|off" sets the
+**              deadline every command gets without a "timeout" of its
+**              own, "timeout -x GRACE" how long background jobs get
+**              after SIGTERM when the shell exits, "timeout" prints
+**              both. Returns what smallsh_execute() returned.
+** Parameters: the args array starting at "timeout", its length, the
+**             shell's status variables and the job table
+**********************************************************************/
+int smallsh_timeout_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     long long duration;
+     long long grace = default_grace;
+     int first = 1;  //the duration or "-d"
+     int result;
+
+     if (args[1] == NULL)
+     {
+          char timeout_text[32], grace_text[32];
+
+          printf("timeout default %s, grace %s", (default_timeout == 0) ? "off" : smallsh_format_usec(default_timeout, timeout_text, sizeof(timeout_text)),
+                 smallsh_format_usec(default_grace, grace_text, sizeof(grace_text)));
+          printf(", exit grace %s\n", smallsh_format_usec(exit_grace, grace_text, sizeof(grace_text)));
+          *exit_status = 0;
+          return 1; //reprint prompt
+     }
+
+     if (strcmp(args[1], "-x") == 0)
+     {
+          if ((args[2] == NULL) || (smallsh_duration_parse(args[2], &grace) == -1))
+          {
+               printf("smallsh: timeout: invalid grace period \"%s\"\n", (args[2] != NULL) ? args[2] : "");
+               *exit_status = 1;
+               return 1; //reprint prompt
+          }
+          exit_grace = grace;
+          *exit_status = 0;
+          return 1; //reprint prompt
+     }
+
+     if (strcmp(args[1], "-k") == 0)
+     {
+          if ((args[2] == NULL) || (smallsh_duration_parse(args[2], &grace) == -1))
+          {
+               printf("smallsh: timeout: invalid grace period \"%s\"\n", (args[2] != NULL) ? args[2] : "");
+               *exit_status = 1;
+               return 1; //reprint prompt
+          }
+          first = 3;
+     }
+
+     if ((args[first] != NULL) && (strcmp(args[first], "-d") == 0))
+     {
+          if ((args[first + 1] != NULL) && (strcmp(args[first + 1], "off") == 0))
+          {
+               duration = 0;
+          }
+          else if ((args[first + 1] == NULL) || (smallsh_duration_parse(args[first + 1], &duration) == -1))
+          {
+               printf("smallsh: timeout: invalid duration \"%s\"\n", (args[first + 1] != NULL) ? args[first + 1] : "");
+               *exit_status = 1;
+               return 1; //reprint prompt
+          }
+          default_timeout = duration;
+          default_grace = grace;
+          *exit_status = 0;
+          return 1; //reprint prompt
+     }
+
+     if ((args[first] == NULL) || (args[first + 1] == NULL))
+     {
+          printf("usage: timeout [-k GRACE] DURATION command [args]\n       timeout [-k GRACE] -d DURATION|off\n       timeout -x GRACE\n");
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+     if (smallsh_duration_parse(args[first], &duration) == -1)
+     {
+          printf("smallsh: timeout: invalid duration \"%s\"\n", args[first]);
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     //0 runs the command without a deadline, not even the default one
+     command_timeout = (duration > 0) ? duration : -1;
+     command_grace = grace;
+     result = smallsh_execute(args + first + 1, num_args - first - 1, exit_status, signal_flag, terminating_signal, jobs);
+     command_timeout = 0;
+
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_group_builtin(char **args)
+** Description: built in "group": with no arguments lists the named
+**              groups, "group NAME [limits]" creates one or replaces
+**              its limits and "group -d NAME" removes it (its cgroup
+**              goes once its last job is reaped). Returns the exit
+**              status.
+** Parameters: the args array
+**********************************************************************/
+int smallsh_group_builtin(char **args)
+{
+     resource_limits limits;
+     resource_group *group;
+     int used;
+
+     if (args[1] == NULL)
+     {
+          for (group = named_groups; group != NULL; group = group->next)
+          {
+               smallsh_group_print(group, "");
+          }
+          return 0;
+     }
+
+     if (strcmp(args[1], "-d") == 0)
+     {
+          resource_group **link;
+
+          for (link = &named_groups; (*link != NULL) && ((args[2] == NULL) || (strcmp((*link)->name, args[2]) != 0)); link = &(*link)->next)
+          {
+               //find the group and the pointer to it
+          }
+          if (*link == NULL)
+          {
+               printf("smallsh: group: no group %s\n", (args[2] != NULL) ? args[2] : "");
+               return 1;
+          }
+
+          group = *link;
+          *link = group->next;
+          smallsh_group_release(group);
+          return 0;
+     }
+
+     if ((strlen(args[1]) >= CGROUP_NAME_LENGTH) || (strchr(args[1], '/') != NULL) || (strchr(args[1], '=') != NULL) || (args[1][0] == '.'))
+     {
+          printf("smallsh: group: invalid group name %s\n", args[1]);
+          return 1;
+     }
+
+     used = smallsh_limits_parse(args + 2, &limits, NULL, "group");
+     if (used == -1)
+     {
+          return 1;
+     }
+     if (args[used + 2] != NULL)
+     {
+          printf("smallsh: group: unknown option %s\n", args[used + 2]);
+          return 1;
+     }
+
+     group = smallsh_group_find(args[1]);
+     if (group == NULL)
+     {
+          group = smallsh_group_create(args[1]);
+          group->next = named_groups;
+          named_groups = group;
+     }
+     smallsh_group_set_limits(group, &limits);
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_limits_parse(char **args, resource_limits *limits,
+**                                char **group_name, const char *name)
+** Description: reads the leading limit options of args: memory=SIZE
+**              (K, M, G or T suffix), cpu=N% of one CPU or
+**              cpu=QUOTA/PERIOD in microseconds, pids=N and, if
+**              group_name isn't NULL, group=NAME. Unset limits are -1.
+**              Stops at the first other word and returns how many
+**              were used, or -1 after printing the error.
+** Parameters: the words, where to store them and the built in's name
+**             for errors
+**********************************************************************/
+int smallsh_limits_parse(char **args, resource_limits *limits, char **group_name, const char *name)
+{
+     int used;
+
+     limits->memory_max = -1;
+     limits->cpu_quota = -1;
+     limits->cpu_period = CPU_PERIOD_USEC;
+     limits->pids_max = -1;
+
+     for (used = 0; args[used] != NULL; used++)
+     {
+          char *value = strchr(args[used], '=');
+          char *end;
+
+          if (value == NULL)
+          {
+               break; //the command
+          }
+          value++;
+
+          if (strncmp(args[used], "memory=", 7) == 0)
+          {
+               if (smallsh_size_parse(value, &limits->memory_max) == -1)
+               {
+                    printf("smallsh: %s: invalid memory size %s\n", name, value);
+                    return -1;
+               }
+          }
+          else if (strncmp(args[used], "cpu=", 4) == 0)
+          {
+               double percent = strtod(value, &end);
+
+               if ((end != value) && (strcmp(end, "%") == 0) && (percent > 0))
+               {
+                    limits->cpu_quota = (long long)((percent * CPU_PERIOD_USEC) / 100);
+               }
+               else if ((sscanf(value, "%lld/%lld", &limits->cpu_quota, &limits->cpu_period) != 2) || (limits->cpu_period <= 0))
+               {
+                    printf("smallsh: %s: CPU limit must be N%% or QUOTA/PERIOD\n", name);
+                    return -1;
+               }
+
+               if (limits->cpu_quota < 1000)
+               {
+                    printf("smallsh: %s: CPU quota must be at least 1ms per period\n", name);
+                    return -1;
+               }
+          }
+          else if (strncmp(args[used], "pids=", 5) == 0)
+          {
+               limits->pids_max = strtoll(value, &end, 10);
+               if ((*value == '\0') || (*end != '\0') || (limits->pids_max <= 0))
+               {
+                    printf("smallsh: %s: invalid process count %s\n", name, value);
+                    return -1;
+               }
+          }
+          else if ((group_name != NULL) && (strncmp(args[used], "group=", 6) == 0))
+          {
+               *group_name = value;
+          }
+          else
+          {
+               break; //a command argument like VAR=value
+          }
+     }
+
+     return used;
+}
+
+/**********************************************************************
+** Function: smallsh_size_parse(const char *text, long long *value)
+** Description: reads a byte count with an optional K, M, G or T
+**              (powers of 1024) suffix. Returns -1 if it isn't one.
+** Parameters: the text and where to store the count
+**********************************************************************/
+int smallsh_size_parse(const char *text, long long *value)
+{
+     char *end;
+     int shift = 0;
+
+     *value = strtoll(text, &end, 10);
+     if ((end == text) || (*value < 0))
+     {
+          return -1;
+     }
+
+     switch (*end)
+     {
+          case 'k': case 'K': shift = 10; break;
+          case 'm': case 'M': shift = 20; break;
+          case 'g': case 'G': shift = 30; break;
+          case 't': case 'T': shift = 40; break;
+          case '\0': break;
+          default: return -1;
+     }
+     if ((shift != 0) && (end[1] != '\0'))
+     {
+          return -1;
+     }
+
+     *value <<= shift;
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_duration_parse(const char *text, long long *usec)
+** Description: reads a number of seconds (fractions allowed) with an
+**              optional ms, s, m, h or d suffix into microseconds.
+**              Returns -1 if it isn't one.
+** Parameters: the text and where to store the microseconds
+**********************************************************************/
+int smallsh_duration_parse(const char *text, long long *usec)
+{
+     char *end;
+     double value = strtod(text, &end);
+
+     if ((end != text) && (strcmp(end, "ms") == 0))
+     {
+          value /= 1000;
+          end += 2;
+     }
+     else if ((end != text) && (*end != '\0') && (end[1] == '\0') && (strchr("smhd", *end) != NULL))
+     {
+          value *= (*end == 's') ? 1 : (*end == 'm') ? 60 : (*end == 'h') ? 3600 : 86400;
+          end++;
+     }
+
+     if ((end == text) || (*end != '\0') || (value < 0) || (value > 1e12))
+     {
+          return -1;
+     }
+
+     *usec = (long long)(value * 1000000);
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_cgroup_init()
+** Description: creates smallsh-<pid> in the shell's cgroup v2 cgroup
+**              (found through /proc/self/mountinfo and
+**              /proc/self/cgroup), moves the shell into a
+**              smallsh-<pid>/shell leaf so smallsh-<pid> holds no
+**              process itself, and enables the memory, cpu and pids
+**              controllers for the leaves under smallsh-<pid>. The
+**              cgroup the shell started in is never changed: if it
+**              doesn't delegate a controller that is said once and
+**              the limits fall back to setrlimit(). Returns the
+**              directory descriptor, or -1 if cgroupfs isn't there or
+**              isn't writable.
+** Parameters: none
+**********************************************************************/
+int smallsh_cgroup_init()
+{
+     char mount_point[PATH_MAX] = "";
+     char own[PATH_MAX] = "";
+     char parent[PATH_MAX];
+     char *line = NULL;
+     size_t line_size = 0;
+     const char *controllers[] = { "+memory", "+cpu", "+pids", NULL };
+     char missing[32] = "";
+     char pid_text[24];
+     FILE *file;
+     int i;
+
+     cgroup_base_fd = -1;
+
+     //mountinfo: id parent dev root mount_point options ... - fstype source super_options
+     file = fopen("/proc/self/mountinfo", "re");
+     while ((file != NULL) && (getline(&line, &line_size, file) != -1))
+     {
+          char *separator = strstr(line, " - cgroup2 ");
+
+          if ((separator != NULL) && (sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1))
+          {
+               break;
+          }
+          mount_point[0] = '\0';
+     }
+     if (file != NULL)
+     {
+          fclose(file);
+     }
+
+     file = fopen("/proc/self/cgroup", "re");
+     while ((file != NULL) && (getline(&line, &line_size, file) != -1))
+     {
+          if (strncmp(line, "0::", 3) == 0)
+          {
+               snprintf(own, sizeof(own), "%s", line + 3);
+               own[strcspn(own, "\n")] = '\0';
+               break;
+          }
+     }
+     if (file != NULL)
+     {
+          fclose(file);
+     }
+     free(line);
+
+     if ((mount_point[0] == '\0') || (own[0] == '\0'))
+     {
+          return -1;
+     }
+
+     if ((snprintf(parent, sizeof(parent), "%s%s", mount_point, (strcmp(own, "/") == 0) ? "" : own) >= (int)sizeof(parent))
+         || (snprintf(cgroup_base_path, sizeof(cgroup_base_path), "%s/smallsh-%d", parent, getpid()) >= (int)sizeof(cgroup_base_path)))
+     {
+          return -1;
+     }
+
+     if ((mkdir(cgroup_base_path, 0755) == -1) && (errno != EEXIST))
+     {
+          return -1;
+     }
+     cgroup_base_fd = open(cgroup_base_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+     if (cgroup_base_fd == -1)
+     {
+          return -1;
+     }
+
+     //a cgroup with processes of its own can't hand controllers to its children, so the shell moves to a leaf
+     snprintf(pid_text, sizeof(pid_text), "%d", getpid());
+     if (((mkdirat(cgroup_base_fd, "shell", 0755) == 0) || (errno == EEXIST)))
+     {
+          int shell_fd = openat(cgroup_base_fd, "shell", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+          if ((shell_fd != -1) && (smallsh_cgroup_write(shell_fd, "cgroup.procs", pid_text) == 0))
+          {
+               snprintf(cgroup_origin_path, sizeof(cgroup_origin_path), "%s", parent);
+          }
+          else
+          {
+               unlinkat(cgroup_base_fd, "shell", AT_REMOVEDIR);
+          }
+          if (shell_fd != -1)
+          {
+               close(shell_fd);
+          }
+     }
+
+     //one at a time, a write naming a controller the parent doesn't delegate fails as a whole
+     for (i = 0; controllers[i] != NULL; i++)
+     {
+          if (smallsh_cgroup_write(cgroup_base_fd, "cgroup.subtree_control", controllers[i]) == -1)
+          {
+               strcat(missing, " ");
+               strcat(missing, controllers[i] + 1);
+          }
+     }
+     if (missing[0] != '\0')
+     {
+          printf("smallsh: %s doesn't delegate%s, those limits use setrlimit() or are left out\n", parent, missing);
+          fflush(stdout);
+     }
+
+     return cgroup_base_fd;
+}
+
+/**********************************************************************
+** Function: smallsh_cgroup_write(int dir_fd, const char *file,
+**                                const char *text)
+** Description: writes text to a cgroup control file. Returns -1 if
+**              the file isn't there or the kernel refuses the value.
+** Parameters: the cgroup directory, the file and what to write
+**********************************************************************/
+int smallsh_cgroup_write(int dir_fd, const char *file, const char *text)
+{
+     int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+     int result = 0;
+
+     if (fd == -1)
+     {
+          return -1;
+     }
+     if (write(fd, text, strlen(text)) == -1)
+     {
+          result = -1;
+     }
+     close(fd);
+
+     return result;
+}
+
+/**********************************************************************
+** Function: smallsh_cgroup_read(int dir_fd, const char *file,
+**                               const char *key)
+** Description: reads a number from a cgroup file: its first word, or
+**              the value after "key" in a flat keyed file like
+**              cpu.stat. Returns -1 if it isn't there.
+** Parameters: the cgroup directory, the file and the key or NULL
+**********************************************************************/
+long long smallsh_cgroup_read(int dir_fd, const char *file, const char *key)
+{
+     char buffer[4096];
+     char *text = buffer;
+     ssize_t bytes;
+     int fd = openat(dir_fd, file, O_RDONLY | O_CLOEXEC);
+
+     if (fd == -1)
+     {
+          return -1;
+     }
+     bytes = read(fd, buffer, sizeof(buffer) - 1);
+     close(fd);
+     if (bytes <= 0)
+     {
+          return -1;
+     }
+     buffer[bytes] = '\0';
+
+     if (key != NULL)
+     {
+          size_t key_length = strlen(key);
+
+          while ((strncmp(text, key, key_length) != 0) || (text[key_length] != ' '))
+          {
+               text = strchr(text, '\n');
+               if (text == NULL)
+               {
+                    return -1;
+               }
+               text++;
+          }
+          text += key_length;
+     }
+
+     if ((*text < '0' || *text > '9') && (*text != ' '))
+     {
+          return -1; //"max"
+     }
+     return strtoll(text, NULL, 10);
+}
+
+/**********************************************************************
+** Function: smallsh_group_create(const char *name)
+** Description: creates the cgroup leaf for a named group, or for a
+**              "limit" command if name is NULL, holding one
+**              reference. Without a writable cgroupfs the group only
+**              carries limits for setrlimit().
+** Parameters: the group name or NULL
+**********************************************************************/
+resource_group *smallsh_group_create(const char *name)
+{
+     resource_group *group = calloc(1, sizeof(resource_group));
+
+     if (name != NULL)
+     {
+          snprintf(group->name, sizeof(group->name), "%s", name);
+          snprintf(group->leaf, sizeof(group->leaf), "group-%s", name);
+     }
+     else
+     {
+          snprintf(group->leaf, sizeof(group->leaf), "job-%d", cgroup_next_leaf++);
+     }
+     group->limits.memory_max = group->limits.cpu_quota = group->limits.pids_max = -1;
+     group->fallback = group->limits;
+     group->dir_fd = -1;
+     group->procs_fd = -1;
+     group->refs = 1;
+     group->memory_pressure = group->cpu_pressure = -1;
+
+     if (cgroup_base_fd == -2)
+     {
+          smallsh_cgroup_init();
+     }
+
+     if ((cgroup_base_fd >= 0) && ((mkdirat(cgroup_base_fd, group->leaf, 0755) == 0) || (errno == EEXIST)))
+     {
+          group->dir_fd = openat(cgroup_base_fd, group->leaf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+          if (group->dir_fd != -1)
+          {
+               group->procs_fd = openat(group->dir_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+          }
+          if (group->procs_fd == -1)
+          {
+               if (group->dir_fd != -1)
+               {
+                    close(group->dir_fd);
+                    group->dir_fd = -1;
+               }
+               unlinkat(cgroup_base_fd, group->leaf, AT_REMOVEDIR);
+          }
+     }
+
+     return group;
+}
+
+/**********************************************************************
+** Function: smallsh_group_set_limits(resource_group *group,
+**                                    const resource_limits *limits)
+** Description: replaces a group's limits. Each one goes to its cgroup
+**              file, one the cgroup can't take is kept for setrlimit()
+**              in the children: memory.max becomes RLIMIT_AS (address
+**              space, so stricter) and pids.max RLIMIT_NPROC (which
+**              counts the user's processes and doesn't bind root).
+**              cpu.max has no rlimit, that is reported.
+** Parameters: the group and its new limits
+**********************************************************************/
+void smallsh_group_set_limits(resource_group *group, const resource_limits *limits)
+{
+     char text[64];
+
+     group->limits = *limits;
+     group->fallback.memory_max = group->fallback.cpu_quota = group->fallback.pids_max = -1;
+
+     if (group->dir_fd == -1)
+     {
+          group->fallback = *limits;
+     }
+     else
+     {
+          snprintf(text, sizeof(text), (limits->memory_max >= 0) ? "%lld" : "max", limits->memory_max);
+          if (smallsh_cgroup_write(group->dir_fd, "memory.max", text) == -1)
+          {
+               group->fallback.memory_max = limits->memory_max;
+          }
+
+          if (limits->cpu_quota >= 0)
+          {
+               snprintf(text, sizeof(text), "%lld %lld", limits->cpu_quota, limits->cpu_period);
+          }
+          else
+          {
+               snprintf(text, sizeof(text), "max %lld", limits->cpu_period);
+          }
+          if (smallsh_cgroup_write(group->dir_fd, "cpu.max", text) == -1)
+          {
+               group->fallback.cpu_quota = limits->cpu_quota;
+          }
+
+          snprintf(text, sizeof(text), (limits->pids_max >= 0) ? "%lld" : "max", limits->pids_max);
+          if (smallsh_cgroup_write(group->dir_fd, "pids.max", text) == -1)
+          {
+               group->fallback.pids_max = limits->pids_max;
+          }
+     }
+
+     if (group->fallback.cpu_quota >= 0)
+     {
+          printf("smallsh: the cgroup v2 cpu controller isn't available, CPU time is not limited\n");
+          fflush(stdout);
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_group_find(const char *name)
+** Description: returns the named group or NULL
+** Parameters: the group name
+**********************************************************************/
+resource_group *smallsh_group_find(const char *name)
+{
+     resource_group *group;
+
+     for (group = named_groups; group != NULL; group = group->next)
+     {
+          if (strcmp(group->name, name) == 0)
+          {
+               return group;
+          }
+     }
+
+     return NULL;
+}
+
+/**********************************************************************
+** Function: smallsh_group_release(resource_group *group)
+** Description: drops a reference to a group. The last one removes its
+**              cgroup (the kernel refuses while something still runs
+**              in it, like a process the job left behind) and frees it.
+** Parameters: the group
+**********************************************************************/
+void smallsh_group_release(resource_group *group)
+{
+     group->refs--;
+     if (group->refs > 0)
+     {
+          return;
+     }
+
+     if (group->dir_fd != -1)
+     {
+          close(group->procs_fd);
+          close(group->dir_fd);
+          unlinkat(cgroup_base_fd, group->leaf, AT_REMOVEDIR);
+     }
+     free(group);
+}
+
+/**********************************************************************
+** Function: smallsh_group_enter(const resource_group *group)
+** Description: moves the calling process (a child before exec()) into
+**              a group's cgroup and sets the limits the cgroup couldn't
+**              take as rlimits. Returns -1 with errno set on failure.
+** Parameters: the group
+**********************************************************************/
+int smallsh_group_enter(const resource_group *group)
+{
+     struct rlimit limit;
+
+     if ((group->procs_fd != -1) && (write(group->procs_fd, "0", 1) == -1))
+     {
+          return -1;
+     }
+
+     if (group->fallback.memory_max >= 0)
+     {
+          limit.rlim_cur = limit.rlim_max = group->fallback.memory_max;
+          if (setrlimit(RLIMIT_AS, &limit) == -1)
+          {
+               return -1;
+          }
+     }
+     if (group->fallback.pids_max >= 0)
+     {
+          limit.rlim_cur = limit.rlim_max = group->fallback.pids_max;
+          if (setrlimit(RLIMIT_NPROC, &limit) == -1)
+          {
+               return -1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_group_pressure(const resource_group *group,
+**                                  const char *file)
+** Description: returns the "some avg10" value of a PSI pressure file
+**              (the percentage of the last 10 seconds some task in
+**              the cgroup was stalled), or -1 if there is none
+** Parameters: the group and memory.pressure or cpu.pressure
+**********************************************************************/
+double smallsh_group_pressure(const resource_group *group, const char *file)
+{
+     char buffer[256];
+     double pressure;
+     ssize_t bytes;
+     int fd;
+
+     if (group->dir_fd == -1)
+     {
+          return -1;
+     }
+
+     fd = openat(group->dir_fd, file, O_RDONLY | O_CLOEXEC);
+     if (fd == -1)
+     {
+          return -1;
+     }
+     bytes = read(fd, buffer, sizeof(buffer) - 1);
+     close(fd);
+     if (bytes <= 0)
+     {
+          return -1;
+     }
+     buffer[bytes] = '\0';
+
+     if (sscanf(buffer, "some avg10=%lf", &pressure) != 1)
+     {
+          return -1;
+     }
+     return pressure;
+}
+
+/**********************************************************************
+** Function: smallsh_group_print(resource_group *group,
+**                               const char *indent)
+** Description: prints a group's limits (marked "rlimit" where they
+**              are set with setrlimit()), its memory and CPU use and
+**              its memory and CPU pressure, which is recorded in the
+**              group for the jobs in it
+** Parameters: the group and what to start the line with
+**********************************************************************/
+void smallsh_group_print(resource_group *group, const char *indent)
+{
+     char cpu[32];
+     long long value;
+
+     group->memory_pressure = smallsh_group_pressure(group, "memory.pressure");
+     group->cpu_pressure = smallsh_group_pressure(group, "cpu.pressure");
+
+     printf("%s%s:", indent, (group->name[0] != '\0') ? group->name : group->leaf);
+     if (group->limits.memory_max >= 0)
+     {
+          printf(" memory=%lldKB%s", group->limits.memory_max / 1024, (group->fallback.memory_max >= 0) ? "(rlimit)" : "");
+     }
+     if (group->limits.cpu_quota >= 0)
+     {
+          printf(" cpu=%lld/%lld%s", group->limits.cpu_quota, group->limits.cpu_period, (group->fallback.cpu_quota >= 0) ? "(not applied)" : "");
+     }
+     if (group->limits.pids_max >= 0)
+     {
+          printf(" pids=%lld%s", group->limits.pids_max, (group->fallback.pids_max >= 0) ? "(rlimit)" : "");
+     }
+
+     if (group->dir_fd == -1)
+     {
+          printf(" (no cgroup)\n");
+          return;
+     }
+
+     if ((value = smallsh_cgroup_read(group->dir_fd, "memory.current", NULL)) >= 0)
+     {
+          printf("  memory %lldKB", value / 1024);
+     }
+     if ((value = smallsh_cgroup_read(group->dir_fd, "cpu.stat", "usage_usec")) >= 0)
+     {
+          printf("  cpu %s", smallsh_format_usec(value, cpu, sizeof(cpu)));
+     }
+     if ((value = smallsh_cgroup_read(group->dir_fd, "pids.current", NULL)) >= 0)
+     {
+          printf("  pids %lld", value);
+     }
+     if (group->memory_pressure >= 0)
+     {
+          printf("  pressure memory %.2f%% cpu %.2f%%", group->memory_pressure, group->cpu_pressure);
+     }
+     printf("\n");
+}
+
+/**********************************************************************
+** Function: smallsh_groups_free()
+** Description: removes the named groups and the shell's smallsh-<pid>
+**              cgroup when the shell exits, after its jobs are gone.
+**              The shell moves back to the cgroup it started in first.
+** Parameters: none
+**********************************************************************/
+void smallsh_groups_free()
+{
+     while (named_groups != NULL)
+     {
+          resource_group *group = named_groups;
+
+          named_groups = group->next;
+          smallsh_group_release(group);
+     }
+
+     if (cgroup_base_fd >= 0)
+     {
+          if (cgroup_origin_path[0] != '\0')
+          {
+               int origin_fd = open(cgroup_origin_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+               char pid_text[24];
+
+               snprintf(pid_text, sizeof(pid_text), "%d", getpid());
+               if (origin_fd != -1)
+               {
+                    smallsh_cgroup_write(origin_fd, "cgroup.procs", pid_text);
+                    close(origin_fd);
+               }
+               unlinkat(cgroup_base_fd, "shell", AT_REMOVEDIR);
+               cgroup_origin_path[0] = '\0';
+          }
+          close(cgroup_base_fd);
+          rmdir(cgroup_base_path);
+          cgroup_base_fd = -1;
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_redirect_open(char **args, int *num_args,
+**                                 redirect **redirects,
+**                                 int *num_redirects)
+** Description: takes every redirection out of a command's words, in
+**              order: [N]< file, [N]> file, [N]>> file (appends with
+**              O_APPEND, so jobs can share a log), [N]>&M or [N]<&M
+**              to duplicate a descriptor and [N]>&- to close one.
+**              Files are opened here in the shell (close-on-exec) so
+**              a bad filename costs no fork, and a duplicated
+**              descriptor has to be open by then. The list comes from
+**              the command arena. Returns -1 after printing the error.
+**
+** Parameters: the args, pointer to the number of them (updated), and
+**             where to store the redirections and how many there are
+**********************************************************************/
+int smallsh_redirect_open(char **args, int *num_args, redirect **redirects, int *num_redirects)
+{
+     redirect *list;
+     int defined = 0;  //bit N: descriptor N is open in the command at this point
+     int count = 0;
+     int kept = 0;
+     int i;
+
+     *redirects = NULL;
+     *num_redirects = 0;
+
+     for (i = 0; i < *num_args; i++)
+     {
+          if (smallsh_is_redirect(args[i]))
+          {
+               count++;
+          }
+     }
+     if (count == 0)
+     {
+          return 0;
+     }
+
+     //the command starts with the shell's descriptors that survive exec()
+     for (i = 0; i <= REDIRECT_MAX_FD; i++)
+     {
+          int flags = fcntl(i, F_GETFD);
+
+          if ((flags != -1) && ((flags & FD_CLOEXEC) == 0))
+          {
+               defined |= 1 << i;
+          }
+     }
+
+     list = smallsh_arena_alloc(&command_arena, count * sizeof(redirect));
+     count = 0;
+
+     for (i = 0; i < *num_args; i++)
+     {
+          const char *op = args[i];
+          redirect *current = &list[count];
+
+          if (!smallsh_is_redirect(op))
+          {
+               args[kept++] = args[i];
+               continue;
+          }
+
+          current->fd = (*op == '<') ? 0 : 1;
+          if ((*op >= '0') && (*op <= '9'))
+          {
+               current->fd = *op++ - '0';
+          }
+          current->opened = 0;
+
+          if (op[1] == '&') //duplicate or close
+          {
+               if (op[2] == '-')
+               {
+                    current->source_fd = -1;
+                    defined &= ~(1 << current->fd);
+               }
+               else if ((defined & (1 << (op[2] - '0'))) == 0)
+               {
+                    printf("smallsh: %c: bad file descriptor\n", op[2]);
+                    *num_redirects = count;
+                    smallsh_redirect_close(list, count);
+                    return -1;
+               }
+               else
+               {
+                    current->source_fd = op[2] - '0';
+                    defined |= 1 << current->fd;
+               }
+          }
+          else //a file
+          {
+               int flags = (*op == '<') ? O_RDONLY : ((op[1] == '>') ? (O_WRONLY | O_CREAT | O_APPEND) : (O_WRONLY | O_CREAT | O_TRUNC));
+               const char *target = (i + 1 < *num_args) ? args[i + 1] : NULL;
+               int fd;
+
+               if ((target == NULL) || smallsh_is_redirect(target) || smallsh_is_operator(target, "&") || smallsh_is_operator(target, "|"))
+               {
+                    printf("smallsh: syntax error near \"%s\"\n", args[i]);
+                    *num_redirects = count;
+                    smallsh_redirect_close(list, count);
+                    return -1;
+               }
+               i++;
+
+               fd = open(target, flags | O_CLOEXEC, 0644); //Credit: http://linux.die.net/man/3/open
+               if ((fd != -1) && (fd < REDIRECT_FD_BASE))
+               {
+                    int moved = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+
+                    close(fd);
+                    fd = moved;
+               }
+
+               if (fd == -1)
+               {
+                    printf("smallsh: cannot open %s for %s\n", target, (*op == '<') ? "input" : "output");
+                    *num_redirects = count;
+                    smallsh_redirect_close(list, count);
+                    return -1;
+               }
+
+               current->source_fd = fd;
+               current->opened = 1;
+               defined |= 1 << current->fd;
+          }
+
+          count++;
+     }
+
+     args[kept] = NULL;
+     *num_args = kept;
+     *redirects = list;
+     *num_redirects = count;
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_redirect_close(redirect *redirects, int num_redirects)
+** Description: closes the files the shell opened for redirections
+** Parameters: the redirections and how many there are
+**********************************************************************/
+void smallsh_redirect_close(redirect *redirects, int num_redirects)
+{
+     int i;
+
+     for (i = 0; i < num_redirects; i++)
+     {
+          if (redirects[i].opened == 1)
+          {
+               close(redirects[i].source_fd);
+               redirects[i].opened = 0;
+          }
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_intern_redirect(char *token)
+** Description: returns the redirect_words entry for an unquoted
+**              redirection that names a descriptor or duplicates one,
+**              or the token itself for anything else. The file has to
+**              be the next word, like it is for "<" and ">".
+** Parameters: the unquoted token
+**********************************************************************/
+char *smallsh_intern_redirect(char *token)
+{
+     const char *text = token;
+     int fd = REDIRECT_MAX_FD + 1;      //none
+     int target = REDIRECT_MAX_FD + 2;  //none
+     int op;
+
+     if ((*text >= '0') && (*text <= '9'))
+     {
+          fd = *text++ - '0';
+     }
+     if ((*text != '<') && (*text != '>'))
+     {
+          return token;
+     }
+
+     if (text[1] == '&')
+     {
+          op = (*text == '<') ? 3 : 4;
+          if ((text[2] >= '0') && (text[2] <= '9'))
+          {
+               target = text[2] - '0';
+          }
+          else if (text[2] == '-')
+          {
+               target = REDIRECT_MAX_FD + 1;
+          }
+          else
+          {
+               return token;
+          }
+          text += 3;
+     }
+     else if ((text[0] == '>') && (text[1] == '>'))
+     {
+          op = 2;
+          text += 2;
+     }
+     else
+     {
+          op = (*text == '<') ? 0 : 1;
+          text++;
+     }
+
+     if (*text != '\0')
+     {
+          return token; //words are split at blanks, "2>file" is a plain word
+     }
+
+     if (redirect_words[fd][op][target][0] == '\0')
+     {
+          strcpy(redirect_words[fd][op][target], token);
+     }
+     return redirect_words[fd][op][target];
+}
+
+/**********************************************************************
+** Function: smallsh_is_redirect(const char *token)
+** Description: returns 1 if token is an unquoted redirection operator
+** Parameters: the token
+**********************************************************************/
+int smallsh_is_redirect(const char *token)
+{
+     const char *first = &redirect_words[0][0][0][0];
+
+     if ((token >= first) && (token < first + sizeof(redirect_words)))
+     {
+          return 1;
+     }
+
+     return (smallsh_is_operator(token, "<") || smallsh_is_operator(token, ">") || smallsh_is_operator(token, ">>"));
+}
+
+/**********************************************************************
+** Function: smallsh_find_redirect(char **args, int num_args)
+** Description: returns the position of the first redirection in args
+**              or -1
+** Parameters: the args array and number of elements
+**********************************************************************/
+int smallsh_find_redirect(char **args, int num_args)
+{
+     int i;
+
+     for (i = 0; i < num_args; i++)
+     {
+          if (smallsh_is_redirect(args[i]))
+          {
+               return i;
+          }
+     }
+
+     return -1;
+}
+
+/**********************************************************************
+** Function: smallsh_is_operator(const char *token, const char *op)
+** Description: returns 1 if token is the shell operator op. Only
+**              unquoted operators were interned by parse_line(), so
+**              the token has to be the shell_operators entry itself.
+** Parameters: the token and the operator ("|", "<", ">", ">>", "&")
+**********************************************************************/
+int smallsh_is_operator(const char *token, const char *op)
+{
+     int i;
+
+     if ((token == NULL) || (strcmp(token, op) != 0))
+     {
+          return 0;
+     }
+
+     for (i = 0; shell_operators[i] != NULL; i++)
+     {
+          if (token == shell_operators[i])
+          {
+               return 1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_find_operator(char **args, int num_args, const char *op)
+** Description: returns the position of the first op in args or -1
+** Parameters: the args array, number of elements and the operator
+**********************************************************************/
+int smallsh_find_operator(char **args, int num_args, const char *op)
+{
+     int i;
+
+     for (i = 0; i < num_args; i++)
+     {
+          if (smallsh_is_operator(args[i], op))
+          {
+               return i;
+          }
+     }
+
+     return -1;
+}
+
+/**********************************************************************
+** Function: smallsh_is_builtin(const char *name)
+** Description: returns 1 if name is handled by smallsh_execute() itself
+** Parameters: the command name
+**********************************************************************/
+int smallsh_is_builtin(const char *name)
+{
+     int i;
+
+     for (i = 0; builtin_names[i] != NULL; i++)
+     {
+          if (strcmp(name, builtin_names[i]) == 0)
+          {
+               return 1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_is_fast_path(const char *name)
+** Description: returns 1 if name is a built in that stands in for a
+**              program of the same name (see fast_path_names)
+** Parameters: the command name
+**********************************************************************/
+int smallsh_is_fast_path(const char *name)
+{
+     int i;
+
+     for (i = 0; fast_path_names[i] != NULL; i++)
+     {
+          if (strcmp(name, fast_path_names[i]) == 0)
+          {
+               return 1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_is_pure_builtin(const char *name)
+** Description: returns 1 if name is a built in that leaves the shell's
+**              state alone (see pure_builtin_names)
+** Parameters: the command name
+**********************************************************************/
+int smallsh_is_pure_builtin(const char *name)
+{
+     int i;
+
+     for (i = 0; pure_builtin_names[i] != NULL; i++)
+     {
+          if (strcmp(name, pure_builtin_names[i]) == 0)
+          {
+               return 1;
+          }
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_fast_path_forked(int background_process)
+** Description: returns 1 if a fast path built in has to run as its
+**              program: in the background, under "timeout" (it needs
+**              a process to signal), "on" (to place) or "limit" (to
+**              put in a cgroup)
+** Parameters: 1 if the command runs in the background
+**********************************************************************/
+int smallsh_fast_path_forked(int background_process)
+{
+     return (background_process == 1) || (command_timeout > 0) || (command_placement != NULL) || (command_group != NULL);
+}
+
+/**********************************************************************
+** Function: smallsh_echo_builtin(char **args)
+** Description: built in "echo": prints the arguments separated by
+**              spaces and a newline, "-n" leaves out the newline.
+**              Output goes through the stdout buffer, which is flushed
+**              before the next child starts.
+** Parameters: the args array
+**********************************************************************/
+void smallsh_echo_builtin(char **args)
+{
+     int newline = 1;
+     int first = 1;
+     int i;
+
+     if ((args[1] != NULL) && (strcmp(args[1], "-n") == 0))
+     {
+          newline = 0;
+          first = 2;
+     }
+
+     for (i = first; args[i] != NULL; i++)
+     {
+          if (i > first)
+          {
+               putchar(' ');
+          }
+          fputs(args[i], stdout);
+     }
+
+     if (newline == 1)
+     {
+          putchar('\n');
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_pwd_builtin()
+** Description: built in "pwd": prints the working directory.
+**              Returns the exit status.
+** Parameters: none
+**********************************************************************/
+int smallsh_pwd_builtin()
+{
+     char directory[PATH_MAX];
+
+     if (getcwd(directory, sizeof(directory)) == NULL)
+     {
+          printf("smallsh: pwd: %s\n", strerror(errno));
+          return 1;
+     }
+
+     printf("%s\n", directory);
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_test_builtin(char **args)
+** Description: built in "test" and "[ ... ]". Returns 0 if the
+**              expression is true, 1 if it is false and 2 if it
+**              can't be read, like test(1).
+** Parameters: the args array
+**********************************************************************/
+int smallsh_test_builtin(char **args)
+{
+     int count;
+
+     for (count = 0; args[count + 1] != NULL; count++)
+     {
+          //number of operands
+     }
+
+     if (strcmp(args[0], "[") == 0)
+     {
+          if ((count == 0) || (strcmp(args[count], "]") != 0))
+          {
+               printf("smallsh: [: missing \"]\"\n");
+               return 2;
+          }
+          count--;
+     }
+
+     return smallsh_test_expression(args + 1, count);
+}
+
+/**********************************************************************
+** Function: smallsh_test_expression(char **operands, int count)
+** Description: evaluates a test expression by its number of operands
+**              the way POSIX test does: one operand is true if it is
+**              not empty, two are "! x" or a unary file or string
+**              check, three are a binary comparison, and a leading
+**              "!" negates the rest. Returns 0 true, 1 false, 2 error.
+** Parameters: the operands and how many there are
+**********************************************************************/
+int smallsh_test_expression(char **operands, int count)
+{
+     struct stat file_info;
+     long long left, right;
+     const char *op;
+
+     if (count == 0)
+     {
+          return 1;
+     }
+
+     if (count == 1)
+     {
+          return (operands[0][0] == '\0');
+     }
+
+     if ((count == 3) && (operands[1][0] != '\0'))
+     {
+          op = operands[1];
+
+          if ((strcmp(op, "=") == 0) || (strcmp(op, "==") == 0))
+          {
+               return (strcmp(operands[0], operands[2]) != 0);
+          }
+          if (strcmp(op, "!=") == 0)
+          {
+               return (strcmp(operands[0], operands[2]) == 0);
+          }
+          if ((op[0] == '-') && (strlen(op) == 3) && (strstr("-eq -ne -lt -le -gt -ge", op) != NULL))
+          {
+               if ((smallsh_test_integer(operands[0], &left) == -1) || (smallsh_test_integer(operands[2], &right) == -1))
+               {
+                    return 2;
+               }
+
+               switch (op[1] * 256 + op[2])
+               {
+               case 'e' * 256 + 'q': return !(left == right);
+               case 'n' * 256 + 'e': return !(left != right);
+               case 'l' * 256 + 't': return !(left < right);
+               case 'l' * 256 + 'e': return !(left <= right);
+               case 'g' * 256 + 't': return !(left > right);
+               default: return !(left >= right);
+               }
+          }
+     }
+
+     if ((strcmp(operands[0], "!") == 0) && (count <= 4))
+     {
+          int result = smallsh_test_expression(operands + 1, count - 1);
+
+          return (result == 2) ? 2 : !result;
+     }
+
+     if (count != 2)
+     {
+          printf("smallsh: test: too many arguments\n");
+          return 2;
+     }
+
+     //unary checks
+     op = operands[0];
+     if ((op[0] != '-') || (op[1] == '\0') || (op[2] != '\0'))
+     {
+          printf("smallsh: test: %s: unary operator expected\n", op);
+          return 2;
+     }
+
+     switch (op[1])
+     {
+     case 'z': return (operands[1][0] != '\0');
+     case 'n': return (operands[1][0] == '\0');
+     case 'r': return (access(operands[1], R_OK) != 0);
+     case 'w': return (access(operands[1], W_OK) != 0);
+     case 'x': return (access(operands[1], X_OK) != 0);
+     case 'L':
+     case 'h': return !((lstat(operands[1], &file_info) == 0) && S_ISLNK(file_info.st_mode));
+     }
+
+     if (strchr("efdspS", op[1]) == NULL)
+     {
+          printf("smallsh: test: %s: unary operator expected\n", op);
+          return 2;
+     }
+
+     if (stat(operands[1], &file_info) != 0)
+     {
+          return 1;
+     }
+
+     switch (op[1])
+     {
+     case 'f': return !S_ISREG(file_info.st_mode);
+     case 'd': return !S_ISDIR(file_info.st_mode);
+     case 's': return !(file_info.st_size > 0);
+     case 'p': return !S_ISFIFO(file_info.st_mode);
+     case 'S': return !S_ISSOCK(file_info.st_mode);
+     default: return 0; //-e
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_test_integer(const char *text, long long *value)
+** Description: reads an integer operand for "test", prints an error
+**              and returns -1 if it isn't one
+** Parameters: the operand and where to store its value
+**********************************************************************/
+int smallsh_test_integer(const char *text, long long *value)
+{
+     char *end;
+
+     errno = 0;
+     *value = strtoll(text, &end, 10);
+
+     if ((text[0] == '\0') || (*end != '\0') || (errno != 0))
+     {
+          printf("smallsh: test: %s: integer expression expected\n", text);
+          return -1;
+     }
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_printf_builtin(char **args)
+** Description: built in "printf format [arguments]". The format knows
+**              the \ escapes \n \t \r \a \b \f \v \\ and the %d %i %u
+**              %o %x %X %c %s %f %e %g %% conversions with flags,
+**              width and precision. Like printf(1) the format is used
+**              again while arguments are left, and missing ones count
+**              as "" or 0. Returns the exit status.
+** Parameters: the args array
+**********************************************************************/
+int smallsh_printf_builtin(char **args)
+{
+     int next = 2;      //next argument to convert
+     int status = 0;
+
+     if (args[1] == NULL)
+     {
+          printf("usage: printf format [arguments]\n");
+          return 1;
+     }
+
+     do
+     {
+          const char *format = args[1];
+          int first = next;
+
+          while (*format != '\0')
+          {
+               char spec[40];   //one conversion passed on to printf()
+               int length = 0;
+               const char *argument;
+               char *end;
+
+               if (*format == '\\')
+               {
+                    const char *escapes = "n\nt\tr\ra\ab\bf\fv\v\\\\";
+                    const char *found = (format[1] != '\0') ? strchr(escapes, format[1]) : NULL;
+
+                    //escape letters are at even positions of escapes, followed by what they stand for
+                    if ((found != NULL) && (((found - escapes) % 2) == 0))
+                    {
+                         putchar(found[1]);
+                         format += 2;
+                    }
+                    else
+                    {
+                         putchar(*format++);
+                    }
+                    continue;
+               }
+
+               if (*format != '%')
+               {
+                    putchar(*format++);
+                    continue;
+               }
+
+               if (format[1] == '%')
+               {
+                    putchar('%');
+                    format += 2;
+                    continue;
+               }
+
+               //copy "%[flags][width][.precision]" and find the conversion
+               spec[length++] = *format++;
+               while ((*format != '\0') && (strchr("-+ #0123456789.", *format) != NULL) && (length < 30))
+               {
+                    spec[length++] = *format++;
+               }
+
+               if ((*format == '\0') || (strchr("diouxXcsfeEgG", *format) == NULL))
+               {
+                    printf("smallsh: printf: %%%c: invalid conversion\n", (*format != '\0') ? *format : ' ');
+                    return 1;
+               }
+
+               argument = (args[next] != NULL) ? args[next++] : NULL;
+
+               if ((*format == 'c') || (*format == 's'))
+               {
+                    spec[length++] = *format;
+                    spec[length] = '\0';
+                    if (*format == 'c')
+                    {
+                         if ((argument != NULL) && (argument[0] != '\0'))
+                         {
+                              printf(spec, argument[0]);
+                         }
+                    }
+                    else
+                    {
+                         printf(spec, (argument != NULL) ? argument : "");
+                    }
+               }
+               else if (strchr("feEgG", *format) != NULL)
+               {
+                    double number = 0.0;
+
+                    if (argument != NULL)
+                    {
+                         number = strtod(argument, &end);
+                         if ((argument[0] == '\0') || (*end != '\0'))
+                         {
+                              printf("smallsh: printf: %s: invalid number\n", argument);
+                              status = 1;
+                         }
+                    }
+                    spec[length++] = *format;
+                    spec[length] = '\0';
+                    printf(spec, number);
+               }
+               else
+               {
+                    long long number = 0;
+
+                    if (argument != NULL)
+                    {
+                         //a leading quote gives the character's value, like printf(1)
+                         if ((argument[0] == '\'') || (argument[0] == '"'))
+                         {
+                              number = (unsigned char)argument[1];
+                         }
+                         else
+                         {
+                              number = strtoll(argument, &end, 0);
+                              if ((argument[0] == '\0') || (*end != '\0'))
+                              {
+                                   printf("smallsh: printf: %s: invalid number\n", argument);
+                                   status = 1;
+                              }
+                         }
+                    }
+                    spec[length++] = 'l';
+                    spec[length++] = 'l';
+                    spec[length++] = *format;
+                    spec[length] = '\0';
+                    printf(spec, number);
+               }
+               format++;
+          }
+
+          if (next == first)
+          {
+               break; //the format used no arguments, don't repeat it
+          }
+     } while (args[next] != NULL);
+
+     return status;
+}
+
+/**********************************************************************
+** Function: smallsh_sleep_builtin(char **args, int *signal_flag,
+**                                 int *terminating_signal,
+**                                 job_table *jobs)
+** Description: built in "sleep": waits for the sum of its operands,
+**              each a number of seconds (fractions allowed) with an
+**              optional ms, s, m, h or d suffix. The shell ignores SIGINT
+**              so it is caught while sleeping, which ends the sleep
+**              like it would end the program. While background output
+**              is captured or a deadline is set it sleeps in the event
+**              loop so the capture pipes keep draining and deadlines go
+**              off. Returns the exit status.
+** Parameters: the args array, the shell's signal variables and the
+**             job table
+**********************************************************************/
+int smallsh_sleep_builtin(char **args, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     struct sigaction act, saved;
+     struct timespec remaining;
+     long long usec = 0;
+     int i;
+
+     if (args[1] == NULL)
+     {
+          printf("usage: sleep seconds\n");
+          return 1;
+     }
+
+     for (i = 1; args[i] != NULL; i++)
+     {
+          long long value;
+
+          if (smallsh_duration_parse(args[i], &value) == -1)
+          {
+               printf("smallsh: sleep: invalid time interval \"%s\"\n", args[i]);
+               return 1;
+          }
+          usec += value;
+     }
+
+     fflush(stdout); //echo output from before the sleep shows up now, not after it
+
+     remaining.tv_sec = (time_t)(usec / 1000000);
+     remaining.tv_nsec = (long)((usec % 1000000) * 1000);
+
+     sleep_interrupted = 0;
+     act.sa_handler = smallsh_sleep_interrupt;
+     act.sa_flags = 0;
+     sigemptyset(&act.sa_mask);
+     sigaction(SIGINT, &act, &saved);
+
+     if ((capture.open_pipes > 0) || (event_loop.timer_at != 0))
+     {
+          struct timespec now, wake_time;
+
+          clock_gettime(CLOCK_MONOTONIC, &wake_time);
+          wake_time.tv_sec += remaining.tv_sec;
+          wake_time.tv_nsec += remaining.tv_nsec;
+
+          smallsh_events_jobs_only(1);
+          while (sleep_interrupted == 0)
+          {
+               long long left;
+
+               clock_gettime(CLOCK_MONOTONIC, &now);
+               left = ((wake_time.tv_sec - now.tv_sec) * 1000000000LL) + (wake_time.tv_nsec - now.tv_nsec);
+               if (left <= 0)
+               {
+                    break;
+               }
+               smallsh_events_wait(jobs, (int)((left + 999999) / 1000000));
+               fflush(stdout);
+          }
+          smallsh_events_jobs_only(0);
+     }
+     else
+     {
+          while ((nanosleep(&remaining, &remaining) == -1) && (errno == EINTR) && (sleep_interrupted == 0))
+          {
+               //another signal, keep sleeping
+          }
+     }
+
+     sigaction(SIGINT, &saved, NULL);
+
+     *signal_flag = sleep_interrupted;
+     if (sleep_interrupted == 1)
+     {
+          *terminating_signal = SIGINT;
+          return 1;
+     }
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_sleep_interrupt(int signal_number)
+** Description: SIGINT handler installed while "sleep" waits
+** Parameters: the signal number
+**********************************************************************/
+void smallsh_sleep_interrupt(int signal_number)
+{
+     (void)signal_number; //only SIGINT is handled here
+     sleep_interrupted = 1;
+}
+
+/**********************************************************************
+** Function: smallsh_pipesize_builtin(char **args)
+** Description: built in "pipesize": shows or sets the buffer size of
+**              the pipes between pipeline stages (F_SETPIPE_SZ),
+**              "pipesize 0" goes back to the kernel default.
+**              Returns the exit status.
+** Parameters: the args array
+**********************************************************************/
+int smallsh_pipesize_builtin(char **args)
+{
+     char *end;
+     long size;
+
+     if (args[1] == NULL)
+     {
+          if (pipe_buffer_size == 0)
+          {
+               printf("Pipe size: default\n");
+          }
+          else
+          {
+               printf("Pipe size: %d bytes\n", pipe_buffer_size);
+          }
+          return 0;
+     }
+
+     size = strtol(args[1], &end, 10);
+     if ((*end != '\0') || (size < 0) || (size > INT_MAX))
+     {
+          printf("smallsh: pipesize: %s: invalid size\n", args[1]);
+          return 1;
+     }
+
+     pipe_buffer_size = (int)size;
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_parallel_builtin(char **args, job_table *jobs)
+** Description: built in "parallel [-j N] [-g] command [args] [::: inputs]":
+**              runs command once per input with at most N children
+**              in flight (default: the number of online CPUs). A slot
+**              is refilled as soon as its child exits, found through
+**              a poll() on the children's pidfds. Without ":::" the
+**              inputs are the lines of stdin.
+**              "{}" in a word is replaced by the input, otherwise the
+**              input is appended. -g collects each task's output in a
+**              memfd and prints it in one piece when the task ends.
+**              Returns the number of failed tasks, at most 101.
+** Parameters: the args array and the job table
+**********************************************************************/
+int smallsh_parallel_builtin(char **args, job_table *jobs)
+{
+     parallel_source source;
+     parallel_slot *slots;
+     struct pollfd *waits;
+     char **command;           //arguments of the task being started
+     char *scratch = NULL;     //task argument strings, reused by every task
+     size_t scratch_size = 0;
+     const char *path = NULL;  //resolved once unless the command name itself has a placeholder
+     int max_tasks = 0;
+     int group = 0;
+     int num_words;
+     int running = 0;
+     int failed = 0;
+     int stop = 0;             //no new tasks after one is interrupted with SIGINT
+     int first;
+     char *input;
+     char *end;
+     int i;
+
+     for (first = 1; (args[first] != NULL) && (args[first][0] == '-'); first++)
+     {
+          if (strcmp(args[first], "--") == 0)
+          {
+               first++;
+               break;
+          }
+          else if ((strcmp(args[first], "-g") == 0) || (strcmp(args[first], "--group") == 0))
+          {
+               group = 1;
+          }
+          else if (strncmp(args[first], "-j", 2) == 0)
+          {
+               const char *count = args[first] + 2;
+
+               if ((*count == '\0') && (args[first + 1] != NULL))
+               {
+                    count = args[++first];
+               }
+               max_tasks = (int)strtol(count, &end, 10);
+               if ((*count == '\0') || (*end != '\0') || (max_tasks < 0))
+               {
+                    printf("smallsh: parallel: %s: invalid number of jobs\n", count);
+                    max_tasks = -1;
+                    break;
+               }
+          }
+          else
+          {
+               break;
+          }
+     }
+
+     for (num_words = 0; (args[first + num_words] != NULL) && (strcmp(args[first + num_words], PARALLEL_SEPARATOR) != 0); num_words++)
+     {
+          //the command template ends at ":::"
+     }
+
+     if ((max_tasks < 0) || (num_words == 0) || (args[first][0] == '-'))
+     {
+          printf("usage: parallel [-j N] [-g] command [args] [::: inputs]\n");
+          max_tasks = -1;
+     }
+     else if (strstr(args[first], PARALLEL_PLACEHOLDER) == NULL)
+     {
+          path = smallsh_hash_lookup(args[first]);
+          if (path == NULL)
+          {
+               printf("smallsh: %s: command not found\n", args[first]);
+               max_tasks = -1;
+          }
+     }
+
+     if (max_tasks < 0)
+     {
+          return 1;
+     }
+
+     if (max_tasks == 0)
+     {
+          max_tasks = (int)sysconf(_SC_NPROCESSORS_ONLN);
+          if (max_tasks < 1)
+          {
+               max_tasks = 1;
+          }
+     }
+
+     source.args = NULL;
+     source.buffer = NULL;
+     if (args[first + num_words] != NULL)
+     {
+          source.args = &args[first + num_words + 1];
+     }
+     else
+     {
+          source.input_fd = 0;
+          source.size = PARALLEL_BUFSIZE;
+          source.buffer = malloc(source.size);
+          source.start = 0;
+          source.end = 0;
+          source.eof = 0;
+     }
+
+     slots = smallsh_arena_alloc(&command_arena, max_tasks * sizeof(parallel_slot));
+     waits = smallsh_arena_alloc(&command_arena, max_tasks * sizeof(struct pollfd));
+     command = smallsh_arena_alloc(&command_arena, (num_words + 2) * sizeof(char *));
+     for (i = 0; i < max_tasks; i++)
+     {
+          slots[i].pid = -1;
+          slots[i].pidfd = -1;
+          slots[i].output_fd = -1;
+     }
+
+     fflush(stdout);
+
+     while (1)
+     {
+          int num_waits = 0;
+          int timeout = -1;
+
+          /* Fill every free slot, a task that can't be started hands its slot to the next input */
+          for (i = 0; (i < max_tasks) && (stop == 0) && (running < max_tasks); i++)
+          {
+               while ((slots[i].pid == -1) && (stop == 0))
+               {
+                    spawn_request request;
+                    char **task_args;
+
+                    input = smallsh_parallel_next(&source);
+                    if (input == NULL)
+                    {
+                         stop = 1;
+                         continue;
+                    }
+
+                    task_args = smallsh_parallel_command(&args[first], num_words, input, command, &scratch, &scratch_size);
+
+                    request.path = (path != NULL) ? path : smallsh_hash_lookup(task_args[0]);
+                    request.args = task_args;
+                    request.stdin_fd = -1;
+                    request.stdout_fd = -1;
+                    request.stdin_null = 1; //stdin holds the inputs, tasks must not eat them
+                    request.redirects = NULL;
+                    request.num_redirects = 0;
+                    request.pgid = -1;
+                    request.place = command_placement; //"on ... parallel" places every task, "rr" spreads them over the CPUs
+                    request.cpu = ((command_placement != NULL) && (command_placement->round_robin == 1)) ? smallsh_placement_cpu(command_placement) : -1;
+                    request.group = command_group; //"limit ... parallel" runs every task in one cgroup
+                    request.builtin_jobs = NULL;
+
+                    if ((group == 1) && (slots[i].output_fd == -1))
+                    {
+                         slots[i].output_fd = memfd_create("smallsh-parallel", MFD_CLOEXEC);
+                    }
+                    if ((group == 1) && (slots[i].output_fd != -1))
+                    {
+                         request.stdout_fd = slots[i].output_fd;
+                    }
+
+                    if (request.path == NULL)
+                    {
+                         printf("smallsh: %s: command not found\n", task_args[0]);
+                         failed++;
+                         continue;
+                    }
+
+                    slots[i].stats = smallsh_stats_find(task_args[0]);
+                    clock_gettime(CLOCK_MONOTONIC, &slots[i].start_time);
+                    slots[i].pid = smallsh_spawn(&request);
+                    if (slots[i].pid < 0) //the engine has already printed the error
+                    {
+                         slots[i].pid = -1;
+                         failed++;
+                         continue;
+                    }
+
+                    if (event_loop.use_pidfd == 1)
+                    {
+                         slots[i].pidfd = smallsh_pidfd_open(slots[i].pid);
+                    }
+                    running++;
+               }
+          }
+
+          if ((stop == 1) && (running == 0))
+          {
+               break;
+          }
+
+          /* Wait for a task to exit: its pidfd, or SIGCHLD on kernels without pidfds */
+          if (event_loop.use_pidfd == 1)
+          {
+               for (i = 0; i < max_tasks; i++)
+               {
+                    if (slots[i].pid == -1)
+                    {
+                         continue;
+                    }
+                    if (slots[i].pidfd == -1)
+                    {
+                         timeout = 10; //out of descriptors, this one is polled with wait4()
+                         continue;
+                    }
+                    waits[num_waits].fd = slots[i].pidfd;
+                    waits[num_waits].events = POLLIN;
+                    num_waits++;
+               }
+          }
+          else
+          {
+               waits[0].fd = event_loop.signal_fd;
+               waits[0].events = POLLIN;
+               num_waits = 1;
+          }
+
+          if (poll(waits, num_waits, timeout) < 0)
+          {
+               continue;
+          }
+
+          if (event_loop.use_pidfd == 0)
+          {
+               struct signalfd_siginfo info;
+
+               while (read(event_loop.signal_fd, &info, sizeof(info)) == sizeof(info))
+               {
+                    //drain, every task is checked below
+               }
+          }
+
+          /* Reap whatever finished, their slots are refilled at the top of the loop */
+          for (i = 0; i < max_tasks; i++)
+          {
+               struct rusage usage;
+               int status;
+
+               if ((slots[i].pid == -1) || (wait4(slots[i].pid, &status, WNOHANG, &usage) != slots[i].pid))
+               {
+                    continue;
+               }
+
+               smallsh_stats_record(slots[i].stats, &slots[i].start_time, &usage);
+
+               if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+               {
+                    failed++;
+               }
+               if (WIFSIGNALED(status) && (WTERMSIG(status) == SIGINT))
+               {
+                    stop = 1;
+               }
+
+               if (slots[i].output_fd != -1)
+               {
+                    smallsh_parallel_flush(slots[i].output_fd, 1);
+               }
+               if (slots[i].pidfd != -1)
+               {
+                    close(slots[i].pidfd);
+                    slots[i].pidfd = -1;
+               }
+               slots[i].pid = -1;
+               running--;
+          }
+     }
+
+     for (i = 0; i < max_tasks; i++)
+     {
+          if (slots[i].output_fd != -1)
+          {
+               close(slots[i].output_fd);
+          }
+     }
+     free(source.buffer);
+     free(scratch);
+
+     //the SIGCHLDs drained above may have been for background jobs too
+     if (event_loop.use_pidfd == 0)
+     {
+          smallsh_bg_scan(jobs, 0);
+     }
+
+     return (failed > PARALLEL_MAX_FAILED) ? PARALLEL_MAX_FAILED : failed;
+}
+
+/**********************************************************************
+** Function: smallsh_parallel_next(parallel_source *source)
+** Description: returns the next input for "parallel": the next
+**              argument after ":::", or the next non-empty line read
+**              from the input descriptor. NULL when there are none.
+**              A line stays valid until the next call.
+** Parameters: the input source
+**********************************************************************/
+char *smallsh_parallel_next(parallel_source *source)
+{
+     if (source->args != NULL)
+     {
+          if (*source->args == NULL)
+          {
+               return NULL;
+          }
+          return *(source->args++);
+     }
+
+     while (1)
+     {
+          char *line = source->buffer + source->start;
+          char *newline = memchr(line, '\n', source->end - source->start);
+          ssize_t bytes_read;
+
+          if ((newline != NULL) || ((source->eof == 1) && (source->start < source->end)))
+          {
+               if (newline == NULL) //last line without a newline, there is always room after it
+               {
+                    newline = source->buffer + source->end;
+               }
+               *newline = '\0';
+               source->start = (newline - source->buffer) + 1;
+               if (source->start > source->end)
+               {
+                    source->start = source->end;
+               }
+
+               if (line[0] == '\0')
+               {
+                    continue; //blank lines are skipped like xargs does
+               }
+               return line;
+          }
+
+          if (source->eof == 1)
+          {
+               return NULL;
+          }
+
+          //keep the partial line and make room after it
+          memmove(source->buffer, line, source->end - source->start);
+          source->end -= source->start;
+          source->start = 0;
+          if (source->end + 1 >= source->size)
+          {
+               source->size *= 2;
+               source->buffer = realloc(source->buffer, source->size);
+          }
+
+          bytes_read = read(source->input_fd, source->buffer + source->end, source->size - source->end - 1);
+          if (bytes_read > 0)
+          {
+               source->end += bytes_read;
+          }
+          else if ((bytes_read == 0) || (errno != EINTR))
+          {
+               source->eof = 1;
+          }
+     }
+}
+
+/**********************************************************************
+** Function: smallsh_parallel_command(char **command, int num_words,
+**                                    const char *input, char **task_args,
+**                                    char **scratch, size_t *scratch_size)
+** Description: fills task_args (num_words + 2 entries) with the
+**              arguments of one "parallel" task: the command words with
+**              each "{}" replaced by input, or with input appended if
+**              none of them has one. Replaced words are built in the
+**              scratch buffer, which grows as needed. Returns task_args.
+** Parameters: the command words, how many, the input, the array to
+**             fill and the scratch buffer with its size
+**********************************************************************/
+char **smallsh_parallel_command(char **command, int num_words, const char *input, char **task_args, char **scratch, size_t *scratch_size)
+{
+     size_t input_length = strlen(input);
+     size_t needed = 0;
+     size_t used = 0;
+     int replaced = 0;
+     int i;
+
+     //room for every word that has a placeholder once it is filled in
+     for (i = 0; i < num_words; i++)
+     {
+          const char *found = strstr(command[i], PARALLEL_PLACEHOLDER);
+
+          if (found != NULL)
+          {
+               needed += strlen(command[i]) + 1;
+               for (; found != NULL; found = strstr(found + 2, PARALLEL_PLACEHOLDER))
+               {
+                    needed += input_length;
+               }
+          }
+     }
+
+     if (needed > *scratch_size)
+     {
+          *scratch_size = needed * 2;
+          *scratch = realloc(*scratch, *scratch_size);
+     }
+
+     for (i = 0; i < num_words; i++)
+     {
+          const char *word = command[i];
+          const char *found = strstr(word, PARALLEL_PLACEHOLDER);
+
+          if (found == NULL)
+          {
+               task_args[i] = command[i];
+               continue;
+          }
+
+          task_args[i] = *scratch + used;
+          for (; found != NULL; found = strstr(word, PARALLEL_PLACEHOLDER))
+          {
+               memcpy(*scratch + used, word, found - word);
+               used += found - word;
+               memcpy(*scratch + used, input, input_length);
+               used += input_length;
+               word = found + 2;
+          }
+          strcpy(*scratch + used, word);
+          used += strlen(word) + 1;
+          replaced = 1;
+     }
+
+     if (replaced == 0)
+     {
+          task_args[i++] = (char *)input;
+     }
+     task_args[i] = NULL;
+
+     return task_args;
+}
+
+/**********************************************************************
+** Function: smallsh_parallel_flush(int output_fd, int target_fd)
+** Description: copies the output a "parallel -g" task left in its
+**              memfd to target_fd in one piece with sendfile(), then
+**              empties the memfd so the slot's next task can reuse it
+** Parameters: the task's memfd and where its output goes
+**********************************************************************/
+void smallsh_parallel_flush(int output_fd, int target_fd)
+{
+     off_t size = lseek(output_fd, 0, SEEK_CUR); //the task's writes moved the shared offset to the end
+     off_t offset = 0;
+
+     while (offset < size)
+     {
+          ssize_t sent = sendfile(target_fd, output_fd, &offset, size - offset);
+
+          if ((sent < 0) && (errno == EINVAL)) //a terminal, for example, can't take sendfile()
+          {
+               char buffer[PUMP_BUFSIZE];
+
+               sent = pread(output_fd, buffer, sizeof(buffer), offset);
+               if ((sent > 0) && (smallsh_write_all(target_fd, buffer, sent) == 0))
+               {
+                    offset += sent;
+                    continue;
+               }
+          }
+          else if ((sent < 0) && (errno == EAGAIN))
+          {
+               struct pollfd wait_fd = { target_fd, POLLOUT, 0 };
+               poll(&wait_fd, 1, -1);
+               continue;
+          }
+
+          if (sent <= 0)
+          {
+               break;
+          }
+     }
+
+     if (ftruncate(output_fd, 0) == -1)
+     {
+          printf("smallsh: parallel: cannot clear task output: %s\n", strerror(errno));
+     }
+     lseek(output_fd, 0, SEEK_SET);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_bg_status_check(job_table *jobs)
+** Description: Reports background jobs that completed since the event loop last ran, without blocking
+** Parameters: pointer to the job table
+********************************************************************************************************/
+void smallsh_bg_status_check(job_table *jobs)
+{
+     while (smallsh_events_wait(jobs, 0) & EVENTS_REPORTED)
+     {
+          //keep going while there were more finished jobs than one epoll batch
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_reap(job_table *jobs, job *finished, int bg_status, struct rusage *usage)
+** Description: records the run time and resource usage of a reaped background job, prints its exit
+**              status or terminating signal and removes it from the job table
+** Parameters: pointer to the job table, the job and the status and rusage returned by wait4()
+********************************************************************************************************/
+void smallsh_job_reap(job_table *jobs, job *finished, int bg_status, struct rusage *usage)
+{
+     int timed_out = (finished->limit.state >= DEADLINE_TERM);
+
+     if (finished->pid == wait_pid)
+     {
+          wait_status = timed_out ? TIMED_OUT_STATUS : (WIFEXITED(bg_status) ? WEXITSTATUS(bg_status) : 128 + WTERMSIG(bg_status));
+     }
+
+     if (finished->stats != NULL)
+     {
+          smallsh_stats_record(finished->stats, &finished->start_time, usage);
+     }
+
+     if (finished->job_id == 0) //pipeline stage, its pipeline is reported through its last stage
+     {
+          smallsh_job_remove(jobs, finished);
+          return;
+     }
+
+     printf("Background pid %d is done: %s", finished->pid, timed_out ? "timed out, " : "");
+
+     if (WIFEXITED(bg_status)) //normal exit
+     {
+          printf("Exited value: %d\n", WEXITSTATUS(bg_status));
+     }
+     else if (WIFSIGNALED(bg_status) != 0) //it got terminated
+     {
+          printf("terminated by signal %d\n", WTERMSIG(bg_status));
+     }
+     fflush(stdout);
+
+     smallsh_job_remove(jobs, finished);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_events_init()
+** Description: sets up the event loop that read_line() waits in. stdin is watched with epoll along with
+**              a pidfd for every background job, so a job is reaped and reported as soon as it exits.
+**              Kernels without pidfd_open() fall back to a signalfd for SIGCHLD, which is blocked so it
+**              is only delivered through the signalfd. The descriptor soft limit is raised to the hard one.
+** Parameters: none
+********************************************************************************************************/
+void smallsh_events_init()
+{
+     struct epoll_event event;
+     struct rlimit files;
+     int pidfd;
+
+     //every background job holds a pidfd, so take all the descriptors the hard limit allows
+     if ((getrlimit(RLIMIT_NOFILE, &files) == 0) && (files.rlim_cur < files.rlim_max))
+     {
+          files.rlim_cur = files.rlim_max;
+          setrlimit(RLIMIT_NOFILE, &files);
+     }
+
+     event_loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+     event_loop.unwatched = 0;
+
+     //regular files (input redirected from a script) can't be polled, they are always readable
+     event.events = EPOLLIN;
+     event.data.u64 = EVENT_STDIN;
+     event_loop.stdin_watched = (epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, 0, &event) == 0);
+
+     pidfd = smallsh_pidfd_open(getpid());
+     if (pidfd >= 0)
+     {
+          close(pidfd);
+          event_loop.use_pidfd = 1;
+          event_loop.signal_fd = -1;
+     }
+     else
+     {
+          sigset_t mask;
+
+          sigemptyset(&mask);
+          sigaddset(&mask, SIGCHLD);
+          sigprocmask(SIG_BLOCK, &mask, NULL);
+
+          event_loop.use_pidfd = 0;
+          event_loop.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+          event.events = EPOLLIN;
+          event.data.u64 = EVENT_SIGCHLD;
+          epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, event_loop.signal_fd, &event);
+     }
+
+     event_loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+     event_loop.timer_at = 0;
+     event.events = EPOLLIN;
+     event.data.u64 = EVENT_TIMER;
+     epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, event_loop.timer_fd, &event);
+
+     //commands piped in from a generator are read in large chunks
+     event_loop.input_size = isatty(0) ? INPUT_BUFSIZE : BATCH_BUFSIZE;
+     event_loop.input = malloc(event_loop.input_size);
+     event_loop.input_fd = 0;
+     event_loop.input_start = 0;
+     event_loop.input_end = 0;
+     event_loop.input_eof = 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_input_string(char *commands)
+** Description: makes read_line() return the lines of a string (-c) instead of reading stdin
+** Parameters: the commands
+********************************************************************************************************/
+void smallsh_input_string(char *commands)
+{
+     free(event_loop.input);
+
+     event_loop.input_end = strlen(commands);
+     event_loop.input_size = event_loop.input_end + 1;
+     event_loop.input = malloc(event_loop.input_size);
+     memcpy(event_loop.input, commands, event_loop.input_end);
+     event_loop.input_start = 0;
+     event_loop.input_eof = 1; //nothing more will be read
+}
+
+/*******************************************************************************************************
+** Function: smallsh_input_file(const char *filename)
+** Description: makes read_line() return the lines of a script file instead of reading stdin. The file
+**              is mapped privately so lines are split in place without being read or copied.
+**              Returns -1 if the file can't be opened.
+** Parameters: the script filename
+********************************************************************************************************/
+int smallsh_input_file(const char *filename)
+{
+     struct stat file_info;
+     char *mapping;
+     int fd;
+
+     fd = open(filename, O_RDONLY | O_CLOEXEC);
+     if ((fd == -1) || (fstat(fd, &file_info) == -1))
+     {
+          if (fd != -1)
+          {
+               close(fd);
+          }
+          return -1;
+     }
+
+     free(event_loop.input);
+     event_loop.input = NULL;
+     event_loop.input_size = 0;
+
+     if (file_info.st_size > 0)
+     {
+          mapping = mmap(NULL, file_info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+          if (mapping != MAP_FAILED)
+          {
+               madvise(mapping, file_info.st_size, MADV_SEQUENTIAL);
+               event_loop.input = mapping;
+               event_loop.input_size = file_info.st_size;
+          }
+     }
+
+     event_loop.input_start = 0;
+
+     if (event_loop.input != NULL)
+     {
+          close(fd);
+          event_loop.input_end = event_loop.input_size;
+          event_loop.input_eof = 1; //nothing more will be read
+          return 0;
+     }
+
+     //empty file, or one that can't be mapped (a fifo for example): stream it through the buffer like stdin
+     event_loop.input_size = BATCH_BUFSIZE;
+     event_loop.input = malloc(event_loop.input_size);
+     event_loop.input_end = 0;
+     event_loop.input_fd = fd;
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_serve(const char *path, int num_workers)
+** Description: server mode. Binds a unix socket at path (a socket left there by an earlier server is
+**              replaced), forks num_workers workers and then only waits for signals: a worker that dies
+**              is replaced, SIGTERM or SIGINT stops the workers, removes the socket and returns.
+**              Returns the exit status for main().
+** Parameters: the socket path and the size of the worker pool
+********************************************************************************************************/
+int smallsh_serve(const char *path, int num_workers)
+{
+     struct sockaddr_un address;
+     struct stat file_info;
+     sigset_t signals;
+     sigset_t worker_mask;
+     siginfo_t info;
+     pid_t *workers;
+     int listen_fd;
+     int i;
+
+     if (strlen(path) >= sizeof(address.sun_path))
+     {
+          printf("smallsh: --serve: socket path too long: %s\n", path);
+          return 1;
+     }
+
+     memset(&address, 0, sizeof(address));
+     address.sun_family = AF_UNIX;
+     strcpy(address.sun_path, path);
+
+     if ((lstat(path, &file_info) == 0) && S_ISSOCK(file_info.st_mode))
+     {
+          unlink(path);
+     }
+
+     listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+     if ((listen_fd == -1) || (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+         || (listen(listen_fd, SERVE_BACKLOG) == -1))
+     {
+          printf("smallsh: --serve: %s: %s\n", path, strerror(errno));
+          return 1;
+     }
+
+     //blocked here so sigwaitinfo() gets them, the workers go back to the mask from before
+     sigemptyset(&signals);
+     sigaddset(&signals, SIGCHLD);
+     sigaddset(&signals, SIGTERM);
+     sigaddset(&signals, SIGINT);
+     sigprocmask(SIG_BLOCK, &signals, &worker_mask);
+
+     workers = malloc(num_workers * sizeof(pid_t));
+     for (i = 0; i < num_workers; i++)
+     {
+          workers[i] = smallsh_serve_fork(listen_fd, &worker_mask);
+     }
+
+     printf("smallsh: serving on %s with %d workers\n", path, num_workers);
+     fflush(stdout);
+
+     while ((sigwaitinfo(&signals, &info) == -1) || (info.si_signo == SIGCHLD))
+     {
+          pid_t pid;
+
+          while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+          {
+               for (i = 0; i < num_workers; i++)
+               {
+                    if (workers[i] == pid)
+                    {
+                         workers[i] = -1;
+                    }
+               }
+          }
+
+          for (i = 0; i < num_workers; i++)
+          {
+               if (workers[i] == -1)
+               {
+                    workers[i] = smallsh_serve_fork(listen_fd, &worker_mask);
+               }
+          }
+     }
+
+     for (i = 0; i < num_workers; i++)
+     {
+          if (workers[i] > 0)
+          {
+               kill(workers[i], SIGTERM);
+          }
+     }
+     for (i = 0; i < num_workers; i++)
+     {
+          if (workers[i] > 0)
+          {
+               waitpid(workers[i], NULL, 0);
+          }
+     }
+
+     close(listen_fd);
+     unlink(path);
+     free(workers);
+
+     return 0;
+}
+
+/**********************************************************************
+** Function: smallsh_serve_fork(int listen_fd, sigset_t *worker_mask)
+** Description: forks a worker and returns its pid (-1 if fork()
+**              failed, the slot is tried again at the next SIGCHLD)
+** Parameters: the listening socket and the signal mask for the worker
+**********************************************************************/
+pid_t smallsh_serve_fork(int listen_fd, sigset_t *worker_mask)
+{
+     pid_t pid = fork();
+
+     if (pid == 0)
+     {
+          sigprocmask(SIG_SETMASK, worker_mask, NULL);
+          smallsh_serve_worker(listen_fd);
+     }
+
+     return pid;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_serve_worker(int listen_fd)
+** Description: a worker's loop, it never returns. Everything a request needs is set up once here:
+**              the event loop, the job table, the arenas (warmed by the first request and then reused)
+**              and the path hash. Requests read /dev/null. The listening socket is only watched while a
+**              client slot is free. Requests run one at a time, so a long command holds up the other
+**              clients of this worker but not the other workers.
+** Parameters: the listening socket
+********************************************************************************************************/
+void smallsh_serve_worker(int listen_fd)
+{
+     struct epoll_event event;
+     struct epoll_event events[EVENT_BATCH];
+     serve_client *clients = malloc(SERVE_CONNECTIONS * sizeof(serve_client));
+     int *free_slots = malloc(SERVE_CONNECTIONS * sizeof(int));
+     int num_free = SERVE_CONNECTIONS;
+     int accepting = 1;
+     job_table jobs;
+     int serve_fd;
+     int null_fd;
+     int i;
+
+     prctl(PR_SET_PDEATHSIG, SIGTERM); //a worker doesn't outlive the server
+
+     null_fd = open("/dev/null", O_RDONLY);
+     dup2(null_fd, 0);
+     close(null_fd);
+
+     serve_stdout = fcntl(1, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+     serve_stderr = fcntl(2, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+     serve_home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+     interactive = 0;
+     smallsh_events_init();
+     smallsh_input_string(""); //a block can't ask for more lines
+     smallsh_job_table_init(&jobs);
+
+     for (i = 0; i < SERVE_CONNECTIONS; i++)
+     {
+          clients[i].fd = -1;
+          free_slots[i] = SERVE_CONNECTIONS - 1 - i;
+     }
+
+     serve_fd = epoll_create1(EPOLL_CLOEXEC);
+
+     event.events = EPOLLIN | EPOLLEXCLUSIVE;
+     event.data.u64 = SERVE_LISTEN;
+     epoll_ctl(serve_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+     //background jobs started by requests are reaped through the shell's own event loop
+     event.events = EPOLLIN;
+     event.data.u64 = SERVE_JOBS;
+     epoll_ctl(serve_fd, EPOLL_CTL_ADD, event_loop.epoll_fd, &event);
+
+     while (1)
+     {
+          int num_events = epoll_wait(serve_fd, events, EVENT_BATCH, -1);
+
+          for (i = 0; i < num_events; i++)
+          {
+               uint64_t data = events[i].data.u64;
+
+               if (data == SERVE_JOBS)
+               {
+                    smallsh_events_wait(&jobs, 0);
+                    fflush(stdout);
+               }
+               else if (data == SERVE_LISTEN)
+               {
+                    while (num_free > 0)
+                    {
+                         int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                         int slot;
+
+                         if (client_fd == -1)
+                         {
+                              break; //taken by another worker, or nothing left
+                         }
+
+                         slot = free_slots[--num_free];
+                         clients[slot].fd = client_fd;
+                         clients[slot].used = 0;
+
+                         event.events = EPOLLIN;
+                         event.data.u64 = slot;
+                         epoll_ctl(serve_fd, EPOLL_CTL_ADD, client_fd, &event);
+                    }
+
+                    //full: new clients wait in the backlog for this worker or another one
+                    if (num_free == 0)
+                    {
+                         epoll_ctl(serve_fd, EPOLL_CTL_DEL, listen_fd, NULL);
+                         accepting = 0;
+                    }
+               }
+               else
+               {
+                    serve_client *client = &clients[data];
+                    char *newline;
+                    ssize_t bytes;
+
+                    //MSG_DONTWAIT: the slot may have been given to a new client since this batch was returned
+                    if (client->fd == -1)
+                    {
+                         continue;
+                    }
+                    bytes = recv(client->fd, client->line + client->used, sizeof(client->line) - client->used - 1, MSG_DONTWAIT);
+                    if ((bytes == -1) && ((errno == EAGAIN) || (errno == EINTR)))
+                    {
+                         continue;
+                    }
+
+                    if (bytes > 0)
+                    {
+                         client->used += bytes;
+                         newline = memchr(client->line, '\n', client->used);
+                         if ((newline == NULL) && (client->used < (int)sizeof(client->line) - 1))
+                         {
+                              continue; //the rest of the line is still on its way
+                         }
+
+                         if (newline != NULL)
+                         {
+                              *newline = '\0';
+                         }
+                         epoll_ctl(serve_fd, EPOLL_CTL_DEL, client->fd, NULL);
+                         smallsh_serve_request(client->fd, (newline != NULL) ? client->line : NULL, &jobs);
+                    }
+
+                    //served, or gone before sending a whole line
+                    close(client->fd);
+                    client->fd = -1;
+                    free_slots[num_free++] = (int)data;
+
+                    if (accepting == 0)
+                    {
+                         event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                         event.data.u64 = SERVE_LISTEN;
+                         epoll_ctl(serve_fd, EPOLL_CTL_ADD, listen_fd, &event);
+                         accepting = 1;
+                    }
+               }
+          }
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_serve_request(int client_fd, char *line, job_table *jobs)
+** Description: runs one request line with stdout and stderr on the client, the same way the main loop
+**              runs a line, then writes the trailer: the exit status, the signal that ended the command
+**              (0 if none), the wall clock time and the CPU time and peak resident set of the children it
+**              waited for plus the worker's own CPU time, like "time". Every request starts in the
+**              directory the server was started in, with a status of 0.
+** Parameters: the client socket, the line (NULL if it didn't fit in the buffer) and the job table
+********************************************************************************************************/
+void smallsh_serve_request(int client_fd, char *line, job_table *jobs)
+{
+     struct timespec start_time, end_time;
+     struct rusage self_start, self_end;
+     char trailer[256];
+     long long user_usec, sys_usec, real_usec;
+     int exit_status = 0;
+     int signal_flag = 0;
+     int terminating_signal = 0;
+     int length;
+
+     fflush(stdout);
+     dup2(client_fd, 1);
+     dup2(client_fd, 2);
+
+     memset(&foreground_usage, 0, sizeof(foreground_usage));
+     getrusage(RUSAGE_SELF, &self_start);
+     clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+     if (line == NULL)
+     {
+          printf("smallsh: request longer than %d bytes\n", MAX_LENGTH - 1);
+          exit_status = 2;
+     }
+     else
+     {
+          char **args;
+          int num_args;
+
+          smallsh_arena_reset(&command_arena);
+          smallsh_bg_status_check(jobs);
+          args = parse_line(line, &num_args);
+          smallsh_run_line(args, num_args, &exit_status, &signal_flag, &terminating_signal, jobs);
+     }
+     fflush(stdout);
+
+     getrusage(RUSAGE_SELF, &self_end);
+     clock_gettime(CLOCK_MONOTONIC, &end_time);
+     real_usec = ((end_time.tv_sec - start_time.tv_sec) * 1000000LL) + ((end_time.tv_nsec - start_time.tv_nsec) / 1000);
+     user_usec = (foreground_usage.ru_utime.tv_sec + self_end.ru_utime.tv_sec - self_start.ru_utime.tv_sec) * 1000000LL
+               + (foreground_usage.ru_utime.tv_usec + self_end.ru_utime.tv_usec - self_start.ru_utime.tv_usec);
+     sys_usec = (foreground_usage.ru_stime.tv_sec + self_end.ru_stime.tv_sec - self_start.ru_stime.tv_sec) * 1000000LL
+              + (foreground_usage.ru_stime.tv_usec + self_end.ru_stime.tv_usec - self_start.ru_stime.tv_usec);
+
+     length = snprintf(trailer, sizeof(trailer), "%cstatus=%d signal=%d timed_out=%d real_us=%lld user_us=%lld sys_us=%lld maxrss_kb=%ld\n",
+                       '\0', exit_status, (signal_flag != 0) ? terminating_signal : 0, (signal_flag == 2), real_usec, user_usec, sys_usec,
+                       foreground_usage.ru_maxrss);
+     smallsh_write_all(1, trailer, length);
+
+     dup2(serve_stdout, 1);
+     dup2(serve_stderr, 2);
+     if (fchdir(serve_home) == -1)
+     {
+          printf("smallsh: --serve: can't go back to the starting directory\n");
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_pidfd_open(pid_t pid)
+** Description: returns a close-on-exec pidfd that becomes readable when pid exits, or -1
+** Parameters: the process id
+********************************************************************************************************/
+int smallsh_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+     return syscall(SYS_pidfd_open, pid, 0);
+#else
+     errno = ENOSYS;
+     return -1;
+#endif
+}
+
+/*******************************************************************************************************
+** Function: smallsh_events_watch(job *new_job)
+** Description: adds a pidfd for a new background job to the event loop. A job that can't get one
+**              (out of descriptors) is counted in event_loop.unwatched and polled with wait4() instead.
+** Parameters: the job that was just inserted into the job table
+********************************************************************************************************/
+void smallsh_events_watch(job *new_job)
+{
+     struct epoll_event event;
+
+     if (event_loop.use_pidfd == 0)
+     {
+          return; //the SIGCHLD signalfd covers every job
+     }
+
+     new_job->pidfd = smallsh_pidfd_open(new_job->pid);
+     if (new_job->pidfd >= 0)
+     {
+          event.events = EPOLLIN;
+          event.data.u64 = (uint64_t)new_job->pid;
+          epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, new_job->pidfd, &event);
+     }
+     else
+     {
+          event_loop.unwatched++;
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_events_wait(job_table *jobs, int timeout)
+** Description: waits up to timeout milliseconds (-1 forever, 0 just checks) for stdin or background
+**              jobs. Jobs that exited are reaped and reported right away and captured output is drained.
+**              While some job has no pidfd the wait is cut to EVENT_POLL_MS to check those with wait4().
+**              Returns EVENTS_STDIN if stdin is ready to read, EVENTS_REPORTED if any job was reported
+**              and EVENTS_FOREGROUND once the foreground child being waited for has exited.
+** Parameters: pointer to the job table and the timeout
+********************************************************************************************************/
+int smallsh_events_wait(job_table *jobs, int timeout)
+{
+     struct epoll_event events[EVENT_BATCH];
+     int result = 0;
+     int num_events;
+     int i;
+
+     if ((event_loop.stdin_watched == 0) && (event_loop.jobs_only == 0))
+     {
+          result |= EVENTS_STDIN;
+          timeout = 0; //never block on jobs when stdin can always be read
+     }
+     if ((event_loop.unwatched > 0) && ((timeout < 0) || (timeout > EVENT_POLL_MS)))
+     {
+          timeout = EVENT_POLL_MS;
+     }
+
+     num_events = epoll_wait(event_loop.epoll_fd, events, EVENT_BATCH, timeout);
+
+     for (i = 0; i < num_events; i++)
+     {
+          if (events[i].data.u64 == EVENT_STDIN)
+          {
+               result |= EVENTS_STDIN;
+          }
+          else if (events[i].data.u64 == EVENT_FOREGROUND)
+          {
+               result |= EVENTS_FOREGROUND;
+          }
+          else if (events[i].data.u64 == EVENT_TIMER)
+          {
+               uint64_t expirations;
+
+               if (read(event_loop.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+               {
+                    smallsh_deadline_check(jobs);
+               }
+          }
+          else if (events[i].data.u64 == EVENT_SIGCHLD)
+          {
+               struct signalfd_siginfo info;
+
+               while (read(event_loop.signal_fd, &info, sizeof(info)) == sizeof(info))
+               {
+                    //drain, several SIGCHLDs can be merged into one so every running job is checked below
+               }
+
+               if (smallsh_bg_scan(jobs, 0) > 0)
+               {
+                    result |= EVENTS_REPORTED;
+               }
+          }
+          else if (events[i].data.u64 & EVENT_OUTPUT)
+          {
+               smallsh_capture_drain(capture.by_fd[events[i].data.u64 & ~EVENT_OUTPUT]);
+          }
+          else
+          {
+               pid_t pid = (pid_t)events[i].data.u64;
+               job *finished = smallsh_job_find(jobs, pid);
+               struct rusage usage;
+               int bg_status;
+
+               if ((finished != NULL) && (wait4(pid, &bg_status, WNOHANG, &usage) == pid))
+               {
+                    smallsh_job_reap(jobs, finished, bg_status, &usage);
+                    result |= EVENTS_REPORTED;
+               }
+          }
+     }
+
+     if ((event_loop.unwatched > 0) && (smallsh_bg_scan(jobs, 1) > 0))
+     {
+          result |= EVENTS_REPORTED;
+     }
+
+     return result;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_bg_scan(job_table *jobs, int unwatched)
+** Description: signalfd fallback: checks each running job with wait4(WNOHANG), or with unwatched set
+**              only the jobs that got no pidfd. Only pids in the job table are waited for, so foreground
+**              children are never reaped by accident. Returns the number of jobs reported.
+** Parameters: pointer to the job table and 1 to only check jobs without a pidfd
+********************************************************************************************************/
+int smallsh_bg_scan(job_table *jobs, int unwatched)
+{
+     struct rusage usage;
+     int reported = 0;
+     int bg_status;
+     int i;
+
+     for (i = 0; i < jobs->num_slots; i++)
+     {
+          if ((jobs->slots[i].state != JOB_RUNNING) || (unwatched && (jobs->slots[i].pidfd != -1)))
+          {
+               continue;
+          }
+          if (wait4(jobs->slots[i].pid, &bg_status, WNOHANG, &usage) == jobs->slots[i].pid)
+          {
+               smallsh_job_reap(jobs, &jobs->slots[i], bg_status, &usage);
+               reported++;
+          }
+     }
+
+     return reported;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_events_jobs_only(int on)
+** Description: takes stdin out of the event loop (on == 1) so smallsh_events_wait() only returns for
+**              jobs, captured output and the foreground pidfd, or puts it back (on == 0)
+** Parameters: 1 to take stdin out, 0 to put it back
+********************************************************************************************************/
+void smallsh_events_jobs_only(int on)
+{
+     struct epoll_event event;
+
+     event_loop.jobs_only = on;
+     if (event_loop.stdin_watched == 0)
+     {
+          return;
+     }
+
+     if (on == 1)
+     {
+          epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, 0, NULL);
+     }
+     else
+     {
+          event.events = EPOLLIN;
+          event.data.u64 = EVENT_STDIN;
+          epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, 0, &event);
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_events_foreground(pid_t pid, job_table *jobs)
+** Description: waits in the event loop until a foreground child exits, so capture pipes keep being
+**              drained, background jobs never block on a full pipe and deadlines go off while the shell
+**              waits. The child is left for wait4() to reap. Without pidfds every SIGCHLD wakes the loop
+**              and the child is checked with waitid(WNOWAIT).
+** Parameters: the foreground child's pid and the job table
+********************************************************************************************************/
+void smallsh_events_foreground(pid_t pid, job_table *jobs)
+{
+     struct epoll_event event;
+     siginfo_t info;
+     int pidfd = -1;
+
+     if (event_loop.use_pidfd == 1)
+     {
+          pidfd = smallsh_pidfd_open(pid);
+          if (pidfd == -1)
+          {
+               return;
+          }
+          event.events = EPOLLIN;
+          event.data.u64 = EVENT_FOREGROUND;
+          epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, pidfd, &event);
+     }
+     smallsh_events_jobs_only(1);
+
+     while (1)
+     {
+          info.si_pid = 0;
+          if ((pidfd == -1) && (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0) && (info.si_pid == pid))
+          {
+               break;
+          }
+          if (smallsh_events_wait(jobs, -1) & EVENTS_FOREGROUND)
+          {
+               break;
+          }
+          fflush(stdout); //background reports made meanwhile
+     }
+
+     smallsh_events_jobs_only(0);
+     if (pidfd != -1)
+     {
+          close(pidfd);
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_deadline_start(deadline *limit, long long timeout, long long grace)
+** Description: starts a deadline timeout microseconds from now and arms the timer for it
+** Parameters: the deadline, the timeout and the grace period between SIGTERM and SIGKILL
+********************************************************************************************************/
+void smallsh_deadline_start(deadline *limit, long long timeout, long long grace)
+{
+     limit->state = DEADLINE_RUNNING;
+     limit->at = smallsh_usec_now() + timeout;
+     limit->grace = grace;
+     smallsh_deadline_arm(limit->at);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_deadline_step(deadline *limit, long long now)
+** Description: moves a deadline that is due on to its next step and returns the signal that goes with
+**              it: SIGTERM at the deadline, SIGKILL a grace period later. Returns 0 if it isn't due.
+** Parameters: the deadline and the CLOCK_MONOTONIC time in microseconds
+********************************************************************************************************/
+int smallsh_deadline_step(deadline *limit, long long now)
+{
+     if ((limit->state == DEADLINE_RUNNING) && (now >= limit->at))
+     {
+          limit->state = DEADLINE_TERM;
+          limit->at = now + limit->grace;
+          return SIGTERM;
+     }
+     if ((limit->state == DEADLINE_TERM) && (now >= limit->at))
+     {
+          limit->state = DEADLINE_KILL;
+          return SIGKILL;
+     }
+
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_deadline_foreground()
+** Description: signals every stage of the foreground command that isn't reaped yet once its deadline
+**              is due. Returns the milliseconds until its next step, for poll(), or -1 if it has none.
+** Parameters: none
+********************************************************************************************************/
+int smallsh_deadline_foreground()
+{
+     long long now;
+     int signal_number;
+     int i;
+
+     if ((foreground_wait.limit.state != DEADLINE_RUNNING) && (foreground_wait.limit.state != DEADLINE_TERM))
+     {
+          return -1;
+     }
+
+     now = smallsh_usec_now();
+     signal_number = smallsh_deadline_step(&foreground_wait.limit, now);
+     for (i = foreground_wait.first; (signal_number != 0) && (i < foreground_wait.total); i++)
+     {
+          if (foreground_wait.stages[i].pid > 0)
+          {
+               kill(foreground_wait.stages[i].pid, signal_number);
+          }
+     }
+
+     if (foreground_wait.limit.state == DEADLINE_KILL)
+     {
+          return -1;
+     }
+     return (int)((foreground_wait.limit.at - now + 999) / 1000);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_deadline_check(job_table *jobs)
+** Description: the deadline timer went off: signals the foreground command and the process group of
+**              every background job whose deadline is due, then arms the timer for the next one
+** Parameters: pointer to the job table
+********************************************************************************************************/
+void smallsh_deadline_check(job_table *jobs)
+{
+     long long now = smallsh_usec_now();
+     int i;
+
+     event_loop.timer_at = 0;
+
+     if (smallsh_deadline_foreground() != -1)
+     {
+          smallsh_deadline_arm(foreground_wait.limit.at);
+     }
+
+     for (i = 0; i < jobs->num_slots; i++)
+     {
+          job *current = &jobs->slots[i];
+          int signal_number;
+
+          if ((current->state != JOB_RUNNING) || ((current->limit.state != DEADLINE_RUNNING) && (current->limit.state != DEADLINE_TERM)))
+          {
+               continue;
+          }
+
+          signal_number = smallsh_deadline_step(&current->limit, now);
+          if (signal_number != 0)
+          {
+               killpg(current->pgid, signal_number);
+          }
+          if (current->limit.state != DEADLINE_KILL)
+          {
+               smallsh_deadline_arm(current->limit.at);
+          }
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_deadline_arm(long long at)
+** Description: sets the deadline timer to go off at at, unless it is already set for earlier. A timer
+**              left set for a command that has finished just finds nothing due.
+** Parameters: the CLOCK_MONOTONIC time in microseconds
+********************************************************************************************************/
+void smallsh_deadline_arm(long long at)
+{
+     struct itimerspec when;
+
+     if ((event_loop.timer_at != 0) && (event_loop.timer_at <= at))
+     {
+          return;
+     }
+
+     event_loop.timer_at = at;
+     memset(&when, 0, sizeof(when));
+     when.it_value.tv_sec = at / 1000000;
+     when.it_value.tv_nsec = (at % 1000000) * 1000;
+     timerfd_settime(event_loop.timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_output_builtin(char **args, job_table *jobs)
+** Description: built in "output". "output on [CAP]" captures the output of background jobs started from
+**              then on (CAP is the memory cap for all rings, like "64M"), "output off" stops that, "output"
+**              lists the captures and "output [-f] %job|pid" replays one; -f then follows it until the job
+**              closes its output or SIGINT comes. Returns the exit status.
+** Parameters: the args array and pointer to the job table
+********************************************************************************************************/
+int smallsh_output_builtin(char **args, job_table *jobs)
+{
+     struct sigaction act, saved;
+     job_output *current;
+     int follow = 0;
+
+     if (args[1] == NULL)
+     {
+          printf("output %s, rings %lldK of %lldK\n", (capture.enabled == 1) ? "on" : "off", capture.memory_used / 1024, capture.memory_cap / 1024);
+          for (current = capture.first; current != NULL; current = current->next)
+          {
+               printf("[%d] %d %s %zu bytes (%zu spilled, %zu dropped) %s\n", current->job_id, current->pid,
+                      (current->pipe_fd != -1) ? "Running" : "Done", current->total, current->spilled,
+                      current->total - current->spilled - current->ring_length, current->command);
+          }
+          return 0;
+     }
+
+     if (strcmp(args[1], "on") == 0)
+     {
+          if (args[2] != NULL)
+          {
+               long long cap;
+
+               if ((smallsh_size_parse(args[2], &cap) == -1) || (cap < CAPTURE_RING))
+               {
+                    printf("smallsh: output: bad memory cap %s\n", args[2]);
+                    return 1;
+               }
+               capture.memory_cap = cap;
+          }
+          capture.enabled = 1;
+          return 0;
+     }
+
+     if (strcmp(args[1], "off") == 0)
+     {
+          capture.enabled = 0; //jobs already captured keep going to their rings
+          return 0;
+     }
+
+     if (strcmp(args[1], "-f") == 0)
+     {
+          follow = 1;
+          args++;
+     }
+
+     if ((args[1] == NULL) || (args[2] != NULL))
+     {
+          printf("usage: output [on [CAP] | off | [-f] %%job|pid]\n");
+          return 1;
+     }
+
+     current = smallsh_capture_find(args[1]);
+     if (current == NULL)
+     {
+          printf("smallsh: output: no captured output for %s\n", args[1]);
+          return 1;
+     }
+
+     fflush(stdout);
+     smallsh_capture_write(current, 1);
+
+     if ((follow == 1) && (current->pipe_fd != -1))
+     {
+          //without SA_RESTART so SIGINT breaks out of epoll_wait()
+          block_interrupted = 0;
+          act.sa_handler = smallsh_block_interrupt;
+          act.sa_flags = 0;
+          sigemptyset(&act.sa_mask);
+          sigaction(SIGINT, &act, &saved);
+
+          capture.follow = current;
+          smallsh_events_jobs_only(1);
+
+          while ((current->pipe_fd != -1) && (block_interrupted == 0))
+          {
+               smallsh_events_wait(jobs, -1);
+               fflush(stdout);
+          }
+
+          smallsh_events_jobs_only(0);
+          capture.follow = NULL;
+          sigaction(SIGINT, &saved, NULL);
+     }
+
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_start(int pipe_fd, job *reported)
+** Description: starts capturing the read end of a background job's output pipe: it is made non blocking
+**              and added to the event loop. Returns the new capture.
+** Parameters: the pipe's read end and the job it is reported as
+********************************************************************************************************/
+job_output *smallsh_capture_start(int pipe_fd, job *reported)
+{
+     job_output *current = calloc(1, sizeof(job_output));
+     struct epoll_event event;
+
+     current->job_id = reported->job_id;
+     current->pid = reported->pid;
+     strcpy(current->command, reported->command);
+     current->pipe_fd = pipe_fd;
+     current->spill_fd = -1;
+
+     if (pipe_fd >= capture.by_fd_size)
+     {
+          int size = (capture.by_fd_size == 0) ? 64 : capture.by_fd_size;
+
+          while (size <= pipe_fd)
+          {
+               size *= 2;
+          }
+          capture.by_fd = realloc(capture.by_fd, size * sizeof(job_output *));
+          memset(capture.by_fd + capture.by_fd_size, 0, (size - capture.by_fd_size) * sizeof(job_output *));
+          capture.by_fd_size = size;
+     }
+     capture.by_fd[pipe_fd] = current;
+
+     fcntl(pipe_fd, F_SETFL, O_NONBLOCK);
+     event.events = EPOLLIN;
+     event.data.u64 = EVENT_OUTPUT | (uint64_t)pipe_fd;
+     epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, pipe_fd, &event);
+     capture.open_pipes++;
+
+     if (capture.last == NULL)
+     {
+          capture.first = current;
+     }
+     else
+     {
+          capture.last->next = current;
+     }
+     capture.last = current;
+
+     return current;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_drain(job_output *current)
+** Description: reads what is waiting in a capture pipe, a few chunks per wakeup so one busy job can't
+**              hold up the others. At the end of the output the pipe is closed, and if more than
+**              CAPTURE_KEEP finished captures are kept the oldest one is dropped.
+** Parameters: the capture (may be NULL for a pipe closed earlier in the same batch)
+********************************************************************************************************/
+void smallsh_capture_drain(job_output *current)
+{
+     char buffer[CAPTURE_RING];
+     ssize_t bytes;
+     int reads;
+
+     if ((current == NULL) || (current->pipe_fd == -1))
+     {
+          return;
+     }
+
+     for (reads = 0; reads < 4; reads++)
+     {
+          bytes = read(current->pipe_fd, buffer, sizeof(buffer));
+
+          if (bytes > 0)
+          {
+               smallsh_capture_store(current, buffer, bytes);
+               continue;
+          }
+          if ((bytes == -1) && ((errno == EAGAIN) || (errno == EINTR)))
+          {
+               return;
+          }
+
+          //every stage has closed it
+          capture.by_fd[current->pipe_fd] = NULL;
+          close(current->pipe_fd);
+          current->pipe_fd = -1;
+          capture.open_pipes--;
+          capture.finished++;
+          if (current->ring != NULL)
+          {
+               capture.idle_rings++;
+          }
+
+          while (capture.finished > CAPTURE_KEEP)
+          {
+               job_output *oldest = capture.first;
+
+               while ((oldest->pipe_fd != -1) || (oldest == capture.follow))
+               {
+                    oldest = oldest->next;
+               }
+               smallsh_capture_free(oldest);
+          }
+          return;
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_store(job_output *current, const char *data, size_t length)
+** Description: adds output to a capture's ring, spilling the ring to its file each time it fills up.
+**              Without a ring (the memory cap is reached) the output goes straight to the spill file.
+**              Without a spill file the ring wraps over its oldest bytes. Output of the capture being
+**              followed is written to stdout as well. Returns -1 if any of it was dropped.
+** Parameters: the capture and the output
+********************************************************************************************************/
+int smallsh_capture_store(job_output *current, const char *data, size_t length)
+{
+     int result = 0;
+
+     current->total += length;
+     if (current == capture.follow)
+     {
+          smallsh_write_all(1, data, length);
+     }
+
+     if ((current->ring == NULL) && (smallsh_capture_ring(current) == -1))
+     {
+          if ((current->ring_length == 0) && (smallsh_capture_spill(current) == 0) && (smallsh_write_all(current->spill_fd, data, length) == 0))
+          {
+               current->spilled += length;
+               return 0;
+          }
+          return -1; //no memory and no spill file, it is lost
+     }
+
+     while (length > 0)
+     {
+          size_t end;
+          size_t chunk;
+
+          if ((current->ring_length == CAPTURE_RING) && (smallsh_capture_spill(current) == -1))
+          {
+               chunk = (length < CAPTURE_RING) ? length : CAPTURE_RING;
+               current->ring_start = (current->ring_start + chunk) % CAPTURE_RING;
+               current->ring_length -= chunk;
+               result = -1;
+          }
+
+          end = (current->ring_start + current->ring_length) % CAPTURE_RING;
+          chunk = CAPTURE_RING - current->ring_length;
+          if (chunk > CAPTURE_RING - end)
+          {
+               chunk = CAPTURE_RING - end; //up to the end of the ring, the rest wraps to the front
+          }
+          if (chunk > length)
+          {
+               chunk = length;
+          }
+
+          memcpy(current->ring + end, data, chunk);
+          current->ring_length += chunk;
+          data += chunk;
+          length -= chunk;
+     }
+
+     return result;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_spill(job_output *current)
+** Description: appends a capture's ring to its spill file, opening an unlinked one in $TMPDIR (or /tmp)
+**              the first time, and empties the ring. Returns -1 if there is no spill file or the write
+**              failed, the ring is then left as it is.
+** Parameters: the capture
+********************************************************************************************************/
+int smallsh_capture_spill(job_output *current)
+{
+     size_t first;
+
+     if (current->spill_fd == -1)
+     {
+          const char *dir = (getenv("TMPDIR") != NULL) ? getenv("TMPDIR") : "/tmp";
+
+          current->spill_fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+          if (current->spill_fd == -1)
+          {
+               return -1;
+          }
+     }
+
+     first = CAPTURE_RING - current->ring_start;
+     if (first > current->ring_length)
+     {
+          first = current->ring_length;
+     }
+
+     if ((smallsh_write_all(current->spill_fd, current->ring + current->ring_start, first) == -1)
+         || (smallsh_write_all(current->spill_fd, current->ring, current->ring_length - first) == -1))
+     {
+          return -1;
+     }
+
+     current->spilled += current->ring_length;
+     current->ring_start = 0;
+     current->ring_length = 0;
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_ring(job_output *current)
+** Description: gives a capture a ring if the memory cap allows it. When it doesn't, finished captures
+**              spill their rings and give them up first. Returns -1 if there is still no room.
+** Parameters: the capture
+********************************************************************************************************/
+int smallsh_capture_ring(job_output *current)
+{
+     job_output *other;
+
+     for (other = capture.first; (other != NULL) && (capture.idle_rings > 0) && (capture.memory_used + CAPTURE_RING > capture.memory_cap); other = other->next)
+     {
+          if ((other->pipe_fd == -1) && (other->ring != NULL) && (smallsh_capture_spill(other) == 0))
+          {
+               free(other->ring);
+               other->ring = NULL;
+               capture.memory_used -= CAPTURE_RING;
+               capture.idle_rings--;
+          }
+     }
+
+     if (capture.memory_used + CAPTURE_RING > capture.memory_cap)
+     {
+          return -1;
+     }
+
+     current->ring = malloc(CAPTURE_RING);
+     if (current->ring == NULL)
+     {
+          return -1;
+     }
+     capture.memory_used += CAPTURE_RING;
+
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_write(job_output *current, int fd)
+** Description: writes a capture's output to fd: the spill file, mapped, then what is in the ring
+** Parameters: the capture and the descriptor to write to
+********************************************************************************************************/
+void smallsh_capture_write(job_output *current, int fd)
+{
+     size_t first;
+
+     if (current->spilled > 0)
+     {
+          char *mapping = mmap(NULL, current->spilled, PROT_READ, MAP_SHARED, current->spill_fd, 0);
+
+          if (mapping != MAP_FAILED)
+          {
+               madvise(mapping, current->spilled, MADV_SEQUENTIAL);
+               smallsh_write_all(fd, mapping, current->spilled);
+               munmap(mapping, current->spilled);
+          }
+     }
+
+     first = CAPTURE_RING - current->ring_start;
+     if (first > current->ring_length)
+     {
+          first = current->ring_length;
+     }
+     if (current->ring_length > 0)
+     {
+          smallsh_write_all(fd, current->ring + current->ring_start, first);
+          smallsh_write_all(fd, current->ring, current->ring_length - first);
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_find(const char *spec)
+** Description: returns the capture for "%N" (job id N, the newest one since ids are reused) or a pid,
+**              NULL if there is none
+** Parameters: the job spec
+********************************************************************************************************/
+job_output *smallsh_capture_find(const char *spec)
+{
+     job_output *found = NULL;
+     job_output *current;
+     int by_job_id = (spec[0] == '%');
+     char *end;
+     long number = strtol(spec + by_job_id, &end, 10);
+
+     if ((*end != '\0') || (end == spec + by_job_id))
+     {
+          return NULL;
+     }
+
+     for (current = capture.first; current != NULL; current = current->next)
+     {
+          if ((by_job_id == 1) ? (current->job_id == number) : (current->pid == number))
+          {
+               found = current;
+          }
+     }
+
+     return found;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_capture_free(job_output *current)
+** Description: drops a finished capture: its ring, spill file and list entry
+** Parameters: the capture
+********************************************************************************************************/
+void smallsh_capture_free(job_output *current)
+{
+     job_output *previous = NULL;
+     job_output *other;
+
+     for (other = capture.first; other != current; other = other->next)
+     {
+          previous = other;
+     }
+
+     if (previous == NULL)
+     {
+          capture.first = current->next;
+     }
+     else
+     {
+          previous->next = current->next;
+     }
+     if (capture.last == current)
+     {
+          capture.last = previous;
+     }
+
+     if (current->ring != NULL)
+     {
+          free(current->ring);
+          capture.memory_used -= CAPTURE_RING;
+          capture.idle_rings--;
+     }
+     if (current->spill_fd != -1)
+     {
+          close(current->spill_fd);
+     }
+     capture.finished--;
+     free(current);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_table_init(job_table *jobs)
+** Description: sets up an empty job table
+** Parameters: pointer to the job table
+********************************************************************************************************/
+void smallsh_job_table_init(job_table *jobs)
+{
+     jobs->slots = NULL;
+     jobs->num_slots = 0;
+     jobs->free_slot = -1;
+     jobs->index = NULL;
+     jobs->index_size = 0;
+     jobs->count = 0;
+     jobs->next_job_id = 1;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_table_free(job_table *jobs)
+** Description: releases the memory used by the job table
+** Parameters: pointer to the job table
+********************************************************************************************************/
+void smallsh_job_table_free(job_table *jobs)
+{
+     free(jobs->slots);
+     free(jobs->index);
+     smallsh_job_table_init(jobs);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_index_slot(job_table *jobs, pid_t pid)
+** Description: returns the position in the pid index where pid is stored, or the empty position
+**              where it would be stored
+** Parameters: pointer to the job table and the pid to look for
+********************************************************************************************************/
+int smallsh_job_index_slot(job_table *jobs, pid_t pid)
+{
+     int mask = jobs->index_size - 1;
+     int i = ((unsigned int)pid * 2654435761u) & mask; //Knuth multiplicative hash, pids are mostly sequential
+
+     while ((jobs->index[i] != 0) && (jobs->slots[jobs->index[i] - 1].pid != pid))
+     {
+          i = (i + 1) & mask;
+     }
+
+     return i;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_insert(job_table *jobs, pid_t pid, pid_t pgid, const char *command)
+** Description: adds a running background job. Slots freed by reaped jobs are reused first and the
+**              index is doubled when it gets half full, so inserting is O(1) amortized. Pipeline
+**              stages that aren't reported on their own are added with a NULL command and no job id.
+** Parameters: pointer to the job table, pid of the new child, its process group and the command line
+********************************************************************************************************/
+job *smallsh_job_insert(job_table *jobs, pid_t pid, pid_t pgid, const char *command)
+{
+     job *new_job;
+     int slot;
+
+     //grow the index before it gets crowded, rehashing the running jobs into it
+     if ((jobs->count + 1) * 2 > jobs->index_size)
+     {
+          int i;
+
+          free(jobs->index);
+          jobs->index_size = (jobs->index_size == 0) ? JOB_TABLE_SIZE : jobs->index_size * 2;
+          jobs->index = calloc(jobs->index_size, sizeof(int));
+
+          for (i = 0; i < jobs->num_slots; i++)
+          {
+               if (jobs->slots[i].state != JOB_FREE)
+               {
+                    jobs->index[smallsh_job_index_slot(jobs, jobs->slots[i].pid)] = i + 1;
+               }
+          }
+     }
+
+     //take a slot from the free list, or grow the slab and chain its new slots onto the free list
+     if (jobs->free_slot == -1)
+     {
+          int old_slots = jobs->num_slots;
+          int i;
+
+          jobs->num_slots = (old_slots == 0) ? JOB_TABLE_SIZE : old_slots * 2;
+          jobs->slots = realloc(jobs->slots, jobs->num_slots * sizeof(job));
+
+          for (i = jobs->num_slots - 1; i >= old_slots; i--)
+          {
+               jobs->slots[i].state = JOB_FREE;
+               jobs->slots[i].next_free = jobs->free_slot;
+               jobs->free_slot = i;
+          }
+     }
+
+     slot = jobs->free_slot;
+     new_job = &jobs->slots[slot];
+     jobs->free_slot = new_job->next_free;
+
+     new_job->job_id = (command != NULL) ? jobs->next_job_id++ : 0;
+     new_job->pid = pid;
+     new_job->pgid = pgid;
+     new_job->state = JOB_RUNNING;
+     new_job->pidfd = -1;
+     new_job->limit.state = DEADLINE_NONE;
+     new_job->stats = NULL;
+     new_job->group = NULL;
+     clock_gettime(CLOCK_MONOTONIC, &new_job->start_time);
+     snprintf(new_job->command, JOB_COMMAND_LENGTH, "%s", (command != NULL) ? command : "");
+
+     jobs->index[smallsh_job_index_slot(jobs, pid)] = slot + 1;
+     jobs->count++;
+
+     return new_job;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_find(job_table *jobs, pid_t pid)
+** Description: returns the job for pid or NULL if it isn't a job started by this shell
+** Parameters: pointer to the job table and the pid to look for
+********************************************************************************************************/
+job *smallsh_job_find(job_table *jobs, pid_t pid)
+{
+     int i;
+
+     if (jobs->count == 0)
+     {
+          return NULL;
+     }
+
+     i = smallsh_job_index_slot(jobs, pid);
+     if (jobs->index[i] == 0)
+     {
+          return NULL;
+     }
+
+     return &jobs->slots[jobs->index[i] - 1];
+}
+
+/*******************************************************************************************************
+** Function: smallsh_job_remove(job_table *jobs, job *old_job)
+** Description: removes a reaped job in O(1). Its index entry is deleted by shifting back the entries
+**              that follow it in the probe sequence (no tombstones) and its slot goes on the free list.
+** Parameters: pointer to the job table and the job to remove
+********************************************************************************************************/
+void smallsh_job_remove(job_table *jobs, job *old_job)
+{
+     int mask = jobs->index_size - 1;
+     int hole = smallsh_job_index_slot(jobs, old_job->pid);
+     int slot = old_job - jobs->slots;
+     int i = hole;
+
+     jobs->index[hole] = 0;
+
+     //backward shift deletion for linear probing
+     while (1)
+     {
+          int home;
+
+          i = (i + 1) & mask;
+          if (jobs->index[i] == 0)
+          {
+               break;
+          }
+
+          home = ((unsigned int)jobs->slots[jobs->index[i] - 1].pid * 2654435761u) & mask;
+
+          //move the entry into the hole unless its home lies cyclically in (hole, i]
+          if (((i > hole) && ((home <= hole) || (home > i))) || ((i < hole) && ((home <= hole) && (home > i))))
+          {
+               jobs->index[hole] = jobs->index[i];
+               jobs->index[i] = 0;
+               hole = i;
+          }
+     }
+
+     if (old_job->pidfd >= 0)
+     {
+          close(old_job->pidfd); //also removes it from the epoll set
+          old_job->pidfd = -1;
+     }
+     else if (event_loop.use_pidfd == 1)
+     {
+          event_loop.unwatched--; //it was polled
+     }
+
+     if (old_job->group != NULL)
+     {
+          smallsh_group_release(old_job->group);
+          old_job->group = NULL;
+     }
+
+     old_job->state = JOB_FREE;
+     old_job->next_free = jobs->free_slot;
+     jobs->free_slot = slot;
+     jobs->count--;
+
+     if (jobs->count == 0)
+     {
+          jobs->next_job_id = 1; //start numbering again once nothing is running, like other shells
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_jobs_builtin(job_table *jobs)
+** Description: built in "jobs": lists the running background jobs with their job id, pid, how long
+**              they have been running and the command. "jobs -l" adds the limits, usage and memory and
+**              CPU pressure of the cgroup of jobs started with "limit".
+** Parameters: the args array and pointer to the job table
+********************************************************************************************************/
+void smallsh_jobs_builtin(char **args, job_table *jobs)
+{
+     struct timespec now;
+     int long_format = ((args[1] != NULL) && (strcmp(args[1], "-l") == 0));
+     int i;
+
+     clock_gettime(CLOCK_MONOTONIC, &now);
+
+     for (i = 0; i < jobs->num_slots; i++)
+     {
+          job *current = &jobs->slots[i];
+
+          if ((current->state == JOB_RUNNING) && (current->job_id != 0))
+          {
+               double elapsed = (now.tv_sec - current->start_time.tv_sec) + ((now.tv_nsec - current->start_time.tv_nsec) / 1e9);
+               printf("[%d] %d Running %.1fs %s\n", current->job_id, current->pid, elapsed, current->command);
+
+               if ((long_format == 1) && (current->group != NULL))
+               {
+                    smallsh_group_print(current->group, "     ");
+               }
+          }
+     }
+}
+
+/*******************************************************************************************************
+** Function: smallsh_wait_builtin(char **args, job_table *jobs)
+** Description: built in "wait": blocks in the event loop, with stdin taken out of it, until every
+**              background job has been reaped, or with pids until those jobs have. Finished jobs are
+**              reported as they go, and every EVENT_RESCAN_MS without an event all jobs are checked
+**              with wait4(). Returns the status of the last pid given (0 without pids), 127 if a
+**              pid isn't a job of this shell and 130 if SIGINT cut the wait short.
+** Parameters: the args array and pointer to the job table
+********************************************************************************************************/
+int smallsh_wait_builtin(char **args, job_table *jobs)
+{
+     struct sigaction act, saved;
+     int status = 0;
+     int i;
+
+     for (i = 1; args[i] != NULL; i++)
+     {
+          char *end;
+          long pid = strtol(args[i], &end, 10);
+
+          if ((*args[i] == '\0') || (*end != '\0') || (pid <= 0))
+          {
+               printf("smallsh: wait: %s is not a pid\n", args[i]);
+               return 2;
+          }
+          if (smallsh_job_find(jobs, (pid_t)pid) == NULL)
+          {
+               printf("smallsh: wait: pid %ld is not a child of this shell\n", pid);
+               status = 127;
+          }
+          wait_pid = (pid_t)pid;
+     }
+     wait_status = 0;
+
+     fflush(stdout);
+
+     //without SA_RESTART so SIGINT breaks out of epoll_wait()
+     block_interrupted = 0;
+     act.sa_handler = smallsh_block_interrupt;
+     act.sa_flags = 0;
+     sigemptyset(&act.sa_mask);
+     sigaction(SIGINT, &act, &saved);
+
+     smallsh_events_jobs_only(1);
+
+     while (block_interrupted == 0)
+     {
+          int waiting = 0;
+
+          if (args[1] == NULL)
+          {
+               waiting = (jobs->count > 0);
+          }
+          for (i = 1; (args[i] != NULL) && (waiting == 0); i++)
+          {
+               waiting = (smallsh_job_find(jobs, (pid_t)atoi(args[i])) != NULL);
+          }
+          if (waiting == 0)
+          {
+               break;
+          }
+
+          //never wait forever on the event loop, a job it can't see is still found by wait4()
+          if (smallsh_events_wait(jobs, EVENT_RESCAN_MS) == 0)
+          {
+               smallsh_bg_scan(jobs, 0);
+          }
+          fflush(stdout);
+     }
+
+     smallsh_events_jobs_only(0);
+
+     sigaction(SIGINT, &saved, NULL);
+
+     wait_pid = 0;
+
+     if (block_interrupted == 1)
+     {
+          return 130;
+     }
+     return (status == 0) ? wait_status : status;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_jobs_shutdown(job_table *jobs)
+** Description: stops the background jobs when the shell exits. Jobs that already finished are reported
+**              first, so only jobs still running are signalled: SIGTERM (and SIGCONT, so a stopped one
+**              sees it) goes to every job's process group at once, then they are reaped together in
+**              the event loop for up to exit_grace ("timeout -x"). Process groups still there after
+**              that get SIGKILL and their jobs are reaped with a blocking wait4(), which SIGKILL keeps
+**              short. Each job is reported as it is reaped, then one line sums it up.
+** Parameters: pointer to the job table
+********************************************************************************************************/
+void smallsh_jobs_shutdown(job_table *jobs)
+{
+     char grace_text[32];
+     long long deadline_at;
+     int num_jobs = 0;
+     int num_killed = 0;
+     int i;
+
+     smallsh_bg_status_check(jobs);
+     if (jobs->count == 0)
+     {
+          return;
+     }
+
+     for (i = 0; i < jobs->num_slots; i++)
+     {
+          if (jobs->slots[i].state == JOB_RUNNING)
+          {
+               num_jobs += (jobs->slots[i].job_id != 0);
+               killpg(jobs->slots[i].pgid, SIGTERM);
+               killpg(jobs->slots[i].pgid, SIGCONT);
+          }
+     }
+
+     smallsh_events_jobs_only(1);
+     deadline_at = smallsh_usec_now() + exit_grace;
+
+     while (jobs->count > 0)
+     {
+          long long now = smallsh_usec_now();
+
+          if (now >= deadline_at)
+          {
+               break;
+          }
+          smallsh_events_wait(jobs, (int)((deadline_at - now + 999) / 1000));
+     }
+
+     if (jobs->count > 0)
+     {
+          for (i = 0; i < jobs->num_slots; i++)
+          {
+               if (jobs->slots[i].state == JOB_RUNNING)
+               {
+                    num_killed += (jobs->slots[i].job_id != 0);
+                    killpg(jobs->slots[i].pgid, SIGKILL);
+               }
+          }
+
+          //not through the event loop, a job it can't see would keep the shell from ever exiting
+          for (i = 0; i < jobs->num_slots; i++)
+          {
+               struct rusage usage;
+               int bg_status;
+
+               if ((jobs->slots[i].state == JOB_RUNNING) && (wait4(jobs->slots[i].pid, &bg_status, 0, &usage) == jobs->slots[i].pid))
+               {
+                    smallsh_job_reap(jobs, &jobs->slots[i], bg_status, &usage);
+               }
+               else if (jobs->slots[i].state == JOB_RUNNING)
+               {
+                    smallsh_job_remove(jobs, &jobs->slots[i]); //already gone
+               }
+          }
+     }
+
+     smallsh_events_jobs_only(0);
+
+     printf("smallsh: stopped %d background job%s, %d after SIGTERM, %d killed after %s\n", num_jobs, (num_jobs == 1) ? "" : "s",
+            num_jobs - num_killed, num_killed, smallsh_format_usec(exit_grace, grace_text, sizeof(grace_text)));
+     fflush(stdout);
+}
+
+/*******************************************************************************************************
+** Function: smallsh_time_builtin(char **args, int num_args, int *exit_status, int *signal_flag,
+**                                int *terminating_signal, job_table *jobs)
+** Description: built in "time command": runs the rest of the line and prints its wall clock time, the
+**              CPU time, peak resident set and context switches of the children it waited for, plus
+**              the shell's own CPU time (which is all a built in uses). Returns what smallsh_execute()
+**              returned for the command.
+** Parameters: the args array starting at "time", its length, the shell's status variables and the job table
+********************************************************************************************************/
+int smallsh_time_builtin(char **args, int num_args, int *exit_status, int *signal_flag, int *terminating_signal, job_table *jobs)
+{
+     struct timespec start_time;
+     struct rusage self_start;
+     struct rusage self_end;
+     char real[32], user[32], sys[32];
+     long long user_usec, sys_usec;
+     int result;
+
+     if (args[1] == NULL)
+     {
+          printf("usage: time command [args]\n");
+          *exit_status = 1;
+          return 1; //reprint prompt
+     }
+
+     memset(&foreground_usage, 0, sizeof(foreground_usage));
+     getrusage(RUSAGE_SELF, &self_start);
+     clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+     result = smallsh_execute(args + 1, num_args - 1, exit_status, signal_flag, terminating_signal, jobs);
+
+     getrusage(RUSAGE_SELF, &self_end);
+     user_usec = (foreground_usage.ru_utime.tv_sec + self_end.ru_utime.tv_sec - self_start.ru_utime.tv_sec) * 1000000LL
+               + (foreground_usage.ru_utime.tv_usec + self_end.ru_utime.tv_usec - self_start.ru_utime.tv_usec);
+     sys_usec = (foreground_usage.ru_stime.tv_sec + self_end.ru_stime.tv_sec - self_start.ru_stime.tv_sec) * 1000000LL
+              + (foreground_usage.ru_stime.tv_usec + self_end.ru_stime.tv_usec - self_start.ru_stime.tv_usec);
+
+     printf("real %s  user %s  sys %s  maxrss %ldKB  ctxsw %ld/%ld\n",
+            smallsh_format_usec(smallsh_usec_since(&start_time), real, sizeof(real)),
+            smallsh_format_usec(user_usec, user, sizeof(user)),
+            smallsh_format_usec(sys_usec, sys, sizeof(sys)),
+            foreground_usage.ru_maxrss, foreground_usage.ru_nvcsw, foreground_usage.ru_nivcsw);
+     fflush(stdout);
+
+     return result;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_stats_builtin(char **args)
+** Description: built in "stats": prints for each command name the number of runs, the p50/p99/max wall
+**              clock time, total CPU time and peak resident set, then the spawn latency of each engine
+**              (the time from starting the child to its exec() for posix_spawn(), only the fork() for
+**              the fork engine). "stats -r" clears everything. Entries are zeroed rather than freed since
+**              running jobs and "parallel" tasks still point at theirs.
+** Parameters: the args array
+********************************************************************************************************/
+void smallsh_stats_builtin(char **args)
+{
+     const char *engines[2] = { "fork", "posix" };
+     char p50[32], p99[32], max[32], user[32], sys[32];
+     int i;
+
+     if ((args[1] != NULL) && (strcmp(args[1], "-r") == 0))
+     {
+          for (i = 0; i < stats_table.size; i++)
+          {
+               command_stats *entry = stats_table.entries[i];
+
+               if (entry != NULL)
+               {
+                    memset(&entry->wall, 0, sizeof(entry->wall));
+                    entry->user_usec = entry->sys_usec = 0;
+                    entry->max_rss = 0;
+                    entry->voluntary_switches = entry->involuntary_switches = 0;
+               }
+          }
+          memset(spawn_latency, 0, sizeof(spawn_latency));
+          return;
+     }
+
+     printf("%-16s %8s %9s %9s %9s %9s %9s %9s\n", "command", "runs", "p50", "p99", "max", "user", "sys", "maxrss");
+
+     for (i = 0; i < stats_table.size; i++)
+     {
+          command_stats *entry = stats_table.entries[i];
+
+          if ((entry == NULL) || (entry->wall.total == 0)) //none yet, or not since "stats -r"
+          {
+               continue;
+          }
+
+          printf("%-16s %8ld %9s %9s %9s %9s %9s %7ldKB\n", entry->name, entry->wall.total,
+                 smallsh_format_usec(smallsh_histogram_percentile(&entry->wall, 50.0), p50, sizeof(p50)),
+                 smallsh_format_usec(smallsh_histogram_percentile(&entry->wall, 99.0), p99, sizeof(p99)),
+                 smallsh_format_usec(entry->wall.max, max, sizeof(max)),
+                 smallsh_format_usec(entry->user_usec, user, sizeof(user)),
+                 smallsh_format_usec(entry->sys_usec, sys, sizeof(sys)),
+                 entry->max_rss);
+     }
+
+     for (i = 0; i < 2; i++)
+     {
+          if (spawn_latency[i].total > 0)
+          {
+               printf("spawn %-10s %8ld %9s %9s %9s\n", engines[i], spawn_latency[i].total,
+                      smallsh_format_usec(smallsh_histogram_percentile(&spawn_latency[i], 50.0), p50, sizeof(p50)),
+                      smallsh_format_usec(smallsh_histogram_percentile(&spawn_latency[i], 99.0), p99, sizeof(p99)),
+                      smallsh_format_usec(spawn_latency[i].max, max, sizeof(max)));
+          }
+     }
+}
 
-          return 1; //reprint prompt
+/*******************************************************************************************************
+** Function: smallsh_stats_find(const char *name)
+** Description: returns the accounting entry for a command name, adding it if this is its first run.
+**              Entries are found through an open addressed table hashed like the command path table.
+** Parameters: the command name as it was typed
+********************************************************************************************************/
+command_stats *smallsh_stats_find(const char *name)
+{
+     unsigned int mask;
+     unsigned int i;
 
-     }
-     /* Built in command: "status" */
-     else if (strcmp(args[0], "status") == 0)
+     //grow the table before it gets crowded
+     if ((stats_table.count + 1) * 2 > stats_table.size)
      {
-          if (*signal_flag == 0) //no signals were set
+          command_stats **old_entries = stats_table.entries;
+          int old_size = stats_table.size;
+          int j;
+
+          stats_table.size = (old_size == 0) ? STATS_TABLE_SIZE : old_size * 2;
+          stats_table.entries = calloc(stats_table.size, sizeof(command_stats *));
+          mask = stats_table.size - 1;
+
+          for (j = 0; j < old_size; j++)
           {
-               printf("Exit value: %d\n", *exit_status);
+               if (old_entries[j] != NULL)
+               {
+                    for (i = smallsh_hash_string(old_entries[j]->name) & mask; stats_table.entries[i] != NULL; i = (i + 1) & mask)
+                    {
+                         //linear probing
+                    }
+                    stats_table.entries[i] = old_entries[j];
+               }
           }
-          else
+          free(old_entries);
+     }
+
+     mask = stats_table.size - 1;
+     for (i = smallsh_hash_string(name) & mask; stats_table.entries[i] != NULL; i = (i + 1) & mask)
+     {
+          if (strcmp(stats_table.entries[i]->name, name) == 0)
           {
-               printf("Terminated by signal %d\n", *terminating_signal);
+               return stats_table.entries[i];
           }
-          return 1; //reprint prompt
      }
-     /* Built in command: "exit" */
-     else if (strcmp(args[0], "exit") == 0)
+
+     stats_table.entries[i] = calloc(1, sizeof(command_stats));
+     stats_table.entries[i]->name = strdup(name);
+     stats_table.count++;
+
+     return stats_table.entries[i];
+}
+
+/*******************************************************************************************************
+** Function: smallsh_stats_record(command_stats *entry, const struct timespec *start_time,
+**                                const struct rusage *usage)
+** Description: adds one finished run to a command's accounting: its wall clock time since start_time
+**              and the rusage wait4() returned for it
+** Parameters: the command's entry, when the run started and its rusage
+********************************************************************************************************/
+void smallsh_stats_record(command_stats *entry, const struct timespec *start_time, const struct rusage *usage)
+{
+     smallsh_histogram_record(&entry->wall, smallsh_usec_since(start_time));
+
+     entry->user_usec += (usage->ru_utime.tv_sec * 1000000LL) + usage->ru_utime.tv_usec;
+     entry->sys_usec += (usage->ru_stime.tv_sec * 1000000LL) + usage->ru_stime.tv_usec;
+     entry->voluntary_switches += usage->ru_nvcsw;
+     entry->involuntary_switches += usage->ru_nivcsw;
+     if (usage->ru_maxrss > entry->max_rss)
      {
-          return 0; //End the smallsh shell loop
+          entry->max_rss = usage->ru_maxrss;
      }
+}
 
-     /* Check if the command will be run in the background*/
-     if (strcmp(args[num_args - 1], "&") == 0) // The "&" argument must always be last argument, but the last element is array is NULL
+/*******************************************************************************************************
+** Function: smallsh_usage_add(struct rusage *total, const struct rusage *usage)
+** Description: adds a child's CPU time and context switches to total, ru_maxrss keeps the largest
+** Parameters: the running total and the child's rusage
+********************************************************************************************************/
+void smallsh_usage_add(struct rusage *total, const struct rusage *usage)
+{
+     total->ru_utime.tv_sec += usage->ru_utime.tv_sec;
+     total->ru_utime.tv_usec += usage->ru_utime.tv_usec;
+     total->ru_stime.tv_sec += usage->ru_stime.tv_sec;
+     total->ru_stime.tv_usec += usage->ru_stime.tv_usec;
+     total->ru_nvcsw += usage->ru_nvcsw;
+     total->ru_nivcsw += usage->ru_nivcsw;
+     if (usage->ru_maxrss > total->ru_maxrss)
      {
-          background_proccess = 1; //set to true
-          args[num_args - 1] = NULL; //remove the"&" argument from the array
+          total->ru_maxrss = usage->ru_maxrss;
      }
-
-     /* Not a built in command */
-     //Pass the arguments to be exec()
-     *exit_status = smallsh_launch(args, num_args, background_proccess, signal_flag, terminating_signal, head);
-
-     return 1; //reprint prompt
 }
 
-/*****************************************************************************************************************************
-** Function: smallsh_launch(char **args, int num_args, int background_process, int *signal_flag, int *terminating_signal)
-** Description: This function will fork() the program and check for any redirection and pass non-built in commands to exec()
-**
-** Parameters: Pointers to terminating_signal, signal_flag to set them depending on execution of foreground command
-******************************************************************************************************************************/
-int smallsh_launch(char **args, int num_args, int background_process, int *signal_flag, int *terminating_signal, bg_child *head)
+/*******************************************************************************************************
+** Function: smallsh_histogram_record(histogram *samples, uint64_t value)
+** Description: counts a sample in its bucket. Values below 2^HISTOGRAM_SUB_BITS have a bucket each,
+**              above that every power of two is split into 2^(HISTOGRAM_SUB_BITS - 1) equal buckets,
+**              so the bucket is found with a count leading zeros and a shift.
+** Parameters: the histogram and the sample
+********************************************************************************************************/
+void smallsh_histogram_record(histogram *samples, uint64_t value)
 {
-     pid_t pid, wpid;
-     int status;
+     uint64_t clamped = value;
+     int bucket;
 
-     pid = fork();
+     if (clamped >= (1ULL << HISTOGRAM_MAX_BITS))
+     {
+          clamped = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+     }
 
-     /********************************/
-     /*     This is the Child        */
-     /********************************/
-     if (pid == 0)
+     if (clamped < (1ULL << HISTOGRAM_SUB_BITS))
+     {
+          bucket = (int)clamped;
+     }
+     else
      {
+          int shift = (63 - __builtin_clzll(clamped)) - HISTOGRAM_SUB_BITS + 1;
 
-          //restore sigation to default for all foreground process - Credit: Professor Brewster from class discusion boards
-          struct sigaction act;
-          act.sa_handler = SIG_DFL;
-          act.sa_flags = 0;
-          sigaction(SIGINT, &act, 0);
+          bucket = (shift << (HISTOGRAM_SUB_BITS - 1)) + (int)(clamped >> shift);
+     }
 
-          //check for input/output redirection and set filenames
-          int fd; //file descriptor
-          int input_flag = -1;
-          int output_flag = -1;
+     samples->counts[bucket]++;
+     samples->total++;
+     if (value > samples->max)
+     {
+          samples->max = value;
+     }
+}
 
-          //Counter for preventing segmentation fault when background command (Due to num_arrays being one less)
-          int counter = num_args;
-          if (background_process == 1)
-          {
-               counter = (num_args - 1);
-          }
+/*******************************************************************************************************
+** Function: smallsh_histogram_percentile(histogram *samples, double percentile)
+** Description: returns the highest value of the bucket holding the given percentile, never more than
+**              the largest sample. 0 for an empty histogram.
+** Parameters: the histogram and the percentile (0 - 100)
+********************************************************************************************************/
+uint64_t smallsh_histogram_percentile(histogram *samples, double percentile)
+{
+     long rank = (long)((percentile / 100.0) * samples->total + 0.5);
+     long seen = 0;
+     int i;
 
-          //set redirect flag positions if any - Credit: Inspired by Ian Dalrymple from class discussion boards
-          int i;
-          for (i = 0; i < counter; i++)
+     if (rank < 1)
+     {
+          rank = 1;
+     }
+
+     for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+     {
+          seen += samples->counts[i];
+          if (seen >= rank)
           {
-               if (strcmp(args[i], "<") == 0)
-               {
-                    input_flag = i;
-               }
-               else if (strcmp(args[i], ">") == 0)
-               {
-                    output_flag = i;
-               }
+               uint64_t value = smallsh_histogram_bucket_start(i + 1) - 1;
+
+               return (value < samples->max) ? value : samples->max;
           }
+     }
 
-          /* Check for input/ouput redirection */
-          if ((input_flag > -1) || (output_flag > -1))
-          {
+     return samples->max;
+}
 
-               //Credit: Lecture 12- "Pipes and Redirection"
+/*******************************************************************************************************
+** Function: smallsh_histogram_bucket_start(int bucket)
+** Description: returns the smallest value smallsh_histogram_record() counts in bucket
+** Parameters: the bucket number
+********************************************************************************************************/
+uint64_t smallsh_histogram_bucket_start(int bucket)
+{
+     int sub_buckets = 1 << (HISTOGRAM_SUB_BITS - 1);
+     int shift;
 
-               if (smallsh_redirect_check(input_flag, output_flag) == 0)//perform input redirection
-               {
-                    fd = open(args[input_flag + 1], O_RDONLY, 0644); //Open file that is to be read from -Credit: http://linux.die.net/man/3/open
+     if (bucket < (1 << HISTOGRAM_SUB_BITS))
+     {
+          return bucket;
+     }
 
-                    if (fd == -1)
-                    {
-                         printf("smallsh: cannot open %s for input\n", args[input_flag + 1]);
-                         exit(1); //exit the child process with exit stats 1
-                    }
-                    else
-                    {
-                         //redirect stdin to the specified file
-                         if (dup2(fd, 0) == -1)
-                         {
-                              printf("smallsh: Could not redirect stdin for input file\n");
-                              exit(1); //exit the child process
-                         }
+     shift = (bucket / sub_buckets) - 1;
+     return (uint64_t)(bucket - (shift * sub_buckets)) << shift;
+}
 
-                         args[input_flag] = NULL;
+/*******************************************************************************************************
+** Function: smallsh_usec_since(const struct timespec *start_time)
+** Description: returns the CLOCK_MONOTONIC microseconds elapsed since start_time
+** Parameters: the start time
+********************************************************************************************************/
+long long smallsh_usec_since(const struct timespec *start_time)
+{
+     struct timespec now;
 
-                         close(fd);
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return ((now.tv_sec - start_time->tv_sec) * 1000000LL) + ((now.tv_nsec - start_time->tv_nsec) / 1000);
+}
 
-                    }
-               }
-               else //perform ouput redirection
-               {
-                    fd = open(args[output_flag + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644); //opens file to write to. Will create if not exists or truncate to 0 if it does
+/*******************************************************************************************************
+** Function: smallsh_usec_now()
+** Description: returns the CLOCK_MONOTONIC time in microseconds
+** Parameters: none
+********************************************************************************************************/
+long long smallsh_usec_now()
+{
+     struct timespec now;
 
-                    if (fd == -1)
-                    {
-                         printf("smallsh: cannot not open %s for output\n", args[output_flag + 1]);
-                         exit(1); //exit the child process
-                    }
-                    else
-                    {
-                         //redirect stdout to the specified file
-                         if (dup2(fd, 1) == -1)
-                         {
-                              printf("smallsh: Could not redirect stdout for output file\n");
-                              exit(1); //exit the child process
-                         }
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+}
 
-                         args[output_flag] = NULL;
+/*******************************************************************************************************
+** Function: smallsh_format_usec(long long usec, char *buffer, size_t size)
+** Description: formats a duration as us, ms or s into buffer and returns it
+** Parameters: the duration in microseconds and the buffer
+********************************************************************************************************/
+char *smallsh_format_usec(long long usec, char *buffer, size_t size)
+{
+     if (usec < 1000)
+     {
+          snprintf(buffer, size, "%lldus", usec);
+     }
+     else if (usec < 1000000)
+     {
+          snprintf(buffer, size, "%.2fms", usec / 1000.0);
+     }
+     else
+     {
+          snprintf(buffer, size, "%.2fs", usec / 1000000.0);
+     }
 
-                         close(fd);
-                    }
-               }
+     return buffer;
+}
 
-          }
-          else if ((background_process == 1) && (input_flag < 0)) //user did not specify input redirect
-          {
-               fd = open("/dev/null", O_RDONLY, 0644);  //redirect stdin to "/dev/null" 
+/*******************************************************************************************************
+** Function: smallsh_hash_string(const char *name)
+** Description: FNV-1a hash of a command name used to index the command path table
+** Parameters: the command name
+********************************************************************************************************/
+unsigned int smallsh_hash_string(const char *name)
+{
+     unsigned int hash = 2166136261u;
 
-               if (fd == -1)
-               {
-                    printf("smallsh: Could not open \"/dev/null\"\n");
-                    exit(1); //exit the child process
-               }
-               else
-               {
-                    //redirect stdin to the specified file
-                    if (dup2(fd, 0) == -1)
-                    {
-                         printf("smallsh: Could not redirect stdin to \"/dev/null\"\n");
-                         exit(1); //exit the child process
-                    }
+     while (*name != '\0')
+     {
+          hash ^= (unsigned char)*name++;
+          hash *= 16777619u;
+     }
 
-                    close(fd);
+     return hash;
+}
 
-               }
-          }
+/*******************************************************************************************************
+** Function: smallsh_hash_clear()
+** Description: forgets every remembered command path and re-reads the directories in $PATH along with
+**              their modification times (used by "hash -r" and when $PATH or a directory changes)
+** Parameters: none
+********************************************************************************************************/
+void smallsh_hash_clear()
+{
+     char *path_env = getenv("PATH");
+     char *dir;
+     struct stat dir_info;
+     int i;
 
-          if (execvp(args[0], args) == -1)
+     for (i = 0; i < path_hash.size; i++)
+     {
+          if (path_hash.entries[i].name != NULL)
           {
-               printf("smallsh: no such file or directory\n"); //command not found
-               exit(1); //exit the child process
+               free(path_hash.entries[i].name);
+               free(path_hash.entries[i].path);
+               path_hash.entries[i].name = NULL;
           }
-
      }
-     /********************************/
-     /* There was an error forking   */
-     /********************************/
-     else if (pid < 0)
+     path_hash.count = 0;
+
+     free(path_hash.path_env);
+     free(path_hash.path_copy);
+     free(path_hash.dirs);
+
+     if (path_env == NULL)
      {
-          printf("smallsh: Error forking!\n");
-          return 1;
+          path_env = PATH_DEFAULT;
      }
-     /********************************/
-     /*     This is the Parent       */
-     /********************************/
-     else
-     {
-          do
-          {
-               if (background_process == 1) //if set to true
-               {
-                    smallsh_bg_list_insert(head, pid); //add background process id to linked list
 
-                    printf("Background pid %d has begun.\n", pid);
-                    fflush(stdout);
-               }
-               else //it is a foreground command
-               {
-                    wpid = waitpid(pid, &status, WUNTRACED); //wait unitl it is completed
-               }
+     path_hash.path_env = strdup(path_env);
+     path_hash.path_copy = strdup(path_env); //split in place into the directory list below
+     path_hash.num_dirs = 0;
+     path_hash.first_relative = -1;
+     path_hash.dirs = malloc((strlen(path_env) + 1) * sizeof(path_dir)); //there can't be more directories than characters
 
-          } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+     //Split on ':' by hand, strtok() would skip empty entries which mean the current directory
+     dir = path_hash.path_copy;
+     while (dir != NULL)
+     {
+          char *next = strchr(dir, ':');
 
-          //Status and termination signals for foreground processes
-          if (WIFEXITED(status))
+          if (next != NULL)
+          {
+               *next = '\0';
+               next++;
+          }
+
+          path_hash.dirs[path_hash.num_dirs].dir = (*dir == '\0') ? "." : dir;
+          if ((*dir != '/') && (path_hash.first_relative == -1))
           {
-               *signal_flag = 0; //set to false
-               return (WEXITSTATUS(status)); //return exit_status
+               path_hash.first_relative = path_hash.num_dirs;
+          }
 
+          if (stat(path_hash.dirs[path_hash.num_dirs].dir, &dir_info) == 0)
+          {
+               path_hash.dirs[path_hash.num_dirs].mtime = dir_info.st_mtim;
           }
-          else if (WIFSIGNALED(status))
+          else
           {
-               *signal_flag = 1; //set to true
-               *terminating_signal = WTERMSIG(status);
-               return 1; //return exit status 1
+               path_hash.dirs[path_hash.num_dirs].mtime.tv_sec = -1;
+               path_hash.dirs[path_hash.num_dirs].mtime.tv_nsec = 0;
           }
+
+          path_hash.num_dirs++;
+          dir = next;
+     }
+
+     if (path_hash.first_relative == -1)
+     {
+          path_hash.first_relative = path_hash.num_dirs;
      }
 }
 
-/**********************************************************************
-** Function: smallsh_redirect_check(int input_flag, int output_flag)
-** Description: checks the "<" or ">" location for which one is first
-**              and returns 0 if input redirection is to be done or
-**              will return 1 for output redirection
-**
-** Parameters: values for input_flag andint output_flag
-**********************************************************************/
-int smallsh_redirect_check(int input_flag, int output_flag)
+/*******************************************************************************************************
+** Function: smallsh_hash_dirs_changed(int last_dir)
+** Description: stats the $PATH directories up to and including last_dir and returns 1 if any of them
+**              was modified since the table was built, since a new file in an earlier directory could
+**              shadow the remembered one and a change to its own directory could have removed it
+** Parameters: index of the last directory to check
+********************************************************************************************************/
+int smallsh_hash_dirs_changed(int last_dir)
 {
-     if ((input_flag > -1) && (output_flag > -1)) //both flags have been set
+     struct stat dir_info;
+     int i;
+
+     for (i = 0; (i <= last_dir) && (i < path_hash.num_dirs); i++)
      {
-          if (input_flag < output_flag)
+          if (stat(path_hash.dirs[i].dir, &dir_info) != 0)
           {
-               return 0; //perform input redirection first
+               dir_info.st_mtim.tv_sec = -1;
+               dir_info.st_mtim.tv_nsec = 0;
           }
-          else
+
+          if ((dir_info.st_mtim.tv_sec != path_hash.dirs[i].mtime.tv_sec) || (dir_info.st_mtim.tv_nsec != path_hash.dirs[i].mtime.tv_nsec))
           {
-               return 1; //perform output redirection first
+               return 1;
           }
      }
-     else if ((input_flag > -1) && (output_flag == -1)) //only input has been set
+
+     return 0;
+}
+
+/*******************************************************************************************************
+** Function: smallsh_hash_insert(const char *name, const char *path, int dir_index)
+** Description: remembers the resolved path of a command, doubling the open addressed table when it
+**              gets three quarters full
+** Parameters: command name, resolved path and the index of the $PATH directory it was found in
+********************************************************************************************************/
+path_hash_entry *smallsh_hash_insert(const char *name, const char *path, int dir_index)
+{
+     path_hash_entry *entry;
+     unsigned int i;
+
+     if ((path_hash.count + 1) * 4 > path_hash.size * 3)
      {
-          return 0; //perform input redirection
+          path_hash_entry *old_entries = path_hash.entries;
+          int old_size = path_hash.size;
+          int j;
+
+          path_hash.size = (old_size == 0) ? PATH_HASH_SIZE : old_size * 2;
+          path_hash.entries = calloc(path_hash.size, sizeof(path_hash_entry));
+
+          for (j = 0; j < old_size; j++)
+          {
+               if (old_entries[j].name != NULL)
+               {
+                    i = smallsh_hash_string(old_entries[j].name) & (path_hash.size - 1);
+                    while (path_hash.entries[i].name != NULL)
+                    {
+                         i = (i + 1) & (path_hash.size - 1);
+                    }
+                    path_hash.entries[i] = old_entries[j];
+               }
+          }
+
+          free(old_entries);
      }
-     else //only output has been set
+
+     i = smallsh_hash_string(name) & (path_hash.size - 1);
+     while (path_hash.entries[i].name != NULL)
      {
-          return 1; //perform output redirection
+          i = (i + 1) & (path_hash.size - 1);
      }
-}
 
+     entry = &path_hash.entries[i];
+     entry->name = strdup(name);
+     entry->path = strdup(path);
+     entry->dir_index = dir_index;
+     entry->hits = 0;
+     path_hash.count++;
+
+     return entry;
+}
 
 /*******************************************************************************************************
-** Function: smallsh_bg_status_check()
-** Description: Waits for completed child processes and retrieves their status or terminating signals
-** Parameters: none
+** Function: smallsh_hash_lookup(const char *name)
+** Description: returns the absolute path a command name resolves to, searching $PATH only the first
+**              time a name is seen. Names containing a '/' are returned as they are, and a command found
+**              in or after a relative $PATH directory isn't remembered (its path is a command arena
+**              copy) since it depends on the current directory. Returns NULL if the command can't be
+**              found so the caller can report it without forking.
+** Parameters: the command name (args[0])
 ********************************************************************************************************/
-void smallsh_bg_status_check()
+const char *smallsh_hash_lookup(const char *name)
 {
-     int pid;
-     int bg_status; //status variable for background processes
+     char *path_env = getenv("PATH");
+     char candidate[PATH_MAX];
+     struct stat file_info;
+     unsigned int i;
+     int dir;
 
-     //loop to check for any finished background process
-     do
+     if (strchr(name, '/') != NULL)
      {
-          pid = waitpid(-1, &bg_status, WNOHANG);
+          return name;
+     }
 
-          if (pid > 0) //something has died
-          {
-               printf("Background pid %d is done: ", pid);
+     //a new $PATH, or unsetting it, means every remembered path may be wrong
+     if ((path_hash.path_env == NULL) || (strcmp((path_env != NULL) ? path_env : PATH_DEFAULT, path_hash.path_env) != 0))
+     {
+          smallsh_hash_clear();
+     }
 
-               if (WIFEXITED(bg_status)) //normal exit
+     if (path_hash.size > 0)
+     {
+          i = smallsh_hash_string(name) & (path_hash.size - 1);
+          while (path_hash.entries[i].name != NULL)
+          {
+               if (strcmp(path_hash.entries[i].name, name) == 0)
                {
-                    printf("Exited value: %d\n", WEXITSTATUS(bg_status));
+                    if (smallsh_hash_dirs_changed(path_hash.entries[i].dir_index) == 0)
+                    {
+                         path_hash.entries[i].hits++;
+                         return path_hash.entries[i].path;
+                    }
+
+                    smallsh_hash_clear(); //a directory changed, search again below
+                    break;
                }
-               else if (WIFSIGNALED(bg_status) != 0) //it got terminated
+               i = (i + 1) & (path_hash.size - 1);
+          }
+     }
+
+     for (dir = 0; dir < path_hash.num_dirs; dir++)
+     {
+          if (snprintf(candidate, sizeof(candidate), "%s/%s", path_hash.dirs[dir].dir, name) >= (int)sizeof(candidate))
+          {
+               continue;
+          }
+
+          if ((stat(candidate, &file_info) == 0) && S_ISREG(file_info.st_mode) && (access(candidate, X_OK) == 0))
+          {
+               path_hash_entry *entry;
+               char *uncached;
+
+               if (dir >= path_hash.first_relative)
                {
-                    printf("terminated by signal %d\n", WTERMSIG(bg_status));
+                    uncached = smallsh_arena_alloc(&command_arena, strlen(candidate) + 1);
+                    strcpy(uncached, candidate);
+                    return uncached;
                }
+
+               entry = smallsh_hash_insert(name, candidate, dir);
+               entry->hits++;
+               return entry->path;
           }
-     } while (pid > 0);
+     }
+
+     return NULL;
 }
 
 /*******************************************************************************************************
-** Function: smallsh_bg_list_insert(bg_child *pointer, int bg_pid)
-** Description: inserts and allocates memory for new background process id into the linked list
-** Parameters: pointer to the head of the linked list and the value to add for the new node
+** Function: smallsh_hash_builtin(char **args)
+** Description: built in "hash": lists remembered commands, "hash -r" forgets them all and
+**              "hash name..." looks the names up and remembers them. Returns the exit status.
+** Parameters: the args array
 ********************************************************************************************************/
-void smallsh_bg_list_insert(bg_child *pointer, int bg_pid)
+int smallsh_hash_builtin(char **args)
 {
-     /* Iterate through the list till we encounter the last node.*/
-     while (pointer->next != NULL)
+     int status = 0;
+     int i;
+
+     if (args[1] == NULL)
+     {
+          if (path_hash.count == 0)
+          {
+               printf("smallsh: hash table empty\n");
+               return 0;
+          }
+
+          printf("hits\tcommand\n");
+          for (i = 0; i < path_hash.size; i++)
+          {
+               if (path_hash.entries[i].name != NULL)
+               {
+                    printf("%4d\t%s\n", path_hash.entries[i].hits, path_hash.entries[i].path);
+               }
+          }
+          return 0;
+     }
+
+     if (strcmp(args[1], "-r") == 0)
+     {
+          smallsh_hash_clear();
+          return 0;
+     }
+
+     for (i = 1; args[i] != NULL; i++)
      {
-          pointer = pointer->next;
+          if (smallsh_hash_lookup(args[i]) == NULL)
+          {
+               printf("smallsh: hash: %s: not found\n", args[i]);
+               status = 1;
+          }
      }
-     /* Allocate memory for the new bg_child node and put its pid in it.*/
-     pointer->next = (bg_child *)malloc(sizeof(bg_child));
-     pointer = pointer->next;
-     pointer->bg_pid = bg_pid;
-     pointer->next = NULL;
-}
\ No newline at end of file
+
+     return status;
+}